@@ -0,0 +1,1165 @@
+/*
+This file contains the benchmarks used to measure the renderer. Each benchmark
+is selected from the command line with --benchmark <name>, and uses the
+frame configuration given by the rest of the arguments
+*/
+
+
+#pragma once
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+#include "lights2d/lights2d.h"
+#include "lights2d/src/sdf_program.h"
+#include "scenes.h"
+#include <chrono>
+#include <filesystem>
+#include <execution>
+#include <iomanip>
+#include <random>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include <tbb/info.h>
+
+using namespace Lights2D;
+
+namespace Benchmarks
+{
+
+    template <typename Function>
+    static double measure_seconds(Function function)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    static std::vector<Vec2> random_points(uint32_t count, Vec2 extent)
+    {
+        // Uniform in [-extent, extent], the same points on every run
+        std::vector<Vec2> points(count);
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+        for (Vec2& point : points)
+            point = { distribution(generator) * extent.x, distribution(generator) * extent.y };
+        return points;
+    }
+
+    template <typename Distance>
+    static double evaluations_per_second(const std::vector<Vec2>& points, Distance distance)
+    {
+        // Accumulates the distances, so the calls aren't optimized away
+        float checksum = 0.0f;
+        double seconds = measure_seconds([&]() {
+            for (const Vec2& point : points)
+                checksum += distance(point);
+        });
+        return checksum == INFINITY ? 0.0 : points.size() / seconds;
+    }
+
+    template <size_t N>
+    static bool is_listed(const char* (&names)[N], const char* name)
+    {
+        return std::find_if(std::begin(names), std::end(names), [&](const char* n) { return std::string(n) == name; }) != std::end(names);
+    }
+
+    static void tile_scheduling(FrameConfig config, uint32_t max_threads)
+    {
+        /*
+        Compares the per row scheduling against tiles of 16x16 and 32x32 pixels.
+        Efficiency is the single thread time divided by (time * threads), that is,
+        the fraction of the available cores that did useful work
+        */
+        std::pair<const char*, Scene> scenes[] = {
+            { "convex_lens", compile_scene<Scenes::ConvexLens>() },
+            { "glass_metaballs", compile_scene<Scenes::GlassMetaballs>() }
+        };
+
+        std::vector<uint32_t> thread_counts;
+        for (uint32_t threads = 1; threads < max_threads; threads *= 2)
+            thread_counts.push_back(threads);
+        thread_counts.push_back(max_threads);
+
+        auto image = std::make_shared<Image>(config.width, config.height);
+
+        for (auto& [name, scene] : scenes)
+        {
+            std::cout << name << " " << config.width << "x" << config.height << " " << config.samples << "spp" << std::endl;
+            std::cout << std::setw(8) << "threads"
+                      << std::setw(20) << "rows"
+                      << std::setw(20) << "tiles 16x16"
+                      << std::setw(20) << "tiles 32x32" << std::endl;
+
+            double single_thread_time = 0.0;
+            for (uint32_t threads : thread_counts)
+            {
+                // Allows more workers than cores, to reproduce large nodes on smaller machines
+                tbb::global_control parallelism(tbb::global_control::max_allowed_parallelism, threads);
+
+                config.threads = threads;
+                Renderer renderer(config, scene, 0.0f, image);
+
+                // Per row scheduling, as it was done before tiles
+                std::vector<Tile> rows(config.height);
+                for (uint32_t y = 0; y < config.height; y++)
+                    rows[y] = { 0, y, config.width, y + 1 };
+                tbb::task_arena arena(static_cast<int>(threads));
+                double rows_time = measure_seconds([&]() {
+                    arena.execute([&]() {
+                        std::for_each(
+                            std::execution::par_unseq,
+                            rows.begin(),
+                            rows.end(),
+                            [&renderer](const Tile& row) { renderer.render_tile(row); });
+                    });
+                });
+
+                double tile_times[2];
+                uint32_t tile_sizes[2] = { 16, 32 };
+                for (uint32_t i = 0; i < 2; i++)
+                {
+                    config.tile_size = tile_sizes[i];
+                    Renderer tile_renderer(config, scene, 0.0f, image);
+                    tile_times[i] = measure_seconds([&]() { tile_renderer.render(); });
+                }
+
+                if (threads == 1)
+                    single_thread_time = std::min(rows_time, std::min(tile_times[0], tile_times[1]));
+
+                auto format = [&](double time) {
+                    std::ostringstream stream;
+                    stream << std::fixed << std::setprecision(3) << time << "s "
+                           << std::setprecision(0) << 100.0 * single_thread_time / (time * threads) << "%";
+                    return stream.str();
+                };
+
+                std::cout << std::setw(8) << threads
+                          << std::setw(20) << format(rows_time)
+                          << std::setw(20) << format(tile_times[0])
+                          << std::setw(20) << format(tile_times[1]) << std::endl;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    static void sdf_throughput()
+    {
+        /*
+        Evaluates the SDF of every scene at the same random points, the way the
+        ray marcher calls it, and prints the evaluations per second
+        */
+        std::vector<Vec2> points = random_points(1 << 20, Vec2(1.5f, 1.5f));
+
+        for (auto& [name, scene] : Scenes::all())
+        {
+            double rate = evaluations_per_second(points, [&](Vec2 point) { return scene.sdf(point, 0.25f).distance; });
+
+            std::cout << std::setw(24) << name
+                      << std::setw(10) << std::fixed << std::setprecision(2) << rate * 1e-6 << " M evaluations/s" << std::endl;
+        }
+    }
+
+    static void sdf_dispatch(const FrameConfig& config)
+    {
+        /*
+        Renders every scene with the renderer specialized for the scene type, and with
+        the std::function fallback. Both produce the same image
+        */
+        auto image = std::make_shared<Image>(config.width, config.height);
+        std::cout << std::setw(24) << "scene"
+                  << std::setw(14) << "std::function"
+                  << std::setw(14) << "inlined"
+                  << std::setw(10) << "speedup" << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            Scene erased_scene = scene;
+            Renderer erased_renderer(config, erased_scene, 0.0f, image);
+            Renderer inlined_renderer(config, scene, 0.0f, image);
+
+            double erased_time = measure_seconds([&]() { erased_renderer.render(); });
+            double inlined_time = measure_seconds([&]() { inlined_renderer.render(); });
+
+            std::cout << std::setw(24) << name
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(13) << erased_time << "s"
+                      << std::setw(13) << inlined_time << "s"
+                      << std::setw(9) << std::setprecision(2) << erased_time / inlined_time << "x" << std::endl;
+        });
+    }
+
+    template <typename SDF>
+    struct ScalarOnly
+    {
+        // Hides the template operator() of a scene, so the renderer falls back to forward differences
+        SDF sdf;
+        Nearest operator()(Vec2 pos, float time) const { return sdf(pos, time); }
+    };
+
+    static void normals(FrameConfig config)
+    {
+        /*
+        Renders every scene computing the normals with forward differences (three SDF
+        calls) and with Dual (one call). Both march scalar rays, and the difference is
+        the largest channel difference between both images
+        */
+        config.packet_width = 1;
+        auto difference_image = std::make_shared<Image>(config.width, config.height);
+        auto dual_image = std::make_shared<Image>(config.width, config.height);
+
+        std::cout << std::setw(24) << "scene"
+                  << std::setw(22) << "forward differences"
+                  << std::setw(14) << "dual"
+                  << std::setw(10) << "speedup"
+                  << std::setw(12) << "difference" << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            typedef ScalarOnly<std::decay_t<decltype(scene.sdf)>> Wrapped;
+            BasicScene<Wrapped> wrapped_scene(scene.materials, Wrapped { scene.sdf });
+
+            Renderer difference_renderer(config, wrapped_scene, 0.0f, difference_image);
+            Renderer dual_renderer(config, scene, 0.0f, dual_image);
+            double difference_time = measure_seconds([&]() { difference_renderer.render(); });
+            double dual_time = measure_seconds([&]() { dual_renderer.render(); });
+
+            const uint8_t* a = &difference_image->buffer[0].r;
+            const uint8_t* b = &dual_image->buffer[0].r;
+            int max_difference = 0;
+            for (uint32_t i = 0; i < config.width * config.height * 3; i++)
+                max_difference = std::max(max_difference, std::abs(a[i] - b[i]));
+
+            std::cout << std::setw(24) << name
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(21) << difference_time << "s"
+                      << std::setw(13) << dual_time << "s"
+                      << std::setw(9) << std::setprecision(2) << difference_time / dual_time << "x"
+                      << std::setw(12) << max_difference << std::endl;
+        });
+    }
+
+    static double rmse(const Image& a, const Image& b)
+    {
+        // Root mean square error of the 8 bit channels, scaled to [0, 1]
+        const uint8_t* pa = &a.buffer[0].r;
+        const uint8_t* pb = &b.buffer[0].r;
+        uint32_t channels = a.width * a.height * 3;
+        double sum = 0.0;
+        for (uint32_t i = 0; i < channels; i++)
+        {
+            double difference = (pa[i] - pb[i]) / 255.0;
+            sum += difference * difference;
+        }
+        return std::sqrt(sum / channels);
+    }
+
+    static void integrators(FrameConfig config)
+    {
+        /*
+        Compares quality per second of ray splitting and path tracing on the scenes with
+        the deepest ray trees. The reference is rendered with splitting and 4 times the
+        configured samples, then both integrators render with increasing samples, up to
+        the configured count. Lower RMSE at the same time is better
+        */
+        std::pair<const char*, Scene> scenes[] = {
+            { "caustics", compile_scene<Scenes::Caustics>() },
+            { "metaballs_absorption", compile_scene<Scenes::MetaballsAbsorption>() }
+        };
+
+        for (auto& [name, scene] : scenes)
+        {
+            FrameConfig reference_config = config;
+            reference_config.samples = config.samples * 4;
+            reference_config.integrator = Integrator::Splitting;
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            Renderer(reference_config, scene, 0.0f, reference).render();
+
+            std::cout << name << " " << config.width << "x" << config.height
+                      << ", reference " << reference_config.samples << "spp splitting" << std::endl;
+            std::cout << std::setw(8) << "spp"
+                      << std::setw(24) << "splitting"
+                      << std::setw(24) << "path tracing" << std::endl;
+
+            auto image = std::make_shared<Image>(config.width, config.height);
+            for (uint32_t samples = std::min(8u, config.samples); samples <= config.samples; samples *= 2)
+            {
+                std::cout << std::setw(8) << samples;
+                for (Integrator integrator : { Integrator::Splitting, Integrator::PathTracing })
+                {
+                    FrameConfig frame_config = config;
+                    frame_config.samples = samples;
+                    frame_config.integrator = integrator;
+                    Renderer renderer(frame_config, scene, 0.0f, image);
+                    double time = measure_seconds([&]() { renderer.render(); });
+
+                    std::ostringstream stream;
+                    stream << std::fixed << std::setprecision(3) << time << "s rmse " << std::setprecision(4) << rmse(*image, *reference);
+                    std::cout << std::setw(24) << stream.str();
+                }
+                std::cout << std::endl;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    static void adaptive_sampling(FrameConfig config)
+    {
+        /*
+        Renders every scene with config.samples per pixel, and adaptively with a few
+        tolerances and config.samples as the maximum. Prints the time, the average
+        samples per pixel, and the RMSE against a 4x samples reference
+        */
+        float tolerances[] = { 0.1f, 0.05f, 0.02f };
+
+        std::cout << std::setw(24) << "scene" << std::setw(26) << "fixed";
+        for (float tolerance : tolerances)
+            std::cout << std::setw(32) << ("tolerance " + std::to_string(tolerance).substr(0, 4));
+        std::cout << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            FrameConfig reference_config = config;
+            reference_config.samples = config.samples * 4;
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            Renderer(reference_config, scene, 0.0f, reference).render();
+
+            auto image = std::make_shared<Image>(config.width, config.height);
+            auto sample_counts = std::make_shared<Image>(config.width, config.height);
+            std::cout << std::setw(24) << name;
+
+            for (int i = -1; i < 3; i++)
+            {
+                FrameConfig frame_config = config;
+                frame_config.adaptive_tolerance = i < 0 ? 0.0f : tolerances[i];
+                Renderer renderer(frame_config, scene, 0.0f, image);
+                renderer.sample_count_img = sample_counts;
+                double time = measure_seconds([&]() { renderer.render(); });
+
+                double average_samples = 0.0;
+                for (uint32_t p = 0; p < config.width * config.height; p++)
+                    average_samples += sample_counts->buffer[p].r / 255.0 * config.samples;
+                average_samples /= config.width * config.height;
+
+                std::ostringstream stream;
+                stream << std::fixed << std::setprecision(3) << time << "s "
+                       << std::setprecision(0) << average_samples << "spp "
+                       << "rmse " << std::setprecision(4) << rmse(*image, *reference);
+                std::cout << std::setw(i < 0 ? 26 : 32) << stream.str();
+            }
+            std::cout << std::endl;
+        });
+    }
+
+    static void samplers(FrameConfig config)
+    {
+        /*
+        RMSE against a reference render, for every sampler and increasing samples per
+        pixel, up to config.samples. The reference uses Sobol with 16 times config.samples
+        and a different seed
+        */
+        std::pair<const char*, SamplerType> samplers[] = {
+            { "pcg", SamplerType::PCG },
+            { "sobol", SamplerType::Sobol },
+            { "r2", SamplerType::R2 },
+            { "bluenoise", SamplerType::BlueNoise }
+        };
+        std::pair<const char*, Scene> scenes[] = {
+            { "room_sdf", compile_scene<Scenes::Room>() },
+            { "circular_lens", compile_scene<Scenes::CircularLens>() },
+            { "metaballs", compile_scene<Scenes::Metaballs>() }
+        };
+
+        for (auto& [name, scene] : scenes)
+        {
+            FrameConfig reference_config = config;
+            reference_config.samples = config.samples * 16;
+            reference_config.sampler = SamplerType::Sobol;
+            reference_config.seed = 1000;
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            Renderer(reference_config, scene, 0.0f, reference).render();
+
+            std::cout << name << " " << config.width << "x" << config.height
+                      << ", reference " << reference_config.samples << "spp" << std::endl;
+            std::cout << std::setw(8) << "spp";
+            for (auto& [sampler_name, type] : samplers)
+                std::cout << std::setw(12) << sampler_name;
+            std::cout << std::endl;
+
+            auto image = std::make_shared<Image>(config.width, config.height);
+            for (uint32_t samples = std::min(4u, config.samples); samples <= config.samples; samples *= 2)
+            {
+                std::cout << std::setw(8) << samples;
+                for (auto& [sampler_name, type] : samplers)
+                {
+                    FrameConfig frame_config = config;
+                    frame_config.samples = samples;
+                    frame_config.sampler = type;
+                    Renderer(frame_config, scene, 0.0f, image).render();
+                    std::cout << std::setw(12) << std::fixed << std::setprecision(4) << rmse(*image, *reference);
+                }
+                std::cout << std::endl;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    static void output_stage(const FrameConfig& config)
+    {
+        /*
+        Converts a 1920x1080 framebuffer of random radiance to 8 bits the way render_tile
+        did (gamma_log with powf per channel, then truncation), and with the ToneMapper
+        in 8 and 16 bits, with and without dither. Runs with config.threads workers
+        */
+        constexpr uint32_t width = 1920, height = 1080, repetitions = 10;
+        Framebuffer framebuffer(width, height);
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> distribution(0.0f, 1.2f);
+        for (uint32_t i = 0; i < width * height; i++)
+        {
+            framebuffer.r[i] = distribution(generator) * 64.0f;
+            framebuffer.g[i] = distribution(generator) * 64.0f;
+            framebuffer.b[i] = distribution(generator) * 64.0f;
+            framebuffer.samples[i] = 64;
+        }
+
+        Image image(width, height);
+        Image16 image16(width, height);
+        int concurrency = config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(config.threads);
+        tbb::task_arena arena(concurrency);
+
+        auto per_frame = [&](auto function) {
+            double seconds = 0.0;
+            arena.execute([&]() { seconds = measure_seconds([&]() {
+                for (uint32_t i = 0; i < repetitions; i++)
+                    function();
+            }); });
+            return seconds / repetitions * 1e3;
+        };
+
+        double previous = per_frame([&]() {
+            tbb::parallel_for(tbb::blocked_range<uint32_t>(0, height, 8), [&](const tbb::blocked_range<uint32_t>& rows) {
+                for (uint32_t y = rows.begin(); y < rows.end(); y++)
+                    for (uint32_t x = 0; x < width; x++)
+                    {
+                        Color<float> color = Utils::gamma_log(framebuffer.radiance(x, y));
+                        image.set_pixel(x, y, (Color<uint8_t>)Color<float>::clamp(color, 0, 1.0f));
+                    }
+            });
+        });
+
+        ToneMapper tone_mapper(1.0f, 2.2f, false);
+        ToneMapper dithered_tone_mapper(1.0f, 2.2f, true);
+        BlueNoiseSampler::tile();
+        double mapped_8 = per_frame([&]() { tone_mapper(framebuffer, image); });
+        double mapped_16 = per_frame([&]() { tone_mapper(framebuffer, image16); });
+        double dithered_8 = per_frame([&]() { dithered_tone_mapper(framebuffer, image); });
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(28) << "powf per pixel, 8 bit" << std::setw(10) << previous << " ms" << std::endl
+                  << std::setw(28) << "tone mapper, 8 bit" << std::setw(10) << mapped_8 << " ms" << std::endl
+                  << std::setw(28) << "tone mapper, 16 bit" << std::setw(10) << mapped_16 << " ms" << std::endl
+                  << std::setw(28) << "tone mapper, 8 bit dither" << std::setw(10) << dithered_8 << " ms" << std::endl;
+    }
+
+    static void progressive(FrameConfig config, uint32_t pass_samples)
+    {
+        /*
+        Renders every scene progressively with a few time budgets, and no sample limit.
+        Prints the passes and samples per pixel reached, the time it actually took, and
+        the RMSE against a config.samples reference
+        */
+        float budgets[] = { 0.05f, 0.1f, 0.2f, 0.4f };
+
+        std::cout << std::setw(24) << "scene";
+        for (float budget : budgets)
+            std::cout << std::setw(30) << (std::to_string(static_cast<int>(budget * 1000)) + "ms");
+        std::cout << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            Renderer(config, scene, 0.0f, reference).render();
+
+            auto image = std::make_shared<Image>(config.width, config.height);
+            std::cout << std::setw(24) << name;
+            for (float budget : budgets)
+            {
+                Renderer renderer(config, scene, 0.0f, image);
+                uint32_t passes = 0;
+                uint32_t samples = 0;
+                double time = measure_seconds([&]() {
+                    samples = renderer.render_progressive({ pass_samples, 0, budget },
+                        [&](std::shared_ptr<const Image>, uint32_t) { passes++; });
+                });
+
+                std::ostringstream stream;
+                stream << passes << "x " << samples << "spp " << std::fixed << std::setprecision(3) << time << "s "
+                       << "rmse " << std::setprecision(4) << rmse(*image, *reference);
+                std::cout << std::setw(30) << stream.str();
+            }
+            std::cout << std::endl;
+        });
+    }
+
+    static void sequence_pipelining(const FrameConfig& config, FrameRenderCallback encode)
+    {
+        /*
+        Renders 16 frames of metaballs, passing each to encode. First frame after frame,
+        as render_sequence used to (render, then the callback, then the next frame), and
+        then with the pipelined render_sequence and a few ring sizes
+        */
+        SequenceConfig sequence_config = { 0.0f, 15.0f, 1.0f };
+        auto scene = compile_scene<Scenes::Metaballs>();
+
+        double sequential_time = measure_seconds([&]() {
+            auto image = std::make_shared<Image>(config.width, config.height);
+            for (uint32_t frame = 0; frame < 16; frame++)
+            {
+                FrameConfig frame_config = config;
+                frame_config.seed = config.seed + frame;
+                Renderer(frame_config, scene, static_cast<float>(frame), image).render();
+                encode(image, frame);
+            }
+        });
+        std::cout << std::setw(16) << "sequential" << std::fixed << std::setprecision(3) << std::setw(10) << sequential_time << "s" << std::endl;
+
+        for (uint32_t in_flight : { 1u, 2u, 3u, 4u })
+        {
+            sequence_config.frames_in_flight = in_flight;
+            double time = measure_seconds([&]() { render_sequence(config, sequence_config, scene, encode); });
+            std::cout << std::setw(16) << ("pipelined x" + std::to_string(in_flight)) << std::setw(10) << time << "s" << std::endl;
+        }
+    }
+
+    static void sequence_throughput(const FrameConfig& config)
+    {
+        /*
+        Frames per second of a 240 frame sequence of metaballs and circle_cut, rendered
+        one frame after another, each with a new renderer, and with render_sequence,
+        which renders several frames at once on a shared arena
+        */
+        constexpr uint32_t frames = 240;
+        SequenceConfig sequence_config = { 0.0f, (frames - 1) / 24.0f, 24.0f };
+        auto discard = [](std::shared_ptr<Image>, uint32_t) {};
+
+        auto measure = [&](const char* name, const auto& scene) {
+            double one_by_one = measure_seconds([&]() {
+                int concurrency = config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(config.threads);
+                tbb::task_arena arena(concurrency);
+                auto image = std::make_shared<Image>(config.width, config.height);
+                for (uint32_t frame = 0; frame < frames; frame++)
+                {
+                    FrameConfig frame_config = config;
+                    frame_config.seed = config.seed + frame;
+                    Renderer renderer(frame_config, scene, frame / 24.0f, image);
+                    arena.execute([&]() { renderer.render_in_arena(); });
+                }
+            });
+            double concurrent = measure_seconds([&]() { render_sequence(config, sequence_config, scene, discard); });
+
+            std::cout << std::setw(16) << name << std::fixed << std::setprecision(1)
+                      << std::setw(14) << frames / one_by_one << " fps"
+                      << std::setw(14) << frames / concurrent << " fps" << std::endl;
+        };
+
+        std::cout << std::setw(16) << "scene" << std::setw(18) << "one by one" << std::setw(18) << "concurrent" << std::endl;
+        measure("metaballs", compile_scene<Scenes::Metaballs>());
+        measure("circle_cut", compile_scene<Scenes::CircleCut>());
+    }
+
+    static void output_sinks(const FrameConfig& config, FrameRenderCallback write_png)
+    {
+        /*
+        Time to output 240 copies of a rendered frame: a PNG file per frame with
+        write_png, RGB24 and Y4M streamed to /dev/null, and a raw sequence file in the
+        temporary directory, which is then mapped and read back
+        */
+        constexpr uint32_t frames = 240;
+        auto image = std::make_shared<Image>(config.width, config.height);
+        Renderer(config, compile_scene<Scenes::Metaballs>(), 0.0f, image).render();
+
+        auto report = [](const char* name, double seconds) {
+            std::cout << std::setw(12) << name << std::fixed << std::setprecision(2)
+                      << std::setw(10) << seconds * 1000.0 << "ms" << std::setw(10) << seconds * 1e6 / frames << "us/frame" << std::endl;
+        };
+
+        report("png", measure_seconds([&]() {
+            for (uint32_t frame = 0; frame < frames; frame++)
+                write_png(image, frame);
+        }));
+
+        for (StreamFormat format : { StreamFormat::RGB24, StreamFormat::Y4M })
+        {
+            auto sink = StreamSink::open_target("/dev/null", format, 24.0f);
+            report(format == StreamFormat::RGB24 ? "rgb24" : "y4m", measure_seconds([&]() {
+                for (uint32_t frame = 0; frame < frames; frame++)
+                    sink->write(*image, frame);
+            }));
+        }
+
+        std::string path = (std::filesystem::temp_directory_path() / "lights2d_benchmark.l2rs").string();
+        report("raw", measure_seconds([&]() {
+            RawSequenceWriter writer(path, config.width, config.height, frames, 24.0f);
+            for (uint32_t frame = 0; frame < frames; frame++)
+                writer.write(*image, frame);
+        }));
+
+        uint64_t checksum = 0;
+        report("raw read", measure_seconds([&]() {
+            RawSequence sequence(path);
+            for (uint32_t frame = 0; frame < sequence.frame_count; frame++)
+                checksum += sequence.frame(frame)[frame % (config.width * config.height)].g;
+        }));
+        std::filesystem::remove(path);
+    }
+
+    static void png_encoding(FrameConfig config, std::function<size_t(const Image&)> stb_encode)
+    {
+        /*
+        Encodes a 3840x2160 frame, metaballs rendered at a quarter of the size and
+        scaled up, with stb_encode, and with PngEncoder at a few levels and strategies,
+        on one worker and on every worker. Prints the time and the size of the file
+        */
+        config.width = 960;
+        config.height = 540;
+        config.aspect_ratio = 960.0f / 540.0f;
+        auto small = std::make_shared<Image>(config.width, config.height);
+        Renderer(config, compile_scene<Scenes::Metaballs>(), 0.0f, small).render();
+
+        Image frame(3840, 2160);
+        for (uint32_t y = 0; y < frame.height; y++)
+        {
+            for (uint32_t x = 0; x < frame.width; x++)
+            {
+                // Bilinear, so the gradients stay smooth as in a 4K render
+                float u = std::max((x + 0.5f) / 4.0f - 0.5f, 0.0f), v = std::max((y + 0.5f) / 4.0f - 0.5f, 0.0f);
+                uint32_t x0 = std::min(static_cast<uint32_t>(u), small->width - 2), y0 = std::min(static_cast<uint32_t>(v), small->height - 2);
+                float fx = std::min(u - x0, 1.0f), fy = std::min(v - y0, 1.0f);
+                auto at = [&](uint32_t px, uint32_t py) { return small->buffer[px + py * small->width]; };
+                auto blend = [&](uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+                    return static_cast<uint8_t>((a * (1 - fx) + b * fx) * (1 - fy) + (c * (1 - fx) + d * fx) * fy + 0.5f);
+                };
+                Color<uint8_t> a = at(x0, y0), b = at(x0 + 1, y0), c = at(x0, y0 + 1), d = at(x0 + 1, y0 + 1);
+                frame.buffer[x + y * frame.width] = Color<uint8_t>(blend(a.r, b.r, c.r, d.r), blend(a.g, b.g, c.g, d.g), blend(a.b, b.b, c.b, d.b));
+            }
+        }
+
+        auto report = [](const std::string& name, double seconds, size_t bytes) {
+            std::cout << std::setw(28) << name << std::fixed << std::setprecision(1)
+                      << std::setw(10) << seconds * 1000.0 << "ms" << std::setw(10) << bytes / 1024.0 << "KB" << std::endl;
+        };
+
+        size_t stb_bytes = 0;
+        double stb_time = measure_seconds([&]() { stb_bytes = stb_encode(frame); });
+        report("stbi_write_png", stb_time, stb_bytes);
+
+        struct Setting { const char* name; int level; int strategy; };
+        Setting settings[] = {
+            { "level 1", 1, Z_DEFAULT_STRATEGY },
+            { "level 1 rle", 1, Z_RLE },
+            { "level 6", 6, Z_DEFAULT_STRATEGY },
+            { "level 9", 9, Z_DEFAULT_STRATEGY },
+        };
+
+        uint32_t workers = config.threads == 0 ? static_cast<uint32_t>(tbb::info::default_concurrency()) : config.threads;
+        for (uint32_t threads : { 1u, workers })
+        {
+            tbb::task_arena arena(static_cast<int>(threads));
+            for (const Setting& setting : settings)
+            {
+                PngConfig png_config;
+                png_config.level = setting.level;
+                png_config.strategy = setting.strategy;
+                PngEncoder encoder(png_config);
+
+                // The first frame allocates the buffers of the encoder, the second one reuses them
+                size_t bytes = 0;
+                arena.execute([&]() { bytes = encoder.encode(frame).size(); });
+                double time = measure_seconds([&]() { arena.execute([&]() { encoder.encode(frame); }); });
+                report(std::string(setting.name) + ", " + std::to_string(threads) + " threads", time, bytes);
+            }
+            if (workers == 1)
+                break;
+        }
+    }
+
+    static void packet_marching(FrameConfig config)
+    {
+        /*
+        Renders every scene marching the primary rays one at a time, in packets of 4,
+        and in packets of 8 when the CPU supports AVX2. The speedup is relative to the
+        scalar render, and the images of every width are compared with it
+        */
+        std::vector<uint32_t> widths = { 1, 4 };
+        if (Simd::cpu_supports_avx2())
+            widths.push_back(8);
+
+        std::cout << std::setw(24) << "scene";
+        for (uint32_t width : widths)
+            std::cout << std::setw(18) << ("width " + std::to_string(width));
+        std::cout << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            std::cout << std::setw(24) << name;
+
+            double scalar_time = 0.0;
+            std::vector<uint8_t> scalar_pixels;
+            for (uint32_t width : widths)
+            {
+                config.packet_width = width;
+                auto image = std::make_shared<Image>(config.width, config.height);
+                Renderer renderer(config, scene, 0.0f, image);
+                double time = measure_seconds([&]() { renderer.render(); });
+
+                // Largest difference of a channel with the scalar image
+                int max_difference = 0;
+                if (width == 1)
+                {
+                    scalar_time = time;
+                    scalar_pixels.assign(&image->buffer[0].r, &image->buffer[0].r + config.width * config.height * 3);
+                }
+                const uint8_t* pixels = &image->buffer[0].r;
+                for (size_t i = 0; i < scalar_pixels.size(); i++)
+                    max_difference = std::max(max_difference, std::abs(scalar_pixels[i] - pixels[i]));
+
+                std::ostringstream stream;
+                stream << std::fixed << std::setprecision(3) << time << "s "
+                       << std::setprecision(2) << scalar_time / time << "x"
+                       << (max_difference == 0 ? "" : " ~" + std::to_string(max_difference));
+                std::cout << std::setw(18) << stream.str();
+            }
+            std::cout << std::endl;
+        });
+    }
+
+    static void regions(FrameConfig config)
+    {
+        /*
+        Renders sample_scene, then re-renders centered regions of decreasing size into
+        an image filled with a marker color, and two overlapping regions. Prints the time
+        relative to the whole frame, and checks that the pixels inside the regions are
+        the same as the whole frame, and the others still have the marker
+        */
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            if (std::string(name) != "sample_scene")
+                return;
+
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            double full_time = measure_seconds([&]() { Renderer(config, scene, 0.0f, reference).render(); });
+            std::cout << "whole frame " << config.width << "x" << config.height << ": " << std::fixed << std::setprecision(3) << full_time << "s" << std::endl;
+
+            std::vector<std::pair<std::string, std::vector<Tile>>> cases;
+            for (uint32_t divisor : { 2u, 4u, 8u, 16u })
+            {
+                uint32_t w = config.width / divisor, h = config.height / divisor;
+                uint32_t x0 = (config.width - w) / 2, y0 = (config.height - h) / 2;
+                cases.push_back({ "1/" + std::to_string(divisor * divisor) + " area", { { x0, y0, x0 + w, y0 + h } } });
+            }
+            cases.push_back({ "2 overlapping", { { 0, 0, config.width / 2, config.height / 2 }, { config.width / 4, config.height / 4, config.width * 3 / 4, config.height * 3 / 4 } } });
+
+            const Color<uint8_t> marker(255, 0, 255);
+            for (auto& [label, rectangles] : cases)
+            {
+                auto image = std::make_shared<Image>(config.width, config.height);
+                for (uint32_t y = 0; y < config.height; y++)
+                    for (uint32_t x = 0; x < config.width; x++)
+                        image->set_pixel(x, y, marker);
+
+                FrameConfig region_config = config;
+                region_config.regions = rectangles;
+                double time = measure_seconds([&]() { Renderer(region_config, scene, 0.0f, image).render(); });
+
+                uint32_t wrong = 0;
+                for (uint32_t y = 0; y < config.height; y++)
+                {
+                    for (uint32_t x = 0; x < config.width; x++)
+                    {
+                        bool inside = std::any_of(rectangles.begin(), rectangles.end(), [&](const Tile& tile) {
+                            return x >= tile.x0 && x < tile.x1 && y >= tile.y0 && y < tile.y1;
+                        });
+                        const Color<uint8_t>& expected = inside ? reference->buffer[x + y * config.width] : marker;
+                        const Color<uint8_t>& pixel = image->buffer[x + y * config.width];
+                        wrong += pixel.r != expected.r || pixel.g != expected.g || pixel.b != expected.b;
+                    }
+                }
+                std::cout << std::setw(16) << label << std::setw(10) << time << "s"
+                          << std::setw(10) << std::setprecision(3) << time / full_time << "x"
+                          << (wrong == 0 ? "  pixels match" : "  " + std::to_string(wrong) + " pixels differ") << std::endl;
+            }
+        });
+    }
+
+    static void radiance_cascades(FrameConfig config)
+    {
+        /*
+        Compares the radiance cascades engine with the Monte Carlo engine on room_sdf and
+        metaballs. The reference is a path traced render with 16 times config.samples,
+        the Monte Carlo renders take config.samples and a quarter of them. Cascades are
+        rendered with 4 and 8 directions in the first level, and two interval lengths
+        */
+        struct Variant
+        {
+            std::string label;
+            Engine engine;
+            uint32_t samples;
+            uint32_t directions;
+            float interval;
+        };
+        std::vector<Variant> variants = {
+            { "mc " + std::to_string(config.samples / 4) + "spp", Engine::MonteCarlo, std::max(config.samples / 4, 1u), 0, 0.0f },
+            { "mc " + std::to_string(config.samples) + "spp", Engine::MonteCarlo, config.samples, 0, 0.0f },
+            { "rc 4 dir 1px", Engine::RadianceCascades, 1, 4, 1.0f },
+            { "rc 4 dir 2px", Engine::RadianceCascades, 1, 4, 2.0f },
+            { "rc 8 dir 2px", Engine::RadianceCascades, 1, 8, 2.0f },
+        };
+
+        config.integrator = Integrator::PathTracing;
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            if (std::string(name) != "room_sdf" && std::string(name) != "metaballs")
+                return;
+
+            FrameConfig reference_config = config;
+            reference_config.samples = config.samples * 16;
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            double reference_time = measure_seconds([&]() { Renderer(reference_config, scene, 0.0f, reference).render(); });
+            std::cout << name << " " << config.width << "x" << config.height << ", reference " << reference_config.samples
+                      << "spp " << std::fixed << std::setprecision(3) << reference_time << "s" << std::endl;
+
+            for (const Variant& variant : variants)
+            {
+                FrameConfig variant_config = config;
+                variant_config.engine = variant.engine;
+                variant_config.samples = variant.samples;
+                variant_config.cascade_directions = variant.directions;
+                variant_config.cascade_interval = variant.interval;
+
+                auto image = std::make_shared<Image>(config.width, config.height);
+                double time = measure_seconds([&]() { Renderer(variant_config, scene, 0.0f, image).render(); });
+                std::cout << std::setw(16) << variant.label << std::setw(10) << std::setprecision(3) << time << "s"
+                          << "  rmse " << std::setprecision(4) << rmse(*image, *reference) << std::endl;
+            }
+        });
+    }
+
+    static void distance_grid(FrameConfig config)
+    {
+        /*
+        Renders the static scenes, and glass_metaballs, whose lights are static, marching
+        the SDF and marching baked grids of a few error bounds. Prints the time to bake
+        the grid, its memory, the render time and speedup, and the RMSE against the
+        render that marches the SDF
+        */
+        const char* names[] = { "caustics", "room_sdf", "convex_lens", "concave_lens", "semicircular_lens", "circular_lens", "glass_metaballs" };
+        float errors[] = { 0.004f, 0.001f, 0.00025f };
+
+        std::cout << std::setw(20) << "scene" << std::setw(10) << "sdf";
+        for (float error : errors)
+            std::cout << std::setw(45) << ("grid " + std::to_string(error).substr(0, 7));
+        std::cout << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            if (!is_listed(names, name))
+                return;
+
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            double sdf_time = measure_seconds([&]() { Renderer(config, scene, 0.25f, reference).render(); });
+            std::cout << std::setw(20) << name << std::setw(9) << std::fixed << std::setprecision(3) << sdf_time << "s";
+
+            for (float error : errors)
+            {
+                FrameConfig grid_config = config;
+                grid_config.grid_error = error;
+                auto image = std::make_shared<Image>(config.width, config.height);
+                Renderer renderer(grid_config, scene, 0.25f, image);
+                double bake_time = measure_seconds([&]() { renderer.bake_grid(); });
+                double time = measure_seconds([&]() { renderer.render(); });
+
+                std::ostringstream stream;
+                stream << " bake " << std::fixed << std::setprecision(3) << bake_time << "s " << renderer.grid->bytes() / 1024 << "KB "
+                       << time << "s " << std::setprecision(2) << sdf_time / time << "x rmse " << std::setprecision(4) << rmse(*image, *reference);
+                std::cout << std::setw(45) << stream.str();
+            }
+            std::cout << std::endl;
+        });
+    }
+
+    static void sdf_program(FrameConfig config)
+    {
+        /*
+        Compiles the SDF of a few scenes to tapes pruned per tile. Prints the graph size,
+        the length of the whole tape and the mean of the cell tapes, the distinct tapes and
+        the compile time, then the SDF evaluations per second of the compiled C++, the whole
+        tape and the cell tapes, with the largest difference of the tapes
+        */
+        std::vector<Vec2> points = random_points(1 << 16, Vec2(config.aspect_ratio, 1.0f));
+
+        const char* names[] = { "sample_scene", "room_sdf", "metaballs", "caustics", "glass_metaballs" };
+        std::cout << std::setw(20) << "scene" << std::setw(8) << "nodes" << std::setw(8) << "full" << std::setw(8) << "cell"
+                  << std::setw(8) << "tapes" << std::setw(10) << "compile" << std::setw(10) << "sdf M/s" << std::setw(10) << "full M/s"
+                  << std::setw(10) << "cell M/s" << std::setw(10) << "error" << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            if (!is_listed(names, name))
+                return;
+            if constexpr (SdfProgram::compilable<std::decay_t<decltype(scene.sdf)>>)
+            {
+                Vec2 extent(config.aspect_ratio + 0.5f, 1.5f);
+                std::unique_ptr<SdfProgram> program;
+                double compile_time = measure_seconds([&]() {
+                    program = std::make_unique<SdfProgram>(scene.sdf, 0.25f, Vec2::flip(extent), extent, 2.0f * config.tile_size / config.height);
+                });
+                if (!program->valid())
+                {
+                    std::cout << std::setw(20) << name << " doesn't fit in " << SdfProgram::max_registers << " registers" << std::endl;
+                    return;
+                }
+
+                float error = 0.0f;
+                for (const Vec2& point : points)
+                {
+                    float distance = scene.sdf(point, 0.25f).distance;
+                    error = std::max(error, std::max(std::abs(program->distance(point) - distance), std::abs(program->full_distance(point) - distance)));
+                }
+                double sdf_rate = evaluations_per_second(points, [&](Vec2 point) { return scene.sdf(point, 0.25f).distance; });
+                double full_rate = evaluations_per_second(points, [&](Vec2 point) { return program->full_distance(point); });
+                double cell_rate = evaluations_per_second(points, [&](Vec2 point) { return program->distance(point); });
+
+                std::cout << std::setw(20) << name << std::setw(8) << program->graph_nodes() << std::setw(8) << program->full_length()
+                          << std::fixed << std::setprecision(1) << std::setw(8) << program->mean_cell_length() << std::setw(8) << program->tape_count()
+                          << std::setw(8) << compile_time * 1000.0 << "ms" << std::setprecision(2) << std::setw(10) << sdf_rate * 1e-6
+                          << std::setw(10) << full_rate * 1e-6 << std::setw(10) << cell_rate * 1e-6 << std::setw(10) << std::scientific << std::setprecision(1) << error
+                          << std::fixed << std::endl;
+            }
+        });
+    }
+
+    static void scene_bounds(FrameConfig config)
+    {
+        /*
+        Renders every scene with and without its bounds. Prints the SDF evaluations per
+        second at points of the frame, then for each render the time and the march
+        iterations per ray, and with the bounds the rays they ended, the iterations saved
+        and the RMSE against the render without them
+        */
+        std::vector<Vec2> points = random_points(1 << 16, Vec2(config.aspect_ratio, 1.0f));
+
+        std::cout << std::setw(24) << "scene" << std::setw(10) << "sdf M/s" << std::setw(26) << "unbounded"
+                  << std::setw(26) << "bounded" << std::setw(10) << "culled" << std::setw(10) << "saved" << std::setw(10) << "rmse" << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            double rate = evaluations_per_second(points, [&](Vec2 point) { return scene.sdf(point, 0.0f).distance; });
+
+            auto render = [&](bool bounds, std::shared_ptr<Image> image, double& time) {
+                FrameConfig render_config = config;
+                render_config.scene_bounds = bounds;
+                Renderer renderer(render_config, scene, 0.0f, image);
+                renderer.counters = std::make_shared<MarchCounters>();
+                time = measure_seconds([&]() { renderer.render(); });
+                return renderer.counters;
+            };
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            auto image = std::make_shared<Image>(config.width, config.height);
+            double unbounded_time, bounded_time;
+            std::shared_ptr<MarchCounters> unbounded = render(false, reference, unbounded_time);
+            std::shared_ptr<MarchCounters> bounded = render(true, image, bounded_time);
+
+            auto column = [](double time, const MarchCounters& counters) {
+                std::ostringstream stream;
+                stream << std::fixed << std::setprecision(3) << time << "s " << std::setprecision(1)
+                       << static_cast<double>(counters.iterations) / std::max<uint64_t>(counters.rays, 1) << " it/ray";
+                return stream.str();
+            };
+            std::cout << std::setw(24) << name << std::fixed << std::setprecision(2) << std::setw(10) << rate * 1e-6
+                      << std::setw(26) << column(unbounded_time, *unbounded) << std::setw(26) << column(bounded_time, *bounded)
+                      << std::setw(9) << std::setprecision(1) << 100.0 * bounded->culled_rays / std::max<uint64_t>(bounded->rays, 1) << "%"
+                      << std::setw(9) << 100.0 * bounded->saved_iterations / std::max<uint64_t>(unbounded->iterations, 1) << "%"
+                      << std::setw(10) << std::setprecision(4) << rmse(*image, *reference) << std::endl;
+        });
+    }
+
+    static void sphere_tracing(FrameConfig config)
+    {
+        /*
+        Renders every scene marching plainly, with over-relaxed steps, with the hit
+        footprint and with both, the ones of config or 1.6 and a quarter pixel. Prints the
+        time, the iterations per ray, the rays that ran out of iterations, the steps taken
+        back and the RMSE against a plain render with four times the iterations
+        */
+        float relaxation = config.relaxation > 1.0f ? config.relaxation : 1.6f;
+        float hit_footprint = config.hit_footprint > 0.0f ? config.hit_footprint : 0.25f;
+        struct Variant { const char* name; float relaxation, hit_footprint; };
+        const Variant variants[] = {
+            { "plain", 1.0f, 0.0f },
+            { "relaxed", relaxation, 0.0f },
+            { "footprint", 1.0f, hit_footprint },
+            { "both", relaxation, hit_footprint }
+        };
+        std::cout << "relaxation " << relaxation << ", hit footprint " << hit_footprint << " pixels" << std::endl;
+        std::cout << std::setw(24) << "scene" << std::setw(11) << "variant" << std::setw(10) << "time" << std::setw(10) << "it/ray"
+                  << std::setw(12) << "exhausted" << std::setw(12) << "back/ray" << std::setw(10) << "rmse" << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            auto render = [&](FrameConfig render_config, std::shared_ptr<Image> image, double& time) {
+                Renderer renderer(render_config, scene, 0.0f, image);
+                renderer.counters = std::make_shared<MarchCounters>();
+                time = measure_seconds([&]() { renderer.render(); });
+                return renderer.counters;
+            };
+
+            FrameConfig reference_config = config;
+            reference_config.relaxation = 1.0f;
+            reference_config.hit_footprint = 0.0f;
+            reference_config.ray_march_max_iterations *= 4;
+            auto reference = std::make_shared<Image>(config.width, config.height);
+            double reference_time;
+            render(reference_config, reference, reference_time);
+
+            for (const Variant& variant : variants)
+            {
+                FrameConfig render_config = config;
+                render_config.relaxation = variant.relaxation;
+                render_config.hit_footprint = variant.hit_footprint;
+                auto image = std::make_shared<Image>(config.width, config.height);
+                double time;
+                std::shared_ptr<MarchCounters> counters = render(render_config, image, time);
+                double rays = static_cast<double>(std::max<uint64_t>(counters->rays, 1));
+                std::cout << std::setw(24) << name << std::setw(11) << variant.name << std::fixed << std::setprecision(3)
+                          << std::setw(9) << time << "s" << std::setprecision(1) << std::setw(10) << counters->iterations / rays
+                          << std::setprecision(2) << std::setw(11) << 100.0 * counters->exhausted_rays / rays << "%"
+                          << std::setprecision(3) << std::setw(12) << counters->failed_steps / rays
+                          << std::setprecision(4) << std::setw(10) << rmse(*image, *reference) << std::endl;
+            }
+        });
+    }
+
+    static void light_sampling(FrameConfig config)
+    {
+        /*
+        Renders the scenes that declare lights with uniform rays and with a fraction of
+        them sent toward the lights, the one of config or half, at 1, 2 and 4 times the
+        samples. Prints the time and the RMSE against a render with 16 times the samples
+        and another seed, so its samples aren't the ones of the renders compared. It
+        samples the lights too, the uniform rays alone leave it noisy for the tiny lights
+        */
+        float fraction = config.light_sampling > 0.0f ? config.light_sampling : 0.5f;
+        std::cout << "light sampling " << fraction << std::endl;
+        std::cout << std::setw(24) << "scene" << std::setw(8) << "spp" << std::setw(22) << "uniform" << std::setw(22) << "lights" << std::endl;
+
+        Scenes::for_each_scene([&](const char* name, const auto& scene) {
+            if constexpr (has_lights<std::decay_t<decltype(scene.sdf)>>::value)
+            {
+                auto render = [&](float light_sampling, uint32_t samples, uint32_t seed, std::shared_ptr<Image> image) {
+                    FrameConfig render_config = config;
+                    render_config.light_sampling = light_sampling;
+                    render_config.samples = samples;
+                    render_config.seed = seed;
+                    Renderer renderer(render_config, scene, 0.0f, image);
+                    return measure_seconds([&]() { renderer.render(); });
+                };
+                auto reference = std::make_shared<Image>(config.width, config.height);
+                render(fraction, config.samples * 16, config.seed + 1, reference);
+
+                auto image = std::make_shared<Image>(config.width, config.height);
+                auto column = [&](float light_sampling, uint32_t samples) {
+                    double time = render(light_sampling, samples, config.seed, image);
+                    std::ostringstream stream;
+                    stream << std::fixed << std::setprecision(3) << time << "s " << std::setprecision(4) << rmse(*image, *reference);
+                    return stream.str();
+                };
+                for (uint32_t scale : { 1u, 2u, 4u })
+                {
+                    uint32_t samples = config.samples * scale;
+                    std::cout << std::setw(24) << name << std::setw(8) << samples << std::setw(22) << column(0.0f, samples)
+                              << std::setw(22) << column(fraction, samples) << std::endl;
+                }
+            }
+        });
+    }
+
+    static SceneDescription particle_scene(uint32_t count, float aspect_ratio)
+    {
+        // count circles spread over the frame, one in eight is a light, the rest reflect
+        SceneDescription description;
+        description.materials.push_back(Material::create_light(Color(1.0f, 0.8f, 0.5f), 2.0f));
+        description.materials.push_back(Material::create_reflective(0.5f));
+        std::mt19937 generator(count);
+        std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+        float radius = 0.5f / std::sqrt(static_cast<float>(count));
+        for (uint32_t i = 0; i < count; i++)
+        {
+            Primitive circle;
+            circle.position = Vec2(distribution(generator) * aspect_ratio, distribution(generator));
+            circle.params[0] = radius * (0.65f + 0.35f * distribution(generator));
+            circle.material = i % 8 == 0 ? 0 : 1;
+            description.objects.push_back({ circle });
+        }
+        return description;
+    }
+
+    static void primitive_scenes(FrameConfig config)
+    {
+        /*
+        Scenes of count circles, loaded as data. Prints the time to build them, to write
+        the binary form and to map it back, the SDF evaluations per second culling with the
+        hierarchy and evaluating every object, and the render time. The rainbow_sdf scene,
+        as data, compares the data driven SDF with the compiled one
+        */
+        std::vector<Vec2> points = random_points(1 << 16, Vec2(config.aspect_ratio, 1.0f));
+        auto sdf_rate = [&](const auto& sdf) {
+            return evaluations_per_second(points, [&](Vec2 point) { return sdf(point, 0.0f).distance; });
+        };
+
+        std::string path = (std::filesystem::temp_directory_path() / "lights2d_benchmark.l2sc").string();
+        auto image = std::make_shared<Image>(config.width, config.height);
+        std::cout << std::setw(10) << "objects" << std::setw(10) << "build" << std::setw(10) << "save" << std::setw(10) << "map"
+                  << std::setw(12) << "bytes" << std::setw(14) << "culled M/s" << std::setw(14) << "all M/s" << std::setw(10) << "render" << std::endl;
+
+        for (uint32_t count : { 16u, 256u, 4096u, 65536u, 1048576u })
+        {
+            SceneDescription description = particle_scene(count, config.aspect_ratio);
+            BasicScene<PrimitiveScene> scene;
+            double build_time = measure_seconds([&]() { scene = PrimitiveScene::build(description); });
+            double save_time = measure_seconds([&]() { scene.sdf.save(path); });
+            BasicScene<PrimitiveScene> mapped;
+            std::string error;
+            double map_time = measure_seconds([&]() { PrimitiveScene::load(path, mapped, error); });
+
+            double culled = sdf_rate(mapped.sdf);
+            PrimitiveScene every_object = mapped.sdf;
+            every_object.culling = false;
+            double all = count <= 4096 ? sdf_rate(every_object) : 0.0;
+            double render_time = measure_seconds([&]() { Renderer(config, mapped, 0.0f, image).render(); });
+
+            std::cout << std::setw(10) << count << std::fixed << std::setprecision(1)
+                      << std::setw(8) << build_time * 1000.0 << "ms" << std::setw(8) << save_time * 1000.0 << "ms" << std::setw(8) << map_time * 1000.0 << "ms"
+                      << std::setw(12) << mapped.sdf.bytes() << std::setprecision(2) << std::setw(14) << culled * 1e-6
+                      << std::setw(14) << (all > 0.0 ? std::to_string(all * 1e-6).substr(0, 6) : std::string("-"))
+                      << std::setw(9) << std::setprecision(3) << render_time << "s" << std::endl;
+        }
+        std::filesystem::remove(path);
+
+        // rainbow_sdf as data, the colors as gamma_exp leaves them
+        SceneDescription rainbow;
+        Color<float> colors[7] = {
+            Color<float>(148, 0, 211), Color<float>(75, 0, 130), Color<float>(0, 0, 255), Color<float>(0, 255, 0),
+            Color<float>(255, 255, 0), Color<float>(255, 127, 0), Color<float>(255, 0, 0) };
+        for (uint32_t i = 0; i < 7; i++)
+        {
+            rainbow.materials.push_back(Material::create_light(Utils::gamma_exp(colors[i] / 255.0f), 1.0f));
+            Primitive line;
+            line.type = PrimitiveType::Segment;
+            line.position = Vec2(0.0f, 0.75f - i * 1.5f / 7.0f);
+            line.params[0] = 0.35f;
+            line.params[1] = 0.01f;
+            line.material = i;
+            rainbow.objects.push_back({ line });
+        }
+
+        auto compiled = compile_scene<Scenes::Rainbow>();
+        auto data = PrimitiveScene::build(rainbow);
+        auto reference = std::make_shared<Image>(config.width, config.height);
+        double compiled_time = measure_seconds([&]() { Renderer(config, compiled, 0.0f, reference).render(); });
+        double data_time = measure_seconds([&]() { Renderer(config, data, 0.0f, image).render(); });
+        std::cout << "rainbow_sdf compiled " << std::setprecision(2) << sdf_rate(compiled.sdf) * 1e-6 << " M/s "
+                  << std::setprecision(3) << compiled_time << "s, data " << std::setprecision(2) << sdf_rate(data.sdf) * 1e-6
+                  << " M/s " << std::setprecision(3) << data_time << "s, rmse " << std::setprecision(4) << rmse(*image, *reference) << std::endl;
+    }
+}
+
+#endif
@@ -2,7 +2,11 @@
 #ifndef LIGHTS_2D_H
 #define LIGHTS_2D_H
 
+#include "src/band_render.h"
 #include "src/frame_sequence.h"
+#include "src/frame_sink.h"
+#include "src/png_encoder.h"
+#include "src/primitive_scene.h"
 #include "src/sdf_functions.h"
 
 #endif
\ No newline at end of file
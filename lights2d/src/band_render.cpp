@@ -0,0 +1,8 @@
+#include "band_render.h"
+
+namespace Lights2D {
+// The type erased band renderer is compiled once, here
+template bool render_bands<SignedDistanceFunction>(
+    const FrameConfig&, const BandConfig&, const Scene&, float, BandCallback);
+
+} // namespace Lights2D
@@ -0,0 +1,118 @@
+#pragma once
+#ifndef BAND_RENDER_H
+#define BAND_RENDER_H
+#include "renderer.h"
+#include <functional>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
+
+namespace Lights2D
+{
+    // Receives a band of rows of the frame and the row of its top, returns false to stop the render
+    typedef std::function<bool(const Image&, uint32_t)> BandCallback;
+
+    struct BandConfig
+    {
+        uint32_t band_rows = 256;           // Rows of a band, a multiple of the PNG strip rows keeps the PNG identical
+        uint32_t bands_in_flight = 0;       // Bands rendered at once or waiting for the callback, 0 picks one per worker plus one
+    };
+
+    template <typename SDF>
+    bool render_bands(
+        const FrameConfig& frame_config,
+        const BandConfig& band_config,
+        const BasicScene<SDF>& scene,
+        float time,
+        BandCallback on_band_callback)
+    {
+        /*
+        Renders a single frame as horizontal bands, top to bottom, for frames too large
+        to hold in memory. Bands go through the same pipeline as the frames of
+        render_sequence: several render at once, on the workers of one arena, and the
+        callback receives them serially, in order, so it streams them into a file. Each
+        band in flight owns a renderer whose buffers only cover the band, so the memory
+        is bands_in_flight bands, whatever the height of the frame. The pixels are the
+        same as a render of the whole frame. Returns false if the callback stopped it, or
+        right away with regions, which keep pixels of a previous image the bands don't have
+        */
+        struct Band
+        {
+            uint32_t y0;
+            uint32_t slot;
+        };
+
+        if (!frame_config.regions.empty())
+            return false;
+
+        int concurrency = frame_config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(frame_config.threads);
+        tbb::task_arena arena(concurrency);
+
+        uint32_t band_rows = std::max(std::min(band_config.band_rows, frame_config.height), 1u);
+        uint32_t ring_size = band_config.bands_in_flight > 0
+            ? band_config.bands_in_flight
+            : static_cast<uint32_t>(arena.max_concurrency()) + 1;
+
+        std::vector<std::unique_ptr<Renderer<SDF>>> renderers(ring_size);
+        for (uint32_t i = 0; i < ring_size; i++)
+        {
+            auto image = std::make_shared<Image>(frame_config.width, band_rows);
+            renderers[i] = std::make_unique<Renderer<SDF>>(frame_config, scene, time, image, Tile{ 0, 0, frame_config.width, band_rows });
+            renderers[i]->debug = false;
+        }
+
+        // Every band is of the same frame, they share a grid
+        if (frame_config.grid_error > 0.0f)
+        {
+            arena.execute([&]() { renderers[0]->bake_grid(); });
+            for (uint32_t i = 1; i < ring_size; i++)
+                renderers[i]->grid = renderers[0]->grid;
+        }
+
+        uint32_t next_row = 0;
+        uint32_t emitted = 0;
+        std::atomic<bool> stopped(false);
+
+        arena.execute([&]()
+        {
+            tbb::parallel_pipeline(
+                ring_size,
+                tbb::make_filter<void, Band>(tbb::filter_mode::serial_in_order,
+                    [&](tbb::flow_control& control) {
+                        if (next_row >= frame_config.height || stopped)
+                        {
+                            control.stop();
+                            return Band();
+                        }
+                        Band band = { next_row, emitted++ % ring_size };
+                        next_row += band_rows;
+                        return band;
+                    }) &
+                tbb::make_filter<Band, Band>(tbb::filter_mode::parallel,
+                    [&](Band band) {
+                        // The last band is shorter, its renderer gets smaller buffers
+                        Renderer<SDF>& band_renderer = *renderers[band.slot];
+                        if (!stopped)
+                        {
+                            band_renderer.set_region(Tile{ 0, band.y0, frame_config.width, std::min(band.y0 + band_rows, frame_config.height) });
+                            band_renderer.render_in_arena();
+                        }
+                        return band;
+                    }) &
+                tbb::make_filter<Band, void>(tbb::filter_mode::serial_in_order,
+                    [&](Band band) {
+                        if (!stopped && !on_band_callback(*renderers[band.slot]->img, band.y0))
+                            stopped = true;
+                    })
+            );
+        });
+        return !stopped;
+    }
+
+    extern template bool render_bands<SignedDistanceFunction>(
+        const FrameConfig&, const BandConfig&, const Scene&, float, BandCallback);
+}
+
+#endif
@@ -0,0 +1,106 @@
+#pragma once
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include "partial_frame.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LIGHTS2D_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Lights2D
+{
+    namespace Checkpoints
+    {
+        /*
+        A checkpoint is the exact state of a frame rendered in passes: the fixed point
+        sums of every pixel and the range of sample indices they cover. Samplers are
+        addressed by the sample index, so the range is all the random state there is.
+        The fingerprint identifies the frame config, a checkpoint of another frame is
+        ignored. Every pixel took the same samples, so the counts aren't stored.
+        Layout: magic, fingerprint, width, height, sample_begin, sample_end, then the
+        r, g and b sums
+        */
+        constexpr uint32_t magic = 0x4b43324c;     // "L2CK" little endian
+        constexpr size_t header_size = 6 * sizeof(uint32_t);
+
+        // Writes to a temporary file and renames it, so a job killed while saving keeps the previous checkpoint
+        static bool save(const std::string& filepath, uint32_t fingerprint, const PartialFrame& frame)
+        {
+            std::string temporary = filepath + ".tmp";
+            {
+                std::ofstream file(temporary, std::ios::binary);
+                if (!file)
+                    return false;
+                uint32_t header[6] = { magic, fingerprint, frame.width, frame.height, frame.sample_begin, frame.sample_end };
+                file.write(reinterpret_cast<const char*>(header), sizeof(header));
+                for (const std::vector<int64_t>* channel : { &frame.r, &frame.g, &frame.b })
+                    file.write(reinterpret_cast<const char*>(channel->data()), channel->size() * sizeof(int64_t));
+                if (!file)
+                    return false;
+            }
+            std::error_code error;
+            std::filesystem::rename(temporary, filepath, error);
+            return !error;
+        }
+
+        // Fills frame from the checkpoint, if the file exists and matches the fingerprint and the size of frame
+        static bool load(const std::string& filepath, uint32_t fingerprint, PartialFrame& frame)
+        {
+            size_t channel_bytes = static_cast<size_t>(frame.width) * frame.height * sizeof(int64_t);
+            size_t file_bytes = header_size + 3 * channel_bytes;
+
+            auto restore = [&](const char* data) {
+                uint32_t header[6];
+                std::memcpy(header, data, sizeof(header));
+                if (header[0] != magic || header[1] != fingerprint || header[2] != frame.width || header[3] != frame.height)
+                    return false;
+                frame.sample_begin = header[4];
+                frame.sample_end = header[5];
+                const char* channels = data + header_size;
+                std::memcpy(frame.r.data(), channels, channel_bytes);
+                std::memcpy(frame.g.data(), channels + channel_bytes, channel_bytes);
+                std::memcpy(frame.b.data(), channels + 2 * channel_bytes, channel_bytes);
+                std::fill(frame.samples.begin(), frame.samples.end(), frame.sample_end - frame.sample_begin);
+                return true;
+            };
+
+#ifdef LIGHTS2D_MMAP
+            // Mapped, the sums are copied straight from the page cache
+            int descriptor = open(filepath.c_str(), O_RDONLY);
+            if (descriptor < 0)
+                return false;
+            struct stat status;
+            bool restored = false;
+            if (fstat(descriptor, &status) == 0 && static_cast<size_t>(status.st_size) == file_bytes)
+            {
+                void* mapping = mmap(nullptr, file_bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (mapping != MAP_FAILED)
+                {
+                    madvise(mapping, file_bytes, MADV_SEQUENTIAL);
+                    restored = restore(static_cast<const char*>(mapping));
+                    munmap(mapping, file_bytes);
+                }
+            }
+            close(descriptor);
+            return restored;
+#else
+            std::ifstream file(filepath, std::ios::binary);
+            std::vector<char> data(file_bytes);
+            if (!file.read(data.data(), file_bytes) || file.peek() != EOF)
+                return false;
+            return restore(data.data());
+#endif
+        }
+    }
+}
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+#ifndef DISTANCE_GRID_H
+#define DISTANCE_GRID_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <tbb/parallel_for.h>
+#include "vec2.h"
+
+namespace Lights2D
+{
+    class DistanceGrid
+    {
+        /*
+        Signed distances of the scene baked on a two level grid. The coarse level covers
+        the bounds with cells of brick_cells fine cells per side. Cells the surface may
+        cross also get a brick of fine samples, the others are interpolated from the coarse
+        corners. For an exact SDF, which changes by at most the distance moved, bilinear
+        interpolation is off by at most the weighted distance to the corners, below
+        spacing / sqrt(2), so the interpolated distance minus that is a lower bound of the
+        true one, a step the march can always take.
+        Near a surface the bound is useless and the march evaluates the SDF itself, so hits
+        and materials are exact, and the grid only stores distances. The fine spacing is
+        the error bound, doubled until the bricks fit in the memory budget
+        */
+        public:
+            static constexpr uint32_t brick_cells = 8;
+            float baked_time = 0.0f;            // Time the SDF was evaluated at, when it depends on it
+
+        public:
+            DistanceGrid(Vec2 bounds_min, Vec2 bounds_max, float error_bound, size_t memory_budget)
+                :   _min(bounds_min),
+                    _max(bounds_max),
+                    _requested_error(std::max(error_bound, 1e-5f)),
+                    _memory_budget(memory_budget)
+                    {}
+
+            // Samples distance(Vec2) -> float, in parallel on the workers of the current arena
+            template <typename Distance>
+            void bake(const Distance& distance)
+            {
+                for (float spacing = _requested_error;; spacing *= 2.0f)
+                {
+                    _fine_spacing = spacing;
+                    _coarse_spacing = spacing * brick_cells;
+                    _inverse_coarse_spacing = 1.0f / _coarse_spacing;
+                    _cells_x = static_cast<uint32_t>(std::ceil((_max.x - _min.x) / _coarse_spacing));
+                    _cells_y = static_cast<uint32_t>(std::ceil((_max.y - _min.y) / _coarse_spacing));
+                    size_t coarse_bytes = static_cast<size_t>(_cells_x + 1) * (_cells_y + 1) * sizeof(float)
+                        + static_cast<size_t>(_cells_x) * _cells_y * sizeof(int32_t);
+                    if (coarse_bytes > _memory_budget && _cells_x > 1 && _cells_y > 1)
+                        continue;
+
+                    _coarse.resize(static_cast<size_t>(_cells_x + 1) * (_cells_y + 1));
+                    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, _cells_y + 1, 4), [&](const tbb::blocked_range<uint32_t>& rows) {
+                        for (uint32_t y = rows.begin(); y != rows.end(); y++)
+                            for (uint32_t x = 0; x <= _cells_x; x++)
+                                _coarse[y * (_cells_x + 1) + x] = distance(Vec2(_min.x + x * _coarse_spacing, _min.y + y * _coarse_spacing));
+                    });
+
+                    // The surface can only cross a cell if a corner is closer to it than the cell diagonal
+                    _bricks.assign(static_cast<size_t>(_cells_x) * _cells_y, -1);
+                    int32_t brick_count = 0;
+                    float diagonal = _coarse_spacing * 1.4143f;
+                    for (uint32_t y = 0; y < _cells_y; y++)
+                    {
+                        for (uint32_t x = 0; x < _cells_x; x++)
+                        {
+                            float nearest = std::min(
+                                std::min(std::abs(_coarse_at(x, y)), std::abs(_coarse_at(x + 1, y))),
+                                std::min(std::abs(_coarse_at(x, y + 1)), std::abs(_coarse_at(x + 1, y + 1))));
+                            if (nearest < diagonal)
+                                _bricks[y * _cells_x + x] = brick_count++;
+                        }
+                    }
+
+                    size_t brick_bytes = static_cast<size_t>(brick_count) * _brick_samples * sizeof(float);
+                    if (coarse_bytes + brick_bytes > _memory_budget && _cells_x > 1 && _cells_y > 1)
+                        continue;
+
+                    _fine.resize(static_cast<size_t>(brick_count) * _brick_samples);
+                    tbb::parallel_for(tbb::blocked_range<size_t>(0, _bricks.size(), 16), [&](const tbb::blocked_range<size_t>& cells) {
+                        for (size_t cell = cells.begin(); cell != cells.end(); cell++)
+                        {
+                            if (_bricks[cell] < 0)
+                                continue;
+                            float* samples = &_fine[static_cast<size_t>(_bricks[cell]) * _brick_samples];
+                            Vec2 corner(_min.x + (cell % _cells_x) * _coarse_spacing, _min.y + (cell / _cells_x) * _coarse_spacing);
+                            for (uint32_t y = 0; y <= brick_cells; y++)
+                                for (uint32_t x = 0; x <= brick_cells; x++)
+                                    samples[y * (brick_cells + 1) + x] = distance(Vec2(corner.x + x * _fine_spacing, corner.y + y * _fine_spacing));
+                        }
+                    });
+                    return;
+                }
+            }
+
+            // Lower bound of the unsigned distance to the scene at point, 0 when it's outside the grid
+            float lower_bound(Vec2 point) const
+            {
+                float gx = (point.x - _min.x) * _inverse_coarse_spacing;
+                float gy = (point.y - _min.y) * _inverse_coarse_spacing;
+                if (!(gx >= 0.0f && gy >= 0.0f && gx < _cells_x && gy < _cells_y))
+                    return 0.0f;
+
+                uint32_t cx = static_cast<uint32_t>(gx), cy = static_cast<uint32_t>(gy);
+                float fx = gx - cx, fy = gy - cy;
+                int32_t brick = _bricks[cy * _cells_x + cx];
+                if (brick < 0)
+                {
+                    float distance = _bilinear(&_coarse[cy * (_cells_x + 1) + cx], _cells_x + 1, fx, fy);
+                    return std::abs(distance) - _coarse_spacing * _interpolation_error;
+                }
+
+                // Position in the brick
+                float bx = fx * brick_cells, by = fy * brick_cells;
+                uint32_t ix = std::min(static_cast<uint32_t>(bx), brick_cells - 1);
+                uint32_t iy = std::min(static_cast<uint32_t>(by), brick_cells - 1);
+                const float* samples = &_fine[static_cast<size_t>(brick) * _brick_samples];
+                float distance = _bilinear(&samples[iy * (brick_cells + 1) + ix], brick_cells + 1, bx - ix, by - iy);
+                return std::abs(distance) - _fine_spacing * _interpolation_error;
+            }
+
+            // Spacing of the bricks, the largest error of the interpolated distances near surfaces
+            float error() const { return _fine_spacing; }
+
+            size_t bytes() const
+            {
+                return _coarse.size() * sizeof(float) + _bricks.size() * sizeof(int32_t) + _fine.size() * sizeof(float);
+            }
+
+            size_t brick_count() const { return _fine.size() / _brick_samples; }
+
+        private:
+            static constexpr uint32_t _brick_samples = (brick_cells + 1) * (brick_cells + 1);
+            static constexpr float _interpolation_error = 0.7072f;     // Of bilinear interpolation, in spacings
+
+            Vec2 _min, _max;
+            float _requested_error;
+            size_t _memory_budget;
+            float _fine_spacing = 0.0f, _coarse_spacing = 0.0f, _inverse_coarse_spacing = 0.0f;
+            uint32_t _cells_x = 0, _cells_y = 0;
+            std::vector<float> _coarse;         // (cells_x + 1) x (cells_y + 1) corners
+            std::vector<int32_t> _bricks;       // Brick of each cell, -1 for cells away from surfaces
+            std::vector<float> _fine;           // Bricks of (brick_cells + 1)^2 samples, corners shared with the coarse level
+
+            float _coarse_at(uint32_t x, uint32_t y) const { return _coarse[y * (_cells_x + 1) + x]; }
+
+            static float _bilinear(const float* corner, uint32_t stride, float fx, float fy)
+            {
+                float bottom = corner[0] + (corner[1] - corner[0]) * fx;
+                float top = corner[stride] + (corner[stride + 1] - corner[stride]) * fx;
+                return bottom + (top - bottom) * fy;
+            }
+    };
+}
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+#ifndef DUAL_H
+#define DUAL_H
+#include <math.h>
+#include <type_traits>
+#include "vec2.h"
+
+/*
+Dual carries a value together with its gradient with respect to the position.
+Evaluating the SDF with Vector2<Dual> gives the distance and the normal of the
+surface in a single pass, every operation applies the chain rule to the gradient
+*/
+
+namespace Lights2D
+{
+    struct Dual
+    {
+        float value;
+        Vec2 gradient;
+
+        Dual() : value(0.0f), gradient() {}
+        Dual(float value) : value(value), gradient() {}
+        Dual(float value, Vec2 gradient) : value(value), gradient(gradient) {}
+
+        // The position as a Vector2<Dual>, where x and y are the independent variables
+        static Vector2<Dual> variable(Vec2 p)
+        {
+            return { Dual(p.x, Vec2(1.0f, 0.0f)), Dual(p.y, Vec2(0.0f, 1.0f)) };
+        }
+
+        Dual operator-() const { return { -value, Vec2::flip(gradient) }; }
+        void operator+=(const Dual& other) { *this = *this + other; }
+        void operator-=(const Dual& other) { *this = *this - other; }
+        void operator*=(const Dual& other) { *this = *this * other; }
+        void operator/=(const Dual& other) { *this = *this / other; }
+
+        friend Dual operator+(const Dual& a, const Dual& b) { return { a.value + b.value, a.gradient + b.gradient }; }
+        friend Dual operator-(const Dual& a, const Dual& b) { return { a.value - b.value, a.gradient - b.gradient }; }
+
+        friend Dual operator*(const Dual& a, const Dual& b)
+        {
+            return { a.value * b.value, a.gradient * b.value + b.gradient * a.value };
+        }
+
+        friend Dual operator/(const Dual& a, const Dual& b)
+        {
+            float inv = 1.0f / b.value;
+            return { a.value * inv, (a.gradient - b.gradient * (a.value * inv)) * inv };
+        }
+
+        // Comparisons only look at the value, branches pick the gradient of the chosen side
+        friend bool operator<(const Dual& a, const Dual& b) { return a.value < b.value; }
+        friend bool operator>(const Dual& a, const Dual& b) { return a.value > b.value; }
+        friend bool operator<=(const Dual& a, const Dual& b) { return a.value <= b.value; }
+        friend bool operator>=(const Dual& a, const Dual& b) { return a.value >= b.value; }
+    };
+
+    // Dual versions of the scalar math used by the SDF functions, found by argument dependent lookup. Inline,
+    // so translation units without normals don't warn about them
+
+    inline Dual min(const Dual& a, const Dual& b) { return a.value < b.value ? a : b; }
+    inline Dual max(const Dual& a, const Dual& b) { return a.value > b.value ? a : b; }
+    inline Dual abs(const Dual& a) { return a.value < 0.0f ? -a : a; }
+
+    inline Dual clamp(const Dual& a, float min_value, float max_value)
+    {
+        return min(max(a, min_value), max_value);
+    }
+
+    inline Dual mix(const Dual& a, const Dual& b, const Dual& t) { return a + (b - a) * t; }
+
+    inline Dual sqrt(const Dual& a)
+    {
+        // The derivative is unbounded at zero, where the gradient is dropped
+        float root = sqrtf(a.value);
+        return { root, root > 0.0f ? a.gradient * (0.5f / root) : Vec2() };
+    }
+}
+#endif
@@ -4,16 +4,22 @@
 #include <iostream>
 #include "renderer.h"
 #include <functional>
+#include <vector>
+#include <memory>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
 
 
 
 namespace Lights2D
 {
     typedef std::function<void(std::shared_ptr<Image>, uint32_t)> FrameRenderCallback;
+    typedef std::function<void(std::shared_ptr<const PartialFrame>, uint32_t)> PartialFrameCallback;
+    typedef std::function<void(const MarchCounters&, uint32_t)> MarchCountersCallback;
 
     /*
     render_sequence allows the user to render sequences of images. The only propose of the
-    function is to modify the time argument passed in the sdf function.
+    function is to modify the time argument passed in the sdf function of the scene.
     The configuration is specified by SequenceConfig struct
     */
     struct SequenceConfig
@@ -21,13 +27,133 @@ namespace Lights2D
         float start_time;
         float end_time;
         float frames_per_second;
+        uint32_t frames_in_flight = 0;      // Frames rendered at once or waiting for the callback, 0 picks one per worker plus one
+        uint32_t shard_index = 0;           // Renders only the frames whose index modulo shard_count is shard_index,
+        uint32_t shard_count = 1;           // so a sequence is split between processes. Frame indices stay global
+
+        // Frames of the whole sequence, every shard included
+        uint32_t frame_count() const
+        {
+            float delta_time = 1.0f / frames_per_second;
+            uint32_t count = 0;
+            while (start_time + count * delta_time <= end_time)
+                count++;
+            return count;
+        }
     };
+
+    template <typename SDF>
     void render_sequence(
         const FrameConfig& frame_config,
         const SequenceConfig& sequence_config,
-        SignedDistanceFunction sdf,
-        FrameRenderCallback on_render_callback
-    );
+        const BasicScene<SDF>& scene,
+        FrameRenderCallback on_render_callback,
+        FrameRenderCallback on_sample_count_callback = nullptr,
+        PartialFrameCallback on_partial_callback = nullptr,
+        MarchCountersCallback on_counters_callback = nullptr)
+    {
+        /*
+        Frames go through a pipeline of three stages: the frame time is picked, the frame
+        is rendered, and the callbacks receive it. Several frames render at once, their
+        tiles are tasks of the same arena, so small frames still keep every worker busy.
+        The callbacks are serial and in frame order, so frame N + 1 can render while the
+        callback of frame N encodes and writes it. Each frame in flight owns a renderer,
+        with its buffers, from a ring of frames_in_flight, which bounds the memory. A
+        renderer is reused as soon as the callbacks of its frame return, callbacks that
+        keep the image must copy it.
+        on_sample_count_callback, when given, receives the samples taken by each pixel of every frame,
+        and on_partial_callback the exact sums of the sample range of the frame config.
+        on_counters_callback receives the march counters of every frame
+        */
+        struct Frame
+        {
+            uint32_t index;
+            uint32_t slot;
+            float time;
+        };
+
+        int concurrency = frame_config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(frame_config.threads);
+        tbb::task_arena arena(concurrency);
+
+        // By default one frame per worker, and one more whose callback can run meanwhile
+        uint32_t ring_size = sequence_config.frames_in_flight > 0
+            ? sequence_config.frames_in_flight
+            : static_cast<uint32_t>(arena.max_concurrency()) + 1;
+
+        std::vector<std::unique_ptr<Renderer<SDF>>> renderers(ring_size);
+        for (uint32_t i = 0; i < ring_size; i++)
+        {
+            auto image = std::make_shared<Image>(frame_config.width, frame_config.height);
+            renderers[i] = std::make_unique<Renderer<SDF>>(frame_config, scene, 0.0f, image);
+            renderers[i]->debug = false;
+            if (on_sample_count_callback)
+                renderers[i]->sample_count_img = std::make_shared<Image>(frame_config.width, frame_config.height);
+            if (on_partial_callback)
+                renderers[i]->partial = std::make_shared<PartialFrame>(frame_config.width, frame_config.height,
+                    frame_config.sample_begin, frame_config.sample_end > 0 ? frame_config.sample_end : frame_config.samples);
+            if (on_counters_callback)
+                renderers[i]->counters = std::make_shared<MarchCounters>();
+        }
+
+        // A grid of the static part of the scene is baked once, for every frame
+        if constexpr (Renderer<SDF>::static_grid)
+        {
+            if (frame_config.grid_error > 0.0f)
+            {
+                arena.execute([&]() { renderers[0]->bake_grid(); });
+                for (uint32_t i = 1; i < ring_size; i++)
+                    renderers[i]->grid = renderers[0]->grid;
+            }
+        }
+
+        float delta_time = 1.0f / sequence_config.frames_per_second;
+        uint32_t shard_count = std::max(sequence_config.shard_count, 1u);
+        uint32_t next_frame = sequence_config.shard_index;
+        uint32_t emitted = 0;
+
+        // Every frame in flight holds a token, so a renderer isn't reused until its callbacks return
+        arena.execute([&]()
+        {
+            tbb::parallel_pipeline(
+                ring_size,
+                tbb::make_filter<void, Frame>(tbb::filter_mode::serial_in_order,
+                    [&](tbb::flow_control& control) {
+                        // The time is computed from the index, so it doesn't accumulate rounding errors
+                        float time = sequence_config.start_time + next_frame * delta_time;
+                        if (time > sequence_config.end_time)
+                        {
+                            control.stop();
+                            return Frame();
+                        }
+                        Frame frame = { next_frame, emitted++ % ring_size, time };
+                        next_frame += shard_count;
+                        return frame;
+                    }) &
+                tbb::make_filter<Frame, Frame>(tbb::filter_mode::parallel,
+                    [&](Frame frame) {
+                        // Each frame gets its own seed, so the noise isn't the same on every frame
+                        Renderer<SDF>& frame_renderer = *renderers[frame.slot];
+                        frame_renderer.set_frame(frame.time, frame_config.seed + frame.index);
+                        frame_renderer.render_in_arena();
+                        return frame;
+                    }) &
+                tbb::make_filter<Frame, void>(tbb::filter_mode::serial_in_order,
+                    [&](Frame frame) {
+                        Renderer<SDF>& frame_renderer = *renderers[frame.slot];
+                        if (on_partial_callback)
+                            on_partial_callback(frame_renderer.partial, frame.index);
+                        if (on_sample_count_callback)
+                            on_sample_count_callback(frame_renderer.sample_count_img, frame.index);
+                        if (on_counters_callback)
+                            on_counters_callback(*frame_renderer.counters, frame.index);
+                        on_render_callback(frame_renderer.img, frame.index);
+                    })
+            );
+        });
+    }
+
+    extern template void render_sequence<SignedDistanceFunction>(
+        const FrameConfig&, const SequenceConfig&, const Scene&, FrameRenderCallback, FrameRenderCallback, PartialFrameCallback, MarchCountersCallback);
 }
 
-#endif  
\ No newline at end of file
+#endif
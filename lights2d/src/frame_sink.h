@@ -0,0 +1,328 @@
+#pragma once
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "image.h"
+
+/*
+Sinks receive the frames of a sequence in order, from the callback of render_sequence,
+and write them somewhere else than a PNG per frame. StreamSink streams them to a file
+descriptor (stdout, a named pipe, a file) for a video encoder to read, RawSequenceWriter
+stores them in a single file that other tools map and read in place
+*/
+
+namespace Lights2D
+{
+    enum class StreamFormat
+    {
+        RGB24,      // Packed 8 bit RGB, the frames back to back without any header
+        Y4M         // YUV4MPEG2, 4:4:4 BT.601 limited range, readable by ffmpeg and most encoders
+    };
+
+    class FrameSink
+    {
+        public:
+            virtual ~FrameSink() {}
+            virtual bool write(const Image& image, uint32_t frame_index) = 0;
+    };
+
+    class StreamSink : public FrameSink
+    {
+        public:
+            StreamSink(int descriptor, StreamFormat format, float frames_per_second, bool owns_descriptor)
+                :   _descriptor(descriptor),
+                    _format(format),
+                    _frames_per_second(frames_per_second),
+                    _owns_descriptor(owns_descriptor)
+                    {}
+
+            ~StreamSink() override
+            {
+                if (_owns_descriptor && _descriptor >= 0)
+                    close(_descriptor);
+            }
+
+            // target is "-" for stdout, "fd:N" for an open descriptor, or the path of a file or named pipe.
+            // Returns nullptr if it can't be opened. Opening a named pipe waits for its reader
+            static std::unique_ptr<StreamSink> open_target(const std::string& target, StreamFormat format, float frames_per_second)
+            {
+                if (target == "-")
+                    return std::make_unique<StreamSink>(STDOUT_FILENO, format, frames_per_second, false);
+                if (target.rfind("fd:", 0) == 0)
+                    return std::make_unique<StreamSink>(std::stoi(target.substr(3)), format, frames_per_second, false);
+
+                int descriptor = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (descriptor < 0)
+                    return nullptr;
+                return std::make_unique<StreamSink>(descriptor, format, frames_per_second, true);
+            }
+
+            bool write(const Image& image, uint32_t frame_index) override
+            {
+                size_t pixels = static_cast<size_t>(image.width) * image.height;
+
+                // RGB24 is written straight from the image buffer
+                if (_format == StreamFormat::RGB24)
+                    return _write_all(image.buffer, pixels * sizeof(Color<uint8_t>));
+
+                if (!_header_written)
+                {
+                    // The frame rate as a fraction with a millisecond resolution, 23.976 is 23976:1000
+                    std::string header = "YUV4MPEG2 W" + std::to_string(image.width) + " H" + std::to_string(image.height)
+                        + " F" + std::to_string(static_cast<uint32_t>(std::lround(_frames_per_second * 1000.0f))) + ":1000"
+                        + " Ip A1:1 C444\n";
+                    if (!_write_all(header.data(), header.size()))
+                        return false;
+                    _header_written = true;
+                }
+
+                // Planar Y, Cb, Cr, with the fixed point BT.601 coefficients
+                _planes.resize(pixels * 3);
+                uint8_t* y_plane = _planes.data();
+                uint8_t* cb_plane = y_plane + pixels;
+                uint8_t* cr_plane = cb_plane + pixels;
+                for (size_t i = 0; i < pixels; i++)
+                {
+                    int r = image.buffer[i].r, g = image.buffer[i].g, b = image.buffer[i].b;
+                    y_plane[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                    cb_plane[i] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                    cr_plane[i] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+                }
+
+                static const char frame_header[] = "FRAME\n";
+                return _write_all(frame_header, sizeof(frame_header) - 1) && _write_all(_planes.data(), _planes.size());
+            }
+
+        private:
+            bool _write_all(const void* data, size_t bytes)
+            {
+                // Pipes take partial writes, and signals interrupt them
+                const char* cursor = static_cast<const char*>(data);
+                while (bytes > 0)
+                {
+                    ssize_t written = ::write(_descriptor, cursor, bytes);
+                    if (written < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    cursor += written;
+                    bytes -= static_cast<size_t>(written);
+                }
+                return true;
+            }
+
+            int _descriptor;
+            StreamFormat _format;
+            float _frames_per_second;
+            bool _owns_descriptor;
+            bool _header_written = false;
+            std::vector<uint8_t> _planes;
+    };
+
+    namespace RawSequenceFormat
+    {
+        /*
+        A raw sequence file is a 64 byte header, a byte per frame that is 1 once the
+        frame is written, and the RGB24 frames back to back, starting at a 4096 byte
+        boundary. The frame i is at data_offset + i * width * height * 3, so readers map
+        the file and use the pixels in place, and frames are written in any order.
+        Header: magic, version, width, height, frame_count, frames_per_second (float
+        bits), data_offset, all 32 bit little endian, the rest is zero
+        */
+        constexpr uint32_t magic = 0x5352324c;     // "L2RS" little endian
+        constexpr uint32_t version = 1;
+        constexpr size_t header_size = 64;
+
+        static size_t data_offset(uint32_t frame_count)
+        {
+            return (header_size + frame_count + 4095) / 4096 * 4096;
+        }
+    }
+
+    class RawSequenceWriter : public FrameSink
+    {
+        /*
+        Creates the whole file up front and maps it, frames are copied to their place.
+        An existing file of the same size and header is reused, so shards of a sequence
+        can fill the same file. Writers opening the file take turns with a lock on it,
+        and another file is never truncated in place: a complete new one is created
+        beside it and renamed over it, so a mapping of the old one stays valid
+        */
+        public:
+            RawSequenceWriter(const std::string& filepath, uint32_t width, uint32_t height, uint32_t frame_count, float frames_per_second)
+                :   _width(width),
+                    _height(height),
+                    _frame_count(frame_count)
+            {
+                _frame_bytes = static_cast<size_t>(width) * height * sizeof(Color<uint8_t>);
+                _data_offset = RawSequenceFormat::data_offset(frame_count);
+                _bytes = _data_offset + _frame_bytes * frame_count;
+
+                uint32_t expected[7] = { RawSequenceFormat::magic, RawSequenceFormat::version, width, height, frame_count, 0, static_cast<uint32_t>(_data_offset) };
+                std::memcpy(&expected[5], &frames_per_second, sizeof(float));
+
+                int descriptor = _open_locked(filepath);
+                if (descriptor < 0)
+                    return;
+
+                struct stat status;
+                uint32_t existing[7] = {};
+                bool reuse = fstat(descriptor, &status) == 0 && static_cast<size_t>(status.st_size) == _bytes
+                    && ::pread(descriptor, existing, sizeof(existing), 0) == sizeof(existing)
+                    && std::memcmp(existing, expected, sizeof(existing)) == 0;
+
+                int target = descriptor;
+                if (!reuse)
+                {
+                    std::string temporary = filepath + "." + std::to_string(getpid()) + ".tmp";
+                    ::unlink(temporary.c_str());
+                    target = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+                    bool created = target >= 0
+                        && ::ftruncate(target, static_cast<off_t>(_bytes)) == 0
+                        && ::pwrite(target, expected, sizeof(expected), 0) == sizeof(expected)
+                        && ::rename(temporary.c_str(), filepath.c_str()) == 0;
+                    if (!created)
+                    {
+                        if (target >= 0)
+                        {
+                            close(target);
+                            ::unlink(temporary.c_str());
+                        }
+                        close(descriptor);
+                        return;
+                    }
+                }
+
+                void* mapping = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, target, 0);
+                if (target != descriptor)
+                    close(target);
+                // Closing releases the lock
+                close(descriptor);
+                if (mapping != MAP_FAILED)
+                    _mapping = static_cast<uint8_t*>(mapping);
+            }
+
+            ~RawSequenceWriter() override
+            {
+                // The pages of a shared mapping reach the file without a blocking msync
+                if (_mapping)
+                    munmap(_mapping, _bytes);
+            }
+
+            bool is_open() const { return _mapping != nullptr; }
+
+            bool write(const Image& image, uint32_t frame_index) override
+            {
+                if (!_mapping || frame_index >= _frame_count || image.width != _width || image.height != _height)
+                    return false;
+                std::memcpy(_mapping + _data_offset + frame_index * _frame_bytes, image.buffer, _frame_bytes);
+                _mapping[RawSequenceFormat::header_size + frame_index] = 1;
+                return true;
+            }
+
+        private:
+            uint32_t _width, _height, _frame_count;
+            size_t _frame_bytes, _data_offset, _bytes;
+            uint8_t* _mapping = nullptr;
+
+            // Opens the file, created empty if missing, and locks it. When another writer replaced
+            // it while this one waited for the lock, the lock is on the old file, and it opens again
+            static int _open_locked(const std::string& filepath)
+            {
+                for (;;)
+                {
+                    int descriptor = ::open(filepath.c_str(), O_RDWR | O_CREAT, 0644);
+                    if (descriptor < 0)
+                        return -1;
+                    struct stat opened, current;
+                    if (flock(descriptor, LOCK_EX) != 0 || fstat(descriptor, &opened) != 0)
+                    {
+                        close(descriptor);
+                        return -1;
+                    }
+                    if (::stat(filepath.c_str(), &current) == 0 && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+                        return descriptor;
+                    close(descriptor);
+                }
+            }
+    };
+
+    class RawSequence
+    {
+        /*
+        Read only view of a raw sequence file, the frames are read from the mapping
+        */
+        public:
+            uint32_t width = 0, height = 0, frame_count = 0;
+            float frames_per_second = 0.0f;
+
+        public:
+            RawSequence(const std::string& filepath)
+            {
+                int descriptor = ::open(filepath.c_str(), O_RDONLY);
+                if (descriptor < 0)
+                    return;
+                uint32_t header[7];
+                struct stat status;
+                if (::pread(descriptor, header, sizeof(header), 0) == sizeof(header) && header[0] == RawSequenceFormat::magic
+                    && header[1] == RawSequenceFormat::version && fstat(descriptor, &status) == 0)
+                {
+                    size_t frame_bytes = static_cast<size_t>(header[2]) * header[3] * sizeof(Color<uint8_t>);
+                    size_t bytes = header[6] + frame_bytes * header[4];
+                    if (static_cast<size_t>(status.st_size) >= bytes)
+                    {
+                        void* mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, descriptor, 0);
+                        if (mapping != MAP_FAILED)
+                        {
+                            _mapping = static_cast<const uint8_t*>(mapping);
+                            _bytes = bytes;
+                            _frame_bytes = frame_bytes;
+                            _data_offset = header[6];
+                            width = header[2];
+                            height = header[3];
+                            frame_count = header[4];
+                            std::memcpy(&frames_per_second, &header[5], sizeof(float));
+                        }
+                    }
+                }
+                close(descriptor);
+            }
+
+            ~RawSequence()
+            {
+                if (_mapping)
+                    munmap(const_cast<uint8_t*>(_mapping), _bytes);
+            }
+
+            RawSequence(const RawSequence&) = delete;
+            RawSequence& operator=(const RawSequence&) = delete;
+
+            bool is_open() const { return _mapping != nullptr; }
+            bool has_frame(uint32_t index) const { return index < frame_count && _mapping[RawSequenceFormat::header_size + index]; }
+
+            // Packed RGB24 pixels of the frame, row by row from the top
+            const Color<uint8_t>* frame(uint32_t index) const
+            {
+                return reinterpret_cast<const Color<uint8_t>*>(_mapping + _data_offset + index * _frame_bytes);
+            }
+
+        private:
+            const uint8_t* _mapping = nullptr;
+            size_t _bytes = 0, _frame_bytes = 0, _data_offset = 0;
+    };
+}
+#endif
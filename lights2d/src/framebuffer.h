@@ -0,0 +1,69 @@
+#pragma once
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "color.h"
+
+namespace Lights2D
+{
+    class Framebuffer
+    {
+        /*
+        Float radiance of a frame, before tone mapping. Each channel is a separate
+        array (SoA), so the output stage reads them with contiguous vector loads.
+        Pixels keep the sum of their samples and the sample count, so more samples
+        can be added later and frames can be merged, the radiance is sum / samples
+        */
+        public:
+            uint32_t width, height;
+            std::vector<float> r, g, b;
+            std::vector<uint32_t> samples;
+
+        public:
+            Framebuffer(uint32_t width, uint32_t height)
+                :   width(width),
+                    height(height),
+                    r(width * height, 0.0f),
+                    g(width * height, 0.0f),
+                    b(width * height, 0.0f),
+                    samples(width * height, 0)
+                    {}
+
+            void set(uint32_t x, uint32_t y, const Color<float>& sum, uint32_t count)
+            {
+                uint32_t i = x + y * width;
+                r[i] = sum.r;
+                g[i] = sum.g;
+                b[i] = sum.b;
+                samples[i] = count;
+            }
+
+            void add(uint32_t x, uint32_t y, const Color<float>& sum, uint32_t count)
+            {
+                uint32_t i = x + y * width;
+                r[i] += sum.r;
+                g[i] += sum.g;
+                b[i] += sum.b;
+                samples[i] += count;
+            }
+
+            Color<float> radiance(uint32_t x, uint32_t y) const
+            {
+                uint32_t i = x + y * width;
+                float inv = samples[i] > 0 ? 1.0f / samples[i] : 0.0f;
+                return { r[i] * inv, g[i] * inv, b[i] * inv };
+            }
+
+            void clear()
+            {
+                std::fill(r.begin(), r.end(), 0.0f);
+                std::fill(g.begin(), g.end(), 0.0f);
+                std::fill(b.begin(), b.end(), 0.0f);
+                std::fill(samples.begin(), samples.end(), 0);
+            }
+    };
+}
+#endif
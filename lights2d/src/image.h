@@ -8,37 +8,42 @@
 
 namespace Lights2D
 {
-    class Image
+    template <typename T>
+    class BasicImage
     {
         /*
             Lights2D::Image is a data structure that contains the rendered image buffer.
             Allocates memory in the heap, and has a destructor.
+            T is the type of each channel, uint8_t for Image and uint16_t for Image16
         */
         public:
             uint32_t width, height;
-            Color<uint8_t>* buffer;
+            Color<T>* buffer;
 
         public:
-            Image(uint32_t width, uint32_t height) : width(width), height(height)
+            BasicImage(uint32_t width, uint32_t height) : width(width), height(height)
             {
-                buffer = new Color<uint8_t>[width * height];
+                buffer = new Color<T>[width * height];
             }
 
-            ~Image()
+            ~BasicImage()
             {
                 delete[] buffer;
             }
 
-            void set_pixel(uint32_t x, uint32_t y, Color<uint8_t> color)
+            void set_pixel(uint32_t x, uint32_t y, Color<T> color)
             {
                 buffer[x + y * width] = color;
             }
 
             void clear()
             {
-                memset(buffer, 0, width * height * sizeof(Color<uint8_t>));
+                memset(buffer, 0, width * height * sizeof(Color<T>));
             }
 
     };
+
+    typedef BasicImage<uint8_t> Image;
+    typedef BasicImage<uint16_t> Image16;
 }
 #endif
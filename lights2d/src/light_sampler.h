@@ -0,0 +1,140 @@
+#pragma once
+#ifndef LIGHT_SAMPLER_H
+#define LIGHT_SAMPLER_H
+
+#include <stdint.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "vec2.h"
+#include "utils.h"
+
+namespace Lights2D
+{
+    struct LightShape
+    {
+        /*
+        Region that holds an emitter: the points within radius of the segment a b, a circle
+        when both ends are the same. It only has to hold the emitting surface, a larger
+        region wastes some of the samples sent toward it, but never biases the image
+        */
+        Vec2 a, b;
+        float radius = 0.0f;
+
+        static LightShape circle(Vec2 center, float radius) { return { center, center, radius }; }
+        static LightShape segment(Vec2 a, Vec2 b, float radius) { return { a, b, radius }; }
+
+        // The segment along the long side of the box, with the short half side as radius, holds it
+        static LightShape box(Vec2 center, Vec2 half_size)
+        {
+            if (half_size.x >= half_size.y)
+                return { Vec2(center.x - half_size.x, center.y), Vec2(center.x + half_size.x, center.y), half_size.y };
+            return { Vec2(center.x, center.y - half_size.y), Vec2(center.x, center.y + half_size.y), half_size.x };
+        }
+    };
+
+    class LightSampler
+    {
+        /*
+        Picks ray angles toward the lights. From a point, each light covers an interval of
+        angles: the angles of the segment widened by the angle its radius spans at the
+        nearest point, or every angle from inside. The intervals are laid end to end, so a
+        uniform number picks a light with probability proportional to its interval and an
+        angle uniformly in it. The density of an angle is the number of intervals holding
+        it over their total width. Past max_lights, the lights are only found by the
+        uniform rays
+        */
+        public:
+            static constexpr size_t max_lights = 16;
+
+        public:
+            LightSampler() {}
+            explicit LightSampler(std::vector<LightShape> lights) : _lights(std::move(lights))
+            {
+                if (_lights.size() > max_lights)
+                    _lights.resize(max_lights);
+            }
+
+            bool empty() const { return _lights.empty(); }
+            size_t size() const { return _lights.size(); }
+
+            // Angle in radians toward the lights from origin for u in [0, 1), and its density
+            float sample(Vec2 origin, float u, float& pdf) const
+            {
+                Interval intervals[max_lights];
+                float total = _intervals(origin, intervals);
+
+                float target = u * total, angle = 0.0f;
+                for (size_t i = 0; i < _lights.size(); i++)
+                {
+                    angle = intervals[i].begin + target;
+                    if (target < intervals[i].width)
+                        break;
+                    target -= intervals[i].width;
+                }
+                pdf = _pdf(intervals, angle, total);
+                return angle;
+            }
+
+            // Density of sample at angle
+            float pdf(Vec2 origin, float angle) const
+            {
+                Interval intervals[max_lights];
+                float total = _intervals(origin, intervals);
+                return _pdf(intervals, angle, total);
+            }
+
+        private:
+            struct Interval
+            {
+                float begin, width;
+            };
+
+            std::vector<LightShape> _lights;
+
+            static Interval _interval(const LightShape& light, Vec2 origin)
+            {
+                Vec2 to_a = light.a - origin, to_b = light.b - origin;
+
+                // Distance to the segment, an origin within radius sees the light everywhere
+                Vec2 ab = light.b - light.a;
+                float length2 = Vec2::dot(ab, ab);
+                float h = length2 > 0.0f ? Utils::clamp(-Vec2::dot(to_a, ab) / length2, 0.0f, 1.0f) : 0.0f;
+                float distance = Vec2::length(to_a + ab * h);
+                if (distance <= light.radius)
+                    return { 0.0f, 2.0f * PI };
+
+                float angle_a = std::atan2(to_a.y, to_a.x);
+                float span = std::remainder(std::atan2(to_b.y, to_b.x) - angle_a, 2.0f * PI);
+                float begin = span >= 0.0f ? angle_a : angle_a + span;
+                float widen = std::asin(light.radius / distance);
+                return { begin - widen, std::abs(span) + 2.0f * widen };
+            }
+
+            float _intervals(Vec2 origin, Interval* intervals) const
+            {
+                float total = 0.0f;
+                for (size_t i = 0; i < _lights.size(); i++)
+                {
+                    intervals[i] = _interval(_lights[i], origin);
+                    total += intervals[i].width;
+                }
+                return total;
+            }
+
+            float _pdf(const Interval* intervals, float angle, float total) const
+            {
+                if (total <= 0.0f)
+                    return 0.0f;
+                uint32_t count = 0;
+                for (size_t i = 0; i < _lights.size(); i++)
+                {
+                    float offset = angle - intervals[i].begin;
+                    offset -= 2.0f * PI * std::floor(offset / (2.0f * PI));
+                    count += offset < intervals[i].width ? 1 : 0;
+                }
+                return count / total;
+            }
+    };
+}
+#endif
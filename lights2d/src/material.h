@@ -3,6 +3,7 @@
 #define MATERIAL_H
 #include "color.h"
 #include "utils.h"
+#include <vector>
 
 namespace Lights2D
 {
@@ -71,5 +72,129 @@ namespace Lights2D
             reflectivity(ref),
             ior(ior) {}
     };
+
+    // Index of a material in the MaterialTable of the scene
+    typedef uint32_t MaterialId;
+
+    struct MaterialBlend
+    {
+        /*
+        MaterialBlend is what the SDF carries instead of a full Material. It's a
+        weighted list of MaterialIds, and it's resolved into a Material only at the hit
+        point. Mixing blends gives the same weights as Material::mix. At most
+        "capacity" materials are kept, when a mix exceeds it, the lightest weight is
+        dropped and the rest are renormalized by MaterialTable::resolve
+        */
+        static constexpr uint32_t capacity = 4;
+        MaterialId ids[capacity];
+        float weights[capacity];
+        uint32_t count;
+
+        MaterialBlend() : ids{}, weights{}, count(0) {}
+        MaterialBlend(MaterialId id) : count(1)
+        {
+            ids[0] = id;
+            weights[0] = 1.0f;
+        }
+
+        void add(MaterialId id, float weight)
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                if (ids[i] == id)
+                {
+                    weights[i] += weight;
+                    return;
+                }
+            }
+
+            if (count < capacity)
+            {
+                ids[count] = id;
+                weights[count++] = weight;
+                return;
+            }
+
+            uint32_t lightest = 0;
+            for (uint32_t i = 1; i < count; i++)
+            {
+                if (weights[i] < weights[lightest])
+                    lightest = i;
+            }
+
+            if (weight > weights[lightest])
+            {
+                ids[lightest] = id;
+                weights[lightest] = weight;
+            }
+        }
+
+        static MaterialBlend mix(const MaterialBlend& b1, const MaterialBlend& b2, float t)
+        {
+            if (t <= 0.0f)
+                return b1;
+            if (t >= 1.0f)
+                return b2;
+
+            MaterialBlend result;
+            for (uint32_t i = 0; i < b1.count; i++)
+                result.add(b1.ids[i], b1.weights[i] * (1.0f - t));
+            for (uint32_t i = 0; i < b2.count; i++)
+                result.add(b2.ids[i], b2.weights[i] * t);
+            return result;
+        }
+
+        template <typename T>
+        static MaterialBlend mix(const MaterialBlend&, const MaterialBlend&, const T&)
+        {
+            // Packets and duals only compute distances, their materials are never resolved
+            return MaterialBlend();
+        }
+    };
+
+    class MaterialTable
+    {
+        /*
+        Holds every material of a scene. Materials are added once, when the scene is
+        built, so the SDF doesn't construct them (nor runs gamma_exp) on each call
+        */
+        public:
+            std::vector<Material> materials;
+
+        public:
+            MaterialId add(const Material& material)
+            {
+                materials.push_back(material);
+                return static_cast<MaterialId>(materials.size() - 1);
+            }
+
+            const Material& operator[](MaterialId id) const { return materials[id]; }
+
+            Material resolve(const MaterialBlend& blend) const
+            {
+                if (blend.count == 0)
+                    return Material::create_opaque();
+
+                if (blend.count == 1)
+                    return materials[blend.ids[0]];
+
+                float total_weight = 0.0f;
+                for (uint32_t i = 0; i < blend.count; i++)
+                    total_weight += blend.weights[i];
+
+                Material result = Material::create_opaque();
+                for (uint32_t i = 0; i < blend.count; i++)
+                {
+                    const Material& material = materials[blend.ids[i]];
+                    float weight = blend.weights[i] / total_weight;
+                    result.emission += material.emission * weight;
+                    result.absorption += material.absorption * weight;
+                    result.emission_intensity += material.emission_intensity * weight;
+                    result.reflectivity += material.reflectivity * weight;
+                    result.ior += material.ior * weight;
+                }
+                return result;
+            }
+    };
 }
 #endif
\ No newline at end of file
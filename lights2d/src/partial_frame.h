@@ -0,0 +1,166 @@
+#pragma once
+#ifndef PARTIAL_FRAME_H
+#define PARTIAL_FRAME_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include "color.h"
+#include "framebuffer.h"
+
+namespace Lights2D
+{
+    namespace FixedPoint
+    {
+        /*
+        Sample sums are also kept as 64 bit integers with 32 fractional bits. Integer
+        addition is associative, so the sum of a pixel is exactly the same whatever
+        the order and grouping of its samples, which makes a frame split between
+        processes merge into the same bits as a frame rendered at once.
+        A pixel sums at most max_samples samples of at most max_sample each, so its sum
+        stays below 2^12 * 2^32 * 2^18 = 2^62
+        */
+        constexpr float scale = 4294967296.0f;
+        constexpr float max_sample = 4096.0f;
+        constexpr uint32_t max_samples = 1u << 18;
+
+        static int64_t from_float(float value)
+        {
+            // NaN and negative radiance count as black, brighter samples are clamped to max_sample
+            return static_cast<int64_t>(std::min(std::max(0.0f, value), max_sample) * scale);
+        }
+
+        static float to_float(int64_t value)
+        {
+            return static_cast<float>(static_cast<double>(value) * (1.0 / 4294967296.0));
+        }
+    }
+
+    class PartialFrame
+    {
+        /*
+        Exact sample sums of a frame, or of a range of its sample indices. Frames rendered
+        by several processes, each with a different range of sample indices, are written
+        to files, and merged by adding them. The sums are fixed point, so the merge is
+        independent of the split and of the order of the files
+        */
+        public:
+            uint32_t width, height;
+            uint32_t sample_begin, sample_end;      // Sample indices covered, [sample_begin, sample_end)
+            std::vector<int64_t> r, g, b;
+            std::vector<uint32_t> samples;
+
+        public:
+            PartialFrame() : width(0), height(0), sample_begin(0), sample_end(0) {}
+            PartialFrame(uint32_t width, uint32_t height, uint32_t sample_begin, uint32_t sample_end)
+                :   width(width),
+                    height(height),
+                    sample_begin(sample_begin),
+                    sample_end(sample_end),
+                    r(width * height, 0),
+                    g(width * height, 0),
+                    b(width * height, 0),
+                    samples(width * height, 0)
+                    {}
+
+            void set(uint32_t x, uint32_t y, const int64_t sum[3], uint32_t count)
+            {
+                uint32_t i = x + y * width;
+                r[i] = sum[0];
+                g[i] = sum[1];
+                b[i] = sum[2];
+                samples[i] = count;
+            }
+
+            void add(uint32_t x, uint32_t y, const int64_t sum[3], uint32_t count)
+            {
+                uint32_t i = x + y * width;
+                r[i] += sum[0];
+                g[i] += sum[1];
+                b[i] += sum[2];
+                samples[i] += count;
+            }
+
+            // Adds the sums of another range of samples of the same frame. Fails if the sizes
+            // differ, the ranges aren't adjacent or the union has more than FixedPoint::max_samples
+            bool merge(const PartialFrame& other)
+            {
+                if (other.width != width || other.height != height)
+                    return false;
+                if (other.sample_begin != sample_end && other.sample_end != sample_begin)
+                    return false;
+                if (std::max(sample_end, other.sample_end) - std::min(sample_begin, other.sample_begin) > FixedPoint::max_samples)
+                    return false;
+
+                for (uint32_t i = 0; i < width * height; i++)
+                {
+                    r[i] += other.r[i];
+                    g[i] += other.g[i];
+                    b[i] += other.b[i];
+                    samples[i] += other.samples[i];
+                }
+                sample_begin = std::min(sample_begin, other.sample_begin);
+                sample_end = std::max(sample_end, other.sample_end);
+                return true;
+            }
+
+            void to_framebuffer(Framebuffer& framebuffer) const
+            {
+                for (uint32_t i = 0; i < width * height; i++)
+                {
+                    framebuffer.r[i] = FixedPoint::to_float(r[i]);
+                    framebuffer.g[i] = FixedPoint::to_float(g[i]);
+                    framebuffer.b[i] = FixedPoint::to_float(b[i]);
+                    framebuffer.samples[i] = samples[i];
+                }
+            }
+
+            // File layout: magic, width, height, sample_begin, sample_end, then the r, g, b and samples arrays
+            bool write(const std::string& filepath) const
+            {
+                std::ofstream file(filepath, std::ios::binary);
+                if (!file)
+                    return false;
+                uint32_t header[5] = { magic, width, height, sample_begin, sample_end };
+                file.write(reinterpret_cast<const char*>(header), sizeof(header));
+                _write_array(file, r);
+                _write_array(file, g);
+                _write_array(file, b);
+                _write_array(file, samples);
+                return static_cast<bool>(file);
+            }
+
+            bool read(const std::string& filepath)
+            {
+                std::ifstream file(filepath, std::ios::binary);
+                uint32_t header[5];
+                if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != magic)
+                    return false;
+                *this = PartialFrame(header[1], header[2], header[3], header[4]);
+                _read_array(file, r);
+                _read_array(file, g);
+                _read_array(file, b);
+                _read_array(file, samples);
+                return static_cast<bool>(file);
+            }
+
+        private:
+            // "L2DP" little endian
+            static constexpr uint32_t magic = 0x5044324c;
+
+            template <typename T>
+            static void _write_array(std::ofstream& file, const std::vector<T>& values)
+            {
+                file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+            }
+
+            template <typename T>
+            static void _read_array(std::ifstream& file, std::vector<T>& values)
+            {
+                file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T));
+            }
+    };
+}
+#endif
@@ -0,0 +1,461 @@
+#pragma once
+#ifndef PNG_ENCODER_H
+#define PNG_ENCODER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <zlib.h>
+#include <tbb/parallel_for.h>
+#include "image.h"
+#include "frame_sink.h"
+
+namespace Lights2D
+{
+    enum class PngFilter
+    {
+        None,
+        Sub,
+        Up,
+        Paeth,
+        Adaptive    // Per row, the filter with the smallest sum of absolute values, as libpng does
+    };
+
+    struct PngConfig
+    {
+        int level = 6;                          // zlib level, 1 is the fastest, 9 the smallest
+        int strategy = Z_DEFAULT_STRATEGY;      // Z_RLE compresses flat renders almost as well, much faster
+        PngFilter filter = PngFilter::Adaptive;
+        uint32_t strip_rows = 64;               // Rows compressed by each task
+    };
+
+    class PngEncoder
+    {
+        /*
+        8 bit RGB PNG encoder that filters and deflates strips of rows in parallel,
+        as pigz does. Every strip is a separate deflate stream, primed with the last
+        32KB of the strip above as its dictionary, so the ratio is close to a single
+        stream. Strips but the last end with a sync flush, which leaves them byte
+        aligned, so the streams are concatenated into one zlib stream, and their
+        Adler-32 and CRC-32 checksums are combined. The z_streams and the buffers of
+        the strips are kept, an encoder reused for every frame doesn't allocate
+        */
+        public:
+            PngEncoder(const PngConfig& config = PngConfig()) : config(config) {}
+
+            ~PngEncoder()
+            {
+                _close();
+                for (Strip& strip : _strips)
+                    if (strip.initialized)
+                        deflateEnd(&strip.stream);
+            }
+
+            PngEncoder(const PngEncoder&) = delete;
+            PngEncoder& operator=(const PngEncoder&) = delete;
+
+            // The PNG file of image, valid until the next call. Empty if zlib fails
+            const std::vector<uint8_t>& encode(const Image& image)
+            {
+                _png.clear();
+                _start(image.width, image.height);
+                if (!_encode_rows(image.buffer, image.height))
+                {
+                    _png.clear();
+                    return _png;
+                }
+                _chunk("IEND", nullptr, 0);
+                return _png;
+            }
+
+            bool write(const Image& image, const std::string& filepath)
+            {
+                const std::vector<uint8_t>& png = encode(image);
+                if (png.empty())
+                    return false;
+                FILE* file = fopen(filepath.c_str(), "wb");
+                if (!file)
+                    return false;
+                bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+                return fclose(file) == 0 && written;
+            }
+
+            /*
+            Streaming: begin writes the header, write_rows compresses the next rows, top
+            to bottom, and appends them as an IDAT chunk, and finish closes the file once
+            all the rows are written. Only the rows of a call are held, so images larger
+            than memory are written band by band. The rows continue the filtering and the
+            dictionary of the previous call, so bands of a multiple of strip_rows give the
+            same compressed data as encode
+            */
+            bool begin(const std::string& filepath, uint32_t width, uint32_t height)
+            {
+                _close();
+                _file = fopen(filepath.c_str(), "wb");
+                if (!_file)
+                    return false;
+                _png.clear();
+                _start(width, height);
+                return _flush();
+            }
+
+            bool write_rows(const Color<uint8_t>* rows, uint32_t count)
+            {
+                if (!_file || count == 0 || _next_row + count > _height)
+                    return false;
+                _png.clear();
+                return _encode_rows(rows, count) && _flush();
+            }
+
+            bool finish()
+            {
+                if (!_file)
+                    return false;
+                bool complete = _next_row == _height;
+                _png.clear();
+                _chunk("IEND", nullptr, 0);
+                complete = _flush() && complete;
+                return _close() && complete;
+            }
+
+        public:
+            PngConfig config;
+
+        private:
+            struct Strip
+            {
+                std::vector<uint8_t> filtered;
+                std::vector<uint8_t> deflated;
+                std::vector<uint8_t> candidates;
+                size_t deflated_bytes = 0;
+                uLong adler = 0;
+                uLong crc = 0;
+                z_stream stream;
+                bool initialized = false;
+                int level = 0, strategy = 0;
+            };
+
+            // A deque keeps the strips in place as it grows, zlib streams can't be moved
+            std::deque<Strip> _strips;
+            std::vector<uint8_t> _png;
+            std::vector<uint8_t> _zero_row;
+
+            // State carried between the calls of write_rows
+            FILE* _file = nullptr;
+            uint32_t _width = 0, _height = 0, _next_row = 0;
+            std::vector<uint8_t> _previous_row;     // Unfiltered, the row above the next call
+            std::vector<uint8_t> _dictionary;       // The last filtered bytes of the previous call
+            uLong _adler = 0;
+
+            static constexpr size_t _window = 32768;
+
+            void _start(uint32_t width, uint32_t height)
+            {
+                _width = width;
+                _height = height;
+                _next_row = 0;
+                _dictionary.clear();
+                _adler = adler32(0L, nullptr, 0);
+
+                static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+                _png.insert(_png.end(), signature, signature + 8);
+
+                uint8_t header[13];
+                _put_u32(header, width);
+                _put_u32(header + 4, height);
+                header[8] = 8;      // Bit depth
+                header[9] = 2;      // RGB
+                header[10] = header[11] = header[12] = 0;
+                _chunk("IHDR", header, sizeof(header));
+            }
+
+            // Appends the next count rows to _png as an IDAT chunk, with the zlib header before
+            // the first row and the Adler-32 of the filtered rows after the last
+            bool _encode_rows(const Color<uint8_t>* rows, uint32_t count)
+            {
+                uint32_t row_bytes = _width * 3;
+                uint32_t strip_rows = std::max(config.strip_rows, 1u);
+                uint32_t strip_count = (count + strip_rows - 1) / strip_rows;
+                bool first = _next_row == 0, last = _next_row + count == _height;
+                if (_strips.size() < strip_count)
+                    _strips.resize(strip_count);
+                if (_zero_row.size() < row_bytes)
+                    _zero_row.resize(row_bytes, 0);
+
+                // Filtering first, every strip takes the dictionary from the filtered rows of the one above
+                const uint8_t* pixels = reinterpret_cast<const uint8_t*>(rows);
+                tbb::parallel_for(tbb::blocked_range<uint32_t>(0, strip_count, 1), [&](const tbb::blocked_range<uint32_t>& range) {
+                    for (uint32_t s = range.begin(); s != range.end(); s++)
+                    {
+                        uint32_t y0 = s * strip_rows, y1 = std::min(y0 + strip_rows, count);
+                        Strip& strip = _strips[s];
+                        strip.filtered.resize(static_cast<size_t>(y1 - y0) * (row_bytes + 1));
+                        for (uint32_t y = y0; y < y1; y++)
+                        {
+                            const uint8_t* row = pixels + static_cast<size_t>(y) * row_bytes;
+                            const uint8_t* above = y > 0 ? row - row_bytes : first ? _zero_row.data() : _previous_row.data();
+                            _filter_row(row, above, row_bytes, &strip.filtered[static_cast<size_t>(y - y0) * (row_bytes + 1)], strip);
+                        }
+                    }
+                });
+
+                std::atomic<bool> failed(false);
+                tbb::parallel_for(tbb::blocked_range<uint32_t>(0, strip_count, 1), [&](const tbb::blocked_range<uint32_t>& range) {
+                    for (uint32_t s = range.begin(); s != range.end(); s++)
+                        if (!_deflate_strip(s, last && s + 1 == strip_count))
+                            failed = true;
+                });
+                if (failed)
+                    return false;
+
+                // IDAT: the zlib header, the strips, and the Adler-32 of all the filtered rows
+                size_t data_bytes = (first ? 2 : 0) + (last ? 4 : 0);
+                for (uint32_t s = 0; s < strip_count; s++)
+                    data_bytes += _strips[s].deflated_bytes;
+                size_t length_offset = _png.size();
+                _png.resize(length_offset + 8);
+                _put_u32(&_png[length_offset], static_cast<uint32_t>(data_bytes));
+                std::memcpy(&_png[length_offset + 4], "IDAT", 4);
+                uLong crc = crc32(0L, &_png[length_offset + 4], 4);
+
+                if (first)
+                {
+                    // Deflate with a 32KB window, the level in FLEVEL and FCHECK making the header a multiple of 31
+                    uint8_t zlib_header[2] = { 0x78, static_cast<uint8_t>(config.level <= 1 ? 0x01 : config.level <= 5 ? 0x5e : config.level == 6 ? 0x9c : 0xda) };
+                    _png.insert(_png.end(), zlib_header, zlib_header + 2);
+                    crc = crc32(crc, zlib_header, 2);
+                }
+                for (uint32_t s = 0; s < strip_count; s++)
+                {
+                    const Strip& strip = _strips[s];
+                    _png.insert(_png.end(), strip.deflated.begin(), strip.deflated.begin() + strip.deflated_bytes);
+                    crc = crc32_combine(crc, strip.crc, static_cast<z_off_t>(strip.deflated_bytes));
+                    _adler = adler32_combine(_adler, strip.adler, static_cast<z_off_t>(strip.filtered.size()));
+                }
+                if (last)
+                {
+                    uint8_t trailer[4];
+                    _put_u32(trailer, static_cast<uint32_t>(_adler));
+                    _png.insert(_png.end(), trailer, trailer + 4);
+                    crc = crc32(crc, trailer, 4);
+                }
+                uint8_t crc_bytes[4];
+                _put_u32(crc_bytes, static_cast<uint32_t>(crc));
+                _png.insert(_png.end(), crc_bytes, crc_bytes + 4);
+
+                // The next call continues from the last row and the end of the last strip
+                _next_row += count;
+                if (!last)
+                {
+                    const std::vector<uint8_t>& filtered = _strips[strip_count - 1].filtered;
+                    size_t size = std::min(filtered.size(), _window);
+                    _dictionary.assign(filtered.end() - size, filtered.end());
+                    _previous_row.assign(pixels + static_cast<size_t>(count - 1) * row_bytes, pixels + static_cast<size_t>(count) * row_bytes);
+                }
+                return true;
+            }
+
+            bool _flush()
+            {
+                if (fwrite(_png.data(), 1, _png.size(), _file) == _png.size())
+                    return true;
+                _close();
+                return false;
+            }
+
+            bool _close()
+            {
+                if (!_file)
+                    return true;
+                bool closed = fclose(_file) == 0;
+                _file = nullptr;
+                return closed;
+            }
+
+            bool _deflate_strip(uint32_t s, bool last)
+            {
+                Strip& strip = _strips[s];
+                if (strip.initialized && (strip.level != config.level || strip.strategy != config.strategy))
+                {
+                    deflateEnd(&strip.stream);
+                    strip.initialized = false;
+                }
+                if (!strip.initialized)
+                {
+                    std::memset(&strip.stream, 0, sizeof(strip.stream));
+                    // Raw deflate, the zlib header and trailer are written once for all the strips
+                    if (deflateInit2(&strip.stream, config.level, Z_DEFLATED, -15, 8, config.strategy) != Z_OK)
+                        return false;
+                    strip.initialized = true;
+                    strip.level = config.level;
+                    strip.strategy = config.strategy;
+                }
+                else if (deflateReset(&strip.stream) != Z_OK)
+                    return false;
+
+                if (s > 0)
+                {
+                    const std::vector<uint8_t>& above = _strips[s - 1].filtered;
+                    size_t size = std::min(above.size(), _window);
+                    deflateSetDictionary(&strip.stream, above.data() + above.size() - size, static_cast<uInt>(size));
+                }
+                else if (_next_row > 0)
+                    deflateSetDictionary(&strip.stream, _dictionary.data(), static_cast<uInt>(_dictionary.size()));
+
+                // A sync flush adds an empty stored block of 5 bytes, deflateBound doesn't count it
+                size_t bound = deflateBound(&strip.stream, static_cast<uLong>(strip.filtered.size())) + 16;
+                if (strip.deflated.size() < bound)
+                    strip.deflated.resize(bound);
+
+                strip.stream.next_in = strip.filtered.data();
+                strip.stream.avail_in = static_cast<uInt>(strip.filtered.size());
+                strip.stream.next_out = strip.deflated.data();
+                strip.stream.avail_out = static_cast<uInt>(strip.deflated.size());
+                int result = deflate(&strip.stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+                if (result != (last ? Z_STREAM_END : Z_OK) || strip.stream.avail_in != 0)
+                    return false;
+
+                strip.deflated_bytes = strip.deflated.size() - strip.stream.avail_out;
+                strip.adler = adler32(adler32(0L, nullptr, 0), strip.filtered.data(), static_cast<uInt>(strip.filtered.size()));
+                strip.crc = crc32(crc32(0L, nullptr, 0), strip.deflated.data(), static_cast<uInt>(strip.deflated_bytes));
+                return true;
+            }
+
+            void _filter_row(const uint8_t* row, const uint8_t* above, uint32_t bytes, uint8_t* out, Strip& strip) const
+            {
+                if (config.filter != PngFilter::Adaptive)
+                {
+                    out[0] = _filter_type(config.filter);
+                    _apply_filter(config.filter, row, above, bytes, out + 1);
+                    return;
+                }
+
+                // Every candidate goes to its own scratch row, the sum of the bytes as signed values
+                // picks the one that compresses best, as libpng does
+                static constexpr PngFilter candidates[4] = { PngFilter::None, PngFilter::Sub, PngFilter::Up, PngFilter::Paeth };
+                strip.candidates.resize(4 * static_cast<size_t>(bytes));
+                uint32_t best = 0, best_sum = UINT32_MAX;
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    uint8_t* candidate = &strip.candidates[c * static_cast<size_t>(bytes)];
+                    const uint8_t* filtered = candidate;
+                    if (candidates[c] == PngFilter::None)
+                        filtered = row;
+                    else
+                        _apply_filter(candidates[c], row, above, bytes, candidate);
+
+                    // The absolute value of a byte as int8_t is min(v, -v) as uint8_t, which SSE2 has
+                    uint32_t sum = 0;
+                    for (uint32_t i = 0; i < bytes; i++)
+                        sum += std::min(filtered[i], static_cast<uint8_t>(-filtered[i]));
+                    if (sum < best_sum)
+                    {
+                        best = c;
+                        best_sum = sum;
+                    }
+                }
+                out[0] = _filter_type(candidates[best]);
+                std::memcpy(out + 1, candidates[best] == PngFilter::None ? row : &strip.candidates[best * static_cast<size_t>(bytes)], bytes);
+            }
+
+            static uint8_t _filter_type(PngFilter filter)
+            {
+                switch (filter)
+                {
+                    case PngFilter::Sub: return 1;
+                    case PngFilter::Up: return 2;
+                    case PngFilter::Paeth: return 4;
+                    default: return 0;
+                }
+            }
+
+            static void _apply_filter(PngFilter filter, const uint8_t* __restrict row, const uint8_t* __restrict above, uint32_t bytes, uint8_t* __restrict out)
+            {
+                // The first pixel has nothing to its left, above the first row is the zero row.
+                // Past the first pixel the loops have no branches, and vectorize
+                constexpr uint32_t bpp = 3;
+                switch (filter)
+                {
+                    case PngFilter::Sub:
+                        for (uint32_t i = 0; i < bpp; i++)
+                            out[i] = row[i];
+                        for (uint32_t i = bpp; i < bytes; i++)
+                            out[i] = static_cast<uint8_t>(row[i] - row[i - bpp]);
+                        break;
+                    case PngFilter::Up:
+                        for (uint32_t i = 0; i < bytes; i++)
+                            out[i] = static_cast<uint8_t>(row[i] - above[i]);
+                        break;
+                    case PngFilter::Paeth:
+                        // With a, c = 0 the predictor is b
+                        for (uint32_t i = 0; i < bpp; i++)
+                            out[i] = static_cast<uint8_t>(row[i] - above[i]);
+                        for (uint32_t i = bpp; i < bytes; i++)
+                        {
+                            // 16 bit lanes, pa = |p - a| with p = a + b - c
+                            int16_t a = row[i - bpp], b = above[i], c = above[i - bpp];
+                            int16_t pa = b - c, pb = a - c;
+                            int16_t pc = pa + pb;
+                            pa = pa < 0 ? -pa : pa;
+                            pb = pb < 0 ? -pb : pb;
+                            pc = pc < 0 ? -pc : pc;
+                            uint8_t predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                            out[i] = static_cast<uint8_t>(row[i] - predictor);
+                        }
+                        break;
+                    default:
+                        std::memcpy(out, row, bytes);
+                        break;
+                }
+            }
+
+            void _chunk(const char* type, const uint8_t* data, uint32_t size)
+            {
+                size_t offset = _png.size();
+                _png.resize(offset + 12 + size);
+                _put_u32(&_png[offset], size);
+                std::memcpy(&_png[offset + 4], type, 4);
+                if (size > 0)
+                    std::memcpy(&_png[offset + 8], data, size);
+                _put_u32(&_png[offset + 8 + size], static_cast<uint32_t>(crc32(0L, &_png[offset + 4], 4 + size)));
+            }
+
+            static void _put_u32(uint8_t* out, uint32_t value)
+            {
+                // PNG is big endian
+                out[0] = static_cast<uint8_t>(value >> 24);
+                out[1] = static_cast<uint8_t>(value >> 16);
+                out[2] = static_cast<uint8_t>(value >> 8);
+                out[3] = static_cast<uint8_t>(value);
+            }
+    };
+
+    class PngSink : public FrameSink
+    {
+        /*
+        Writes each frame to directory/<frame index>.png with a PngEncoder, which is
+        reused for every frame
+        */
+        public:
+            PngSink(const std::string& directory, const PngConfig& config = PngConfig())
+                :   _directory(directory),
+                    _encoder(config)
+                    {}
+
+            bool write(const Image& image, uint32_t frame_index) override
+            {
+                return _encoder.write(image, _directory + std::to_string(frame_index) + ".png");
+            }
+
+        private:
+            std::string _directory;
+            PngEncoder _encoder;
+    };
+}
+#endif
@@ -0,0 +1,812 @@
+#pragma once
+#ifndef PRIMITIVE_SCENE_H
+#define PRIMITIVE_SCENE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scene.h"
+#include "sdf_functions.h"
+
+/*
+Scenes made of data instead of code. A scene is a list of objects, each object a list
+of primitives combined in order, and it's loaded from a file at runtime. The primitives
+are stored as arrays of each field, and the objects are sorted along a bounding volume
+hierarchy, so the SDF only evaluates the objects near the point.
+
+The text form, for authoring, has an entry per line, # starts a comment:
+    material <name> light <r> <g> <b> <intensity>
+    material <name> reflective <reflectivity>
+    material <name> refractive <reflectivity> <ior> [<absorption r> <g> <b>]
+    material <name> opaque
+    [<operation>] <shape> <parameters> [rotate <degrees>] [<material>]
+A shape without operation starts an object, and needs a material. A shape with one of
+union, subtract, intersect or smooth_union <k> is combined into the last object, with
+the material of the object unless it names another. Shapes:
+    circle <x> <y> <radius>
+    box <x> <y> <half width> <half height>
+    round_box <x> <y> <half width> <half height> <radius>
+    line <x0> <y0> <x1> <y1> <radius>
+    plane <x> <y> <normal x> <normal y>
+The binary form is what the scene is in memory, so it's mapped and used in place
+*/
+
+namespace Lights2D
+{
+    enum class PrimitiveType : uint32_t
+    {
+        Circle,         // params: radius
+        Box,            // params: half width, half height
+        RoundBox,       // params: half width, half height, radius
+        Segment,        // params: half length, radius. Along the x axis of the primitive
+        Plane           // The y axis of the primitive is the normal
+    };
+
+    enum class CombineOp : uint32_t
+    {
+        Union,
+        Subtract,       // Removes the primitive from the object
+        Intersect,
+        SmoothUnion     // Blends distances and materials within k
+    };
+
+    struct Primitive
+    {
+        /*
+        A primitive as it's authored: the shape in its own frame, translated to position
+        and rotated by angle, in radians. op combines it into its object
+        */
+        PrimitiveType type = PrimitiveType::Circle;
+        CombineOp op = CombineOp::Union;
+        MaterialId material = 0;
+        Vec2 position;
+        float angle = 0.0f;
+        float params[3] = { 0.0f, 0.0f, 0.0f };
+        float k = 0.0f;
+    };
+
+    struct SceneDescription
+    {
+        // What the text form and scene generators produce, and PrimitiveScene::build takes
+        std::vector<Material> materials;
+        std::vector<std::vector<Primitive>> objects;
+    };
+
+    struct BvhNode
+    {
+        /*
+        Bounds of a subtree. Leaves have count objects from first. Inner nodes have a
+        count of 0, their first child is the next node and the second one is first
+        */
+        float min_x, min_y, max_x, max_y;
+        uint32_t first, count;
+    };
+
+    namespace PrimitiveSceneFormat
+    {
+        /*
+        A 64 byte header: magic, version, material_count, primitive_count, object_count,
+        bounded_count, node_count, all 32 bit little endian, the rest is zero. Then, with
+        4 byte values: the materials as 9 floats (emission, absorption, emission_intensity,
+        reflectivity, ior), an array per field of the primitives, the index of the first
+        primitive of each object plus the primitive count, and the nodes. Objects before
+        bounded_count are in the leaves of the hierarchy, the rest are unbounded (planes)
+        */
+        constexpr uint32_t magic = 0x4353324c;     // "L2SC" little endian
+        constexpr uint32_t version = 1;
+        constexpr size_t header_size = 64;
+        constexpr size_t material_floats = 9;
+        constexpr size_t primitive_fields = 11;     // type, op, material, x, y, cos, sin, 3 params, k
+        constexpr uint32_t max_depth = 64;
+
+        struct Counts
+        {
+            uint32_t materials, primitives, objects, bounded, nodes;
+
+            size_t primitives_offset() const { return header_size + static_cast<size_t>(materials) * material_floats * 4; }
+            size_t objects_offset() const { return primitives_offset() + static_cast<size_t>(primitives) * primitive_fields * 4; }
+            size_t nodes_offset() const { return objects_offset() + (static_cast<size_t>(objects) + 1) * 4; }
+            size_t bytes() const { return nodes_offset() + static_cast<size_t>(nodes) * sizeof(BvhNode); }
+        };
+    }
+
+    class PrimitiveSceneData
+    {
+        /*
+        Bytes of a scene in the binary form, either mapped from a file or built in memory.
+        Renderers copy the scene, they all share these
+        */
+        public:
+            PrimitiveSceneData(std::vector<uint32_t>&& words)
+                :   _words(std::move(words))
+                    {
+                        _bytes = reinterpret_cast<const uint8_t*>(_words.data());
+                        _size = _words.size() * sizeof(uint32_t);
+                    }
+
+            PrimitiveSceneData(const uint8_t* mapping, size_t size) : _bytes(mapping), _size(size), _mapped(true) {}
+
+            ~PrimitiveSceneData()
+            {
+                if (_mapped)
+                    munmap(const_cast<uint8_t*>(_bytes), _size);
+            }
+
+            PrimitiveSceneData(const PrimitiveSceneData&) = delete;
+            PrimitiveSceneData& operator=(const PrimitiveSceneData&) = delete;
+
+            const uint8_t* bytes() const { return _bytes; }
+            size_t size() const { return _size; }
+
+        private:
+            std::vector<uint32_t> _words;       // 4 byte aligned
+            const uint8_t* _bytes = nullptr;
+            size_t _size = 0;
+            bool _mapped = false;
+    };
+
+    class PrimitiveScene
+    {
+        /*
+        SDF of a scene loaded from data. Unbounded objects are evaluated first, then the
+        hierarchy is walked nearest child first, skipping the subtrees whose bounds are
+        farther than the nearest distance found so far. The distance of an object is never
+        smaller than the distance to its bounds, so the result is the same as evaluating
+        every object. Smooth unions grow the bounds by k / 4, the most they lower the distance.
+        Nothing in it moves, the whole scene is its static_part
+        */
+        public:
+            bool culling = true;                // false evaluates every object, to compare
+
+        public:
+            PrimitiveScene() {}
+
+            explicit PrimitiveScene(std::shared_ptr<const PrimitiveSceneData> data) : _data(data)
+            {
+                const uint32_t* header = reinterpret_cast<const uint32_t*>(data->bytes());
+                _counts = { header[2], header[3], header[4], header[5], header[6] };
+                const uint8_t* bytes = data->bytes();
+                const float* fields = reinterpret_cast<const float*>(bytes + _counts.primitives_offset());
+                size_t count = _counts.primitives;
+                _type = reinterpret_cast<const uint32_t*>(fields);
+                _op = reinterpret_cast<const uint32_t*>(fields + count);
+                _material = reinterpret_cast<const uint32_t*>(fields + 2 * count);
+                _x = fields + 3 * count;
+                _y = fields + 4 * count;
+                _cos = fields + 5 * count;
+                _sin = fields + 6 * count;
+                _a = fields + 7 * count;
+                _b = fields + 8 * count;
+                _c = fields + 9 * count;
+                _k = fields + 10 * count;
+                _object_first = reinterpret_cast<const uint32_t*>(bytes + _counts.objects_offset());
+                _nodes = reinterpret_cast<const BvhNode*>(bytes + _counts.nodes_offset());
+
+                // Each primitive is exact in its frame, a rotation that isn't unit length scales it
+                for (uint32_t i = 0; i < _counts.primitives; i++)
+                    _lipschitz = std::max(_lipschitz, std::sqrt(_cos[i] * _cos[i] + _sin[i] * _sin[i]));
+            }
+
+            uint32_t primitive_count() const { return _counts.primitives; }
+            uint32_t object_count() const { return _counts.objects; }
+            size_t bytes() const { return _data ? _data->size() : 0; }
+
+            // Bounds of the root of the hierarchy, unless there are unbounded objects
+            Bounds bounds() const
+            {
+                if (_counts.bounded < _counts.objects)
+                    return Bounds::everything();
+                if (_counts.nodes == 0)
+                    return Bounds::empty();
+                return { _nodes[0].min_x, _nodes[0].min_y, _nodes[0].max_x, _nodes[0].max_y };
+            }
+
+            // The operations keep the bound of their operands, the smooth union blends their gradients
+            float lipschitz() const { return _lipschitz; }
+
+            Nearest static_part(Vec2 pos) const
+            {
+                Nearest nearest;
+                for (uint32_t object = _counts.bounded; object < _counts.objects; object++)
+                    _object(object, pos, nearest);
+
+                if (!culling)
+                {
+                    for (uint32_t object = 0; object < _counts.bounded; object++)
+                        _object(object, pos, nearest);
+                    return nearest;
+                }
+                if (_counts.nodes == 0)
+                    return nearest;
+
+                // Stack of the farther children, with their squared distance when they were pushed
+                uint32_t stack[PrimitiveSceneFormat::max_depth];
+                float stack_distance[PrimitiveSceneFormat::max_depth];
+                uint32_t size = 0;
+                uint32_t node = 0;
+                while (true)
+                {
+                    const BvhNode& current = _nodes[node];
+                    if (current.count > 0)
+                    {
+                        for (uint32_t object = current.first; object < current.first + current.count; object++)
+                            _object(object, pos, nearest);
+                    }
+                    else
+                    {
+                        uint32_t near = node + 1, far = current.first;
+                        float near_distance = _box_distance2(_nodes[near], pos);
+                        float far_distance = _box_distance2(_nodes[far], pos);
+                        if (far_distance < near_distance)
+                        {
+                            std::swap(near, far);
+                            std::swap(near_distance, far_distance);
+                        }
+
+                        if (_may_be_nearer(near_distance, nearest.distance))
+                        {
+                            if (_may_be_nearer(far_distance, nearest.distance))
+                            {
+                                stack[size] = far;
+                                stack_distance[size++] = far_distance;
+                            }
+                            node = near;
+                            continue;
+                        }
+                    }
+
+                    // The nearest distance may have shrunk since the node was pushed
+                    do
+                    {
+                        if (size == 0)
+                            return nearest;
+                        size--;
+                    } while (!_may_be_nearer(stack_distance[size], nearest.distance));
+                    node = stack[size];
+                }
+            }
+
+            Nearest operator()(Vec2 pos, float time) const
+            {
+                return static_part(pos);
+            }
+
+            // Builds the scene in memory, with the hierarchy over its objects
+            static BasicScene<PrimitiveScene> build(const SceneDescription& description);
+
+            // Parses the text form. Returns false, with the line and the problem in error, if it's malformed
+            static bool parse(std::istream& text, SceneDescription& description, std::string& error);
+
+            // Maps a scene in the binary form, or parses and builds one in the text form
+            static bool load(const std::string& filepath, BasicScene<PrimitiveScene>& scene, std::string& error);
+
+            // Writes the binary form
+            bool save(const std::string& filepath) const
+            {
+                if (!_data)
+                    return false;
+                std::ofstream file(filepath, std::ios::binary);
+                file.write(reinterpret_cast<const char*>(_data->bytes()), _data->size());
+                return static_cast<bool>(file);
+            }
+
+        private:
+            std::shared_ptr<const PrimitiveSceneData> _data;
+            PrimitiveSceneFormat::Counts _counts = { 0, 0, 0, 0, 0 };
+            const uint32_t* _type = nullptr;
+            const uint32_t* _op = nullptr;
+            const uint32_t* _material = nullptr;
+            const float* _x = nullptr;
+            const float* _y = nullptr;
+            const float* _cos = nullptr;
+            const float* _sin = nullptr;
+            const float* _a = nullptr;
+            const float* _b = nullptr;
+            const float* _c = nullptr;
+            const float* _k = nullptr;
+            const uint32_t* _object_first = nullptr;
+            const BvhNode* _nodes = nullptr;
+            float _lipschitz = 1.0f;
+
+            static float _box_distance2(const BvhNode& node, Vec2 pos)
+            {
+                float dx = std::max(std::max(node.min_x - pos.x, pos.x - node.max_x), 0.0f);
+                float dy = std::max(std::max(node.min_y - pos.y, pos.y - node.max_y), 0.0f);
+                return dx * dx + dy * dy;
+            }
+
+            static bool _may_be_nearer(float box_distance2, float nearest_distance)
+            {
+                // A point inside the bounds can be inside the object, at any negative distance
+                return box_distance2 == 0.0f || (nearest_distance > 0.0f && box_distance2 < nearest_distance * nearest_distance);
+            }
+
+            float _primitive(uint32_t i, Vec2 pos) const
+            {
+                // Into the frame of the primitive
+                float dx = pos.x - _x[i], dy = pos.y - _y[i];
+                Vec2 p(dx * _cos[i] + dy * _sin[i], dy * _cos[i] - dx * _sin[i]);
+                switch (static_cast<PrimitiveType>(_type[i]))
+                {
+                    case PrimitiveType::Circle:
+                        return Vec2::length(p) - _a[i];
+                    case PrimitiveType::Box:
+                        return SDF::box(p, Vec2(), Vec2(_a[i], _b[i]));
+                    case PrimitiveType::RoundBox:
+                        return SDF::round_box(p, Vec2(), Vec2(_a[i], _b[i]), _c[i]);
+                    case PrimitiveType::Segment:
+                        return SDF::line(p, Vec2(-_a[i], 0.0f), Vec2(_a[i], 0.0f), _b[i]);
+                    default:
+                        return p.y;
+                }
+            }
+
+            void _object(uint32_t object, Vec2 pos, Nearest& nearest) const
+            {
+                uint32_t first = _object_first[object], end = _object_first[object + 1];
+                float distance = _primitive(first, pos);
+                if (end == first + 1)
+                {
+                    nearest.update(distance, _material[first]);
+                    return;
+                }
+
+                MaterialBlend material(_material[first]);
+                for (uint32_t i = first + 1; i < end; i++)
+                {
+                    float other = _primitive(i, pos);
+                    switch (static_cast<CombineOp>(_op[i]))
+                    {
+                        case CombineOp::Union:
+                            if (other < distance)
+                            {
+                                distance = other;
+                                material = MaterialBlend(_material[i]);
+                            }
+                            break;
+                        case CombineOp::Subtract:
+                            distance = SDF::combine_subtract(distance, other);
+                            break;
+                        case CombineOp::Intersect:
+                            distance = SDF::combine_intersect(distance, other);
+                            break;
+                        case CombineOp::SmoothUnion:
+                        {
+                            float h = SDF::smooth_t(distance, other, _k[i]);
+                            distance = SDF::combine_union_s(distance, other, _k[i], h);
+                            material = MaterialBlend::mix(MaterialBlend(_material[i]), material, h);
+                            break;
+                        }
+                    }
+                }
+                nearest.update(distance, material);
+            }
+
+            static bool _validate(const uint8_t* bytes, size_t size, std::string& error);
+    };
+
+    namespace PrimitiveSceneBuilder
+    {
+        static Bounds primitive_bounds(const Primitive& primitive)
+        {
+            // Axis aligned bounds of the rotated shape, planes are infinite
+            float c = std::abs(std::cos(primitive.angle)), s = std::abs(std::sin(primitive.angle));
+            float half_x, half_y;
+            switch (primitive.type)
+            {
+                case PrimitiveType::Circle:
+                    half_x = half_y = primitive.params[0];
+                    break;
+                case PrimitiveType::Box:
+                case PrimitiveType::RoundBox:
+                {
+                    float round = primitive.type == PrimitiveType::RoundBox ? primitive.params[2] : 0.0f;
+                    half_x = c * primitive.params[0] + s * primitive.params[1] + round;
+                    half_y = s * primitive.params[0] + c * primitive.params[1] + round;
+                    break;
+                }
+                case PrimitiveType::Segment:
+                    half_x = c * primitive.params[0] + primitive.params[1];
+                    half_y = s * primitive.params[0] + primitive.params[1];
+                    break;
+                default:
+                    half_x = half_y = INFINITY;
+            }
+            return { primitive.position.x - half_x, primitive.position.y - half_y, primitive.position.x + half_x, primitive.position.y + half_y };
+        }
+
+        static Bounds object_bounds(const std::vector<Primitive>& object)
+        {
+            // Subtractions and intersections only raise the distance, they keep the bounds
+            Bounds bounds = primitive_bounds(object[0]);
+            for (size_t i = 1; i < object.size(); i++)
+            {
+                if (object[i].op == CombineOp::Union || object[i].op == CombineOp::SmoothUnion)
+                    bounds.grow(primitive_bounds(object[i]));
+                if (object[i].op == CombineOp::SmoothUnion)
+                    bounds.expand(object[i].k * 0.25f);
+            }
+            return bounds;
+        }
+
+        static uint32_t build_node(
+            const std::vector<Bounds>& bounds,
+            std::vector<uint32_t>& order,
+            uint32_t begin,
+            uint32_t end,
+            std::vector<BvhNode>& nodes)
+        {
+            // Splits the objects at the median of their centers, along the longest axis of the centers
+            constexpr uint32_t leaf_objects = 4;
+            uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({});
+
+            Bounds node_bounds = Bounds::empty(), centers = Bounds::empty();
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const Bounds& object = bounds[order[i]];
+                node_bounds.grow(object);
+                float x = (object.min_x + object.max_x) * 0.5f, y = (object.min_y + object.max_y) * 0.5f;
+                centers.grow({ x, y, x, y });
+            }
+
+            if (end - begin <= leaf_objects)
+            {
+                nodes[index] = { node_bounds.min_x, node_bounds.min_y, node_bounds.max_x, node_bounds.max_y, begin, end - begin };
+                return index;
+            }
+
+            bool split_x = centers.max_x - centers.min_x >= centers.max_y - centers.min_y;
+            uint32_t middle = (begin + end) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) {
+                return split_x
+                    ? bounds[a].min_x + bounds[a].max_x < bounds[b].min_x + bounds[b].max_x
+                    : bounds[a].min_y + bounds[a].max_y < bounds[b].min_y + bounds[b].max_y;
+            });
+
+            build_node(bounds, order, begin, middle, nodes);
+            uint32_t second = build_node(bounds, order, middle, end, nodes);
+            nodes[index] = { node_bounds.min_x, node_bounds.min_y, node_bounds.max_x, node_bounds.max_y, second, 0 };
+            return index;
+        }
+    }
+
+    inline BasicScene<PrimitiveScene> PrimitiveScene::build(const SceneDescription& description)
+    {
+        using namespace PrimitiveSceneBuilder;
+
+        // Bounded objects in the order of the leaves, then the unbounded ones
+        std::vector<Bounds> bounds;
+        std::vector<uint32_t> bounded, unbounded;
+        for (uint32_t i = 0; i < description.objects.size(); i++)
+        {
+            if (description.objects[i].empty())
+                continue;
+            Bounds object = object_bounds(description.objects[i]);
+            if (object.finite())
+            {
+                bounds.push_back(object);
+                bounded.push_back(i);
+            }
+            else
+                unbounded.push_back(i);
+        }
+
+        std::vector<uint32_t> order(bounded.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::vector<BvhNode> nodes;
+        if (!order.empty())
+            build_node(bounds, order, 0, static_cast<uint32_t>(order.size()), nodes);
+
+        std::vector<uint32_t> objects;
+        for (uint32_t i : order)
+            objects.push_back(bounded[i]);
+        objects.insert(objects.end(), unbounded.begin(), unbounded.end());
+
+        uint32_t primitive_count = 0;
+        for (uint32_t object : objects)
+            primitive_count += static_cast<uint32_t>(description.objects[object].size());
+
+        PrimitiveSceneFormat::Counts counts = {
+            static_cast<uint32_t>(description.materials.size()),
+            primitive_count,
+            static_cast<uint32_t>(objects.size()),
+            static_cast<uint32_t>(order.size()),
+            static_cast<uint32_t>(nodes.size()) };
+        std::vector<uint32_t> words(counts.bytes() / 4, 0);
+        uint32_t header[] = { PrimitiveSceneFormat::magic, PrimitiveSceneFormat::version, counts.materials, counts.primitives, counts.objects, counts.bounded, counts.nodes };
+        std::memcpy(words.data(), header, sizeof(header));
+
+        float* materials = reinterpret_cast<float*>(words.data() + PrimitiveSceneFormat::header_size / 4);
+        for (const Material& material : description.materials)
+        {
+            float values[PrimitiveSceneFormat::material_floats] = {
+                material.emission.r, material.emission.g, material.emission.b,
+                material.absorption.r, material.absorption.g, material.absorption.b,
+                material.emission_intensity, material.reflectivity, material.ior };
+            std::memcpy(materials, values, sizeof(values));
+            materials += PrimitiveSceneFormat::material_floats;
+        }
+
+        uint32_t* fields = words.data() + counts.primitives_offset() / 4;
+        uint32_t* object_first = words.data() + counts.objects_offset() / 4;
+        uint32_t primitive = 0;
+        for (uint32_t i = 0; i < objects.size(); i++)
+        {
+            object_first[i] = primitive;
+            for (const Primitive& source : description.objects[objects[i]])
+            {
+                float values[] = {
+                    source.position.x, source.position.y, std::cos(source.angle), std::sin(source.angle),
+                    source.params[0], source.params[1], source.params[2], source.k };
+                fields[primitive] = static_cast<uint32_t>(source.type);
+                fields[primitive_count + primitive] = static_cast<uint32_t>(source.op);
+                fields[2 * primitive_count + primitive] = source.material;
+                for (uint32_t field = 0; field < 8; field++)
+                    std::memcpy(&fields[(3 + field) * primitive_count + primitive], &values[field], sizeof(float));
+                primitive++;
+            }
+        }
+        object_first[objects.size()] = primitive;
+        if (!nodes.empty())
+            std::memcpy(words.data() + counts.nodes_offset() / 4, nodes.data(), nodes.size() * sizeof(BvhNode));
+
+        MaterialTable table;
+        for (const Material& material : description.materials)
+            table.add(material);
+        return BasicScene<PrimitiveScene>(table, PrimitiveScene(std::make_shared<PrimitiveSceneData>(std::move(words))));
+    }
+
+    inline bool PrimitiveScene::parse(std::istream& text, SceneDescription& description, std::string& error)
+    {
+        std::map<std::string, MaterialId> material_names;
+        std::string line;
+        for (uint32_t line_number = 1; std::getline(text, line); line_number++)
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream tokens(line);
+            std::string keyword;
+            if (!(tokens >> keyword))
+                continue;
+
+            auto fail = [&](const std::string& message) {
+                error = "line " + std::to_string(line_number) + ": " + message;
+                return false;
+            };
+
+            if (keyword == "material")
+            {
+                std::string name, kind;
+                tokens >> name >> kind;
+                float values[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+                uint32_t required = kind == "light" ? 4 : kind == "reflective" ? 1 : kind == "refractive" ? 2 : kind == "opaque" ? 0 : 7;
+                if (required == 7)
+                    return fail("unknown material kind \"" + kind + "\"");
+                uint32_t count = 0;
+                while (count < 6 && tokens >> values[count])
+                    count++;
+                if (count < required)
+                    return fail("missing values of material " + name);
+
+                Material material = Material::create_opaque();
+                if (kind == "light")
+                    material = Material::create_light(Color(values[0], values[1], values[2]), values[3]);
+                else if (kind == "reflective")
+                    material = Material::create_reflective(values[0]);
+                else if (kind == "refractive")
+                    material = Material::create_refractive(values[0], values[1], Color(values[2], values[3], values[4]));
+                material_names[name] = static_cast<MaterialId>(description.materials.size());
+                description.materials.push_back(material);
+                continue;
+            }
+
+            Primitive primitive;
+            bool starts_object = true;
+            std::string shape = keyword;
+            if (keyword == "union" || keyword == "subtract" || keyword == "intersect" || keyword == "smooth_union")
+            {
+                if (description.objects.empty())
+                    return fail(keyword + " before any object");
+                starts_object = false;
+                primitive.op = keyword == "union" ? CombineOp::Union : keyword == "subtract" ? CombineOp::Subtract
+                    : keyword == "intersect" ? CombineOp::Intersect : CombineOp::SmoothUnion;
+                if (primitive.op == CombineOp::SmoothUnion && !(tokens >> primitive.k))
+                    return fail("smooth_union needs its k");
+                if (!(tokens >> shape))
+                    return fail("missing shape after " + keyword);
+            }
+
+            float values[5];
+            uint32_t required = shape == "circle" ? 3 : shape == "box" || shape == "plane" ? 4 : shape == "round_box" || shape == "line" ? 5 : 0;
+            if (required == 0)
+                return fail("unknown shape \"" + shape + "\"");
+            for (uint32_t i = 0; i < required; i++)
+                if (!(tokens >> values[i]))
+                    return fail("missing parameters of " + shape);
+
+            primitive.position = Vec2(values[0], values[1]);
+            if (shape == "circle")
+                primitive.params[0] = values[2];
+            else if (shape == "box" || shape == "round_box")
+            {
+                primitive.type = shape == "box" ? PrimitiveType::Box : PrimitiveType::RoundBox;
+                primitive.params[0] = values[2];
+                primitive.params[1] = values[3];
+                primitive.params[2] = shape == "box" ? 0.0f : values[4];
+            }
+            else if (shape == "line")
+            {
+                Vec2 a(values[0], values[1]), b(values[2], values[3]);
+                primitive.type = PrimitiveType::Segment;
+                primitive.position = (a + b) * 0.5f;
+                primitive.angle = std::atan2(b.y - a.y, b.x - a.x);
+                primitive.params[0] = Vec2::length(b - a) * 0.5f;
+                primitive.params[1] = values[4];
+            }
+            else
+            {
+                primitive.type = PrimitiveType::Plane;
+                primitive.angle = std::atan2(values[3], values[2]) - PI * 0.5f;
+            }
+
+            std::string word;
+            bool has_material = false;
+            while (tokens >> word)
+            {
+                float degrees;
+                if (word == "rotate" && tokens >> degrees)
+                    primitive.angle += degrees * PI / 180.0f;
+                else if (material_names.count(word))
+                {
+                    primitive.material = material_names[word];
+                    has_material = true;
+                }
+                else
+                    return fail("unknown material \"" + word + "\"");
+            }
+
+            if (starts_object)
+            {
+                if (!has_material)
+                    return fail(shape + " starts an object, it needs a material");
+                description.objects.push_back({ primitive });
+            }
+            else
+            {
+                if (!has_material)
+                    primitive.material = description.objects.back()[0].material;
+                description.objects.back().push_back(primitive);
+            }
+        }
+        return true;
+    }
+
+    inline bool PrimitiveScene::_validate(const uint8_t* bytes, size_t size, std::string& error)
+    {
+        // The mapping is used in place, every index in it is checked once here
+        using namespace PrimitiveSceneFormat;
+        const uint32_t* header = reinterpret_cast<const uint32_t*>(bytes);
+        Counts counts = { header[2], header[3], header[4], header[5], header[6] };
+        if (header[1] != version)
+        {
+            error = "unsupported version " + std::to_string(header[1]);
+            return false;
+        }
+        if (size < counts.bytes() || counts.bounded > counts.objects || (counts.bounded == 0) != (counts.nodes == 0))
+        {
+            error = "truncated file, or bad counts";
+            return false;
+        }
+
+        const uint32_t* fields = reinterpret_cast<const uint32_t*>(bytes + counts.primitives_offset());
+        for (uint32_t i = 0; i < counts.primitives; i++)
+        {
+            if (fields[i] > static_cast<uint32_t>(PrimitiveType::Plane) || fields[counts.primitives + i] > static_cast<uint32_t>(CombineOp::SmoothUnion)
+                || fields[2 * counts.primitives + i] >= counts.materials)
+            {
+                error = "bad primitive " + std::to_string(i);
+                return false;
+            }
+        }
+
+        const uint32_t* object_first = reinterpret_cast<const uint32_t*>(bytes + counts.objects_offset());
+        bool objects_valid = object_first[0] == 0 && object_first[counts.objects] == counts.primitives;
+        for (uint32_t i = 0; i < counts.objects && objects_valid; i++)
+            objects_valid = object_first[i] < object_first[i + 1];
+        if (!objects_valid)
+        {
+            error = "bad object ranges";
+            return false;
+        }
+
+        // Children come after their parent, so depths are known in a single pass
+        const BvhNode* nodes = reinterpret_cast<const BvhNode*>(bytes + counts.nodes_offset());
+        std::vector<uint32_t> depth(counts.nodes, 0);
+        for (uint32_t i = 0; i < counts.nodes; i++)
+        {
+            const BvhNode& node = nodes[i];
+            bool valid = node.count > 0
+                ? node.first <= counts.bounded && node.count <= counts.bounded - node.first
+                : i + 1 < node.first && node.first < counts.nodes && depth[i] + 1 < max_depth;
+            if (!valid)
+            {
+                error = "bad node " + std::to_string(i);
+                return false;
+            }
+            if (node.count == 0)
+                depth[i + 1] = depth[node.first] = depth[i] + 1;
+        }
+        return true;
+    }
+
+    inline bool PrimitiveScene::load(const std::string& filepath, BasicScene<PrimitiveScene>& scene, std::string& error)
+    {
+        int descriptor = ::open(filepath.c_str(), O_RDONLY);
+        if (descriptor < 0)
+        {
+            error = "can't open " + filepath;
+            return false;
+        }
+
+        uint32_t header[7] = {};
+        struct stat status;
+        bool binary = ::pread(descriptor, header, sizeof(header), 0) == sizeof(header) && header[0] == PrimitiveSceneFormat::magic;
+        if (!binary)
+        {
+            close(descriptor);
+            std::ifstream file(filepath);
+            SceneDescription description;
+            if (!parse(file, description, error))
+                return false;
+            scene = build(description);
+            return true;
+        }
+
+        void* mapping = MAP_FAILED;
+        size_t size = 0;
+        if (fstat(descriptor, &status) == 0 && static_cast<size_t>(status.st_size) >= PrimitiveSceneFormat::header_size)
+        {
+            size = static_cast<size_t>(status.st_size);
+            mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+        }
+        close(descriptor);
+        if (mapping == MAP_FAILED)
+        {
+            error = "can't map " + filepath;
+            return false;
+        }
+
+        auto data = std::make_shared<PrimitiveSceneData>(static_cast<const uint8_t*>(mapping), size);
+        if (!_validate(data->bytes(), size, error))
+            return false;
+
+        PrimitiveScene sdf(data);
+        MaterialTable table;
+        const float* materials = reinterpret_cast<const float*>(data->bytes() + PrimitiveSceneFormat::header_size);
+        for (uint32_t i = 0; i < sdf._counts.materials; i++, materials += PrimitiveSceneFormat::material_floats)
+        {
+            Material material = Material::create_opaque();
+            material.emission = Color(materials[0], materials[1], materials[2]);
+            material.absorption = Color(materials[3], materials[4], materials[5]);
+            material.emission_intensity = materials[6];
+            material.reflectivity = materials[7];
+            material.ior = materials[8];
+            table.add(material);
+        }
+        scene = BasicScene<PrimitiveScene>(table, sdf);
+        return true;
+    }
+}
+#endif
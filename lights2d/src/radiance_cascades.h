@@ -0,0 +1,130 @@
+#pragma once
+#ifndef RADIANCE_CASCADES_H
+#define RADIANCE_CASCADES_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "color.h"
+
+namespace Lights2D
+{
+    class Cascade
+    {
+        /*
+        One level of radiance cascades. Probes are on a grid of spacing pixels, and
+        each probe traces directions rays over the interval [start, end) of distances,
+        in pixels. Level i + 1 has twice the spacing, four times the directions, and an
+        interval four times as long that starts where the one of level i ends, so every
+        level traces about the same number of rays. Directions are at the centers of
+        equal angular sectors, the four of level i + 1 at 4k..4k+3 split the sector of
+        direction k of level i.
+        radiance holds, for every probe and direction, what the ray sees in its interval
+        plus, if it escaped it, what the level above sees further along, merged from the
+        four nearest probes and the four directions of the sector.
+        Probes are on the grid of the whole frame, a level only holds the window of them
+        [x0, x0 + width) x [y0, y0 + height). A part of the frame holds the probes of its
+        pixels at the first level, and at each level above the ones the level below
+        merges, so parts render the same probes as the whole frame
+        */
+        public:
+            uint32_t frame_width, frame_height;     // Probes over the whole frame
+            uint32_t x0, y0, width, height;         // Window of probes held
+            uint32_t directions;
+            uint32_t spacing;                       // Pixels between probes
+            float start, end;                       // Interval of distances, in pixels
+            std::vector<Color<float>> radiance;
+
+        public:
+            Cascade(uint32_t level, uint32_t frame_pixels_x, uint32_t frame_pixels_y, uint32_t base_directions, float base_interval)
+            {
+                spacing = 1u << level;
+                frame_width = (frame_pixels_x + spacing - 1) / spacing;
+                frame_height = (frame_pixels_y + spacing - 1) / spacing;
+                x0 = y0 = 0;
+                width = frame_width;
+                height = frame_height;
+                directions = base_directions << (2 * level);
+
+                // base_interval * (1 + 4 + ... + 4^(level - 1))
+                float scale = static_cast<float>(1u << (2 * level));
+                start = base_interval * (scale - 1.0f) / 3.0f;
+                end = start + base_interval * scale;
+            }
+
+            // Holds the probes [x_begin, x_end) x [y_begin, y_end) of the frame grid
+            void set_window(uint32_t x_begin, uint32_t y_begin, uint32_t x_end, uint32_t y_end)
+            {
+                x0 = x_begin;
+                y0 = y_begin;
+                width = x_end - x_begin;
+                height = y_end - y_begin;
+                radiance.assign(static_cast<size_t>(width) * height * directions, Color<float>(0.0f));
+            }
+
+            // Window of the probes of the level above that merged() reads from the probes [begin, end) of
+            // this one, along x with the frame size of the level above
+            static void merged_window(uint32_t begin, uint32_t end, uint32_t spacing, uint32_t upper_frame_size, uint32_t& upper_begin, uint32_t& upper_end)
+            {
+                upper_begin = _upper_probe(begin, spacing, upper_frame_size);
+                upper_end = std::min(_upper_probe(end - 1, spacing, upper_frame_size) + 2, upper_frame_size);
+            }
+
+            // Levels needed for the last interval to reach range pixels
+            static uint32_t levels(float range, float base_interval)
+            {
+                uint32_t count = 1;
+                while (base_interval * (std::pow(4.0f, static_cast<float>(count)) - 1.0f) / 3.0f < range && count < 12)
+                    count++;
+                return count;
+            }
+
+            // Center of a probe of the window, in pixels from the corner of the frame
+            float probe_x(uint32_t x) const { return (x0 + x + 0.5f) * spacing; }
+            float probe_y(uint32_t y) const { return (y0 + y + 0.5f) * spacing; }
+
+            float angle(uint32_t direction) const
+            {
+                return 6.283185307f * (direction + 0.5f) / directions;
+            }
+
+            Color<float>& at(uint32_t x, uint32_t y, uint32_t direction)
+            {
+                return radiance[(static_cast<size_t>(y) * width + x) * directions + direction];
+            }
+
+            // Radiance of this level seen from (px, py) in the sector of direction of the level below:
+            // bilinear between the four nearest probes, averaged over the four directions of the sector.
+            // It clamps at the edges of the frame, the window holds every probe it reads
+            Color<float> merged(float px, float py, uint32_t lower_direction) const
+            {
+                float gx = std::min(std::max(px / spacing - 0.5f, 0.0f), static_cast<float>(frame_width - 1));
+                float gy = std::min(std::max(py / spacing - 0.5f, 0.0f), static_cast<float>(frame_height - 1));
+                uint32_t left = static_cast<uint32_t>(gx), top = static_cast<uint32_t>(gy);
+                uint32_t right = std::min(left + 1, frame_width - 1), bottom = std::min(top + 1, frame_height - 1);
+                float fx = gx - left, fy = gy - top;
+
+                const uint32_t probes[4][2] = { { left, top }, { right, top }, { left, bottom }, { right, bottom } };
+                const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+                Color<float> result;
+                for (uint32_t p = 0; p < 4; p++)
+                {
+                    size_t probe = static_cast<size_t>(probes[p][1] - y0) * width + (probes[p][0] - x0);
+                    const Color<float>* sector = &radiance[probe * directions + lower_direction * 4];
+                    result += (sector[0] + sector[1] + sector[2] + sector[3]) * (weights[p] * 0.25f);
+                }
+                return result;
+            }
+
+        private:
+            // First probe of the level above merged() reads for the probe index of this level
+            static uint32_t _upper_probe(uint32_t index, uint32_t spacing, uint32_t upper_frame_size)
+            {
+                float position = (index + 0.5f) * spacing / (2 * spacing) - 0.5f;
+                return static_cast<uint32_t>(std::min(std::max(position, 0.0f), static_cast<float>(upper_frame_size - 1)));
+            }
+    };
+}
+#endif
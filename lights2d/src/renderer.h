@@ -3,22 +3,37 @@
 #define RENDERER_H
 
 #include "image.h"
+#include "framebuffer.h"
+#include "partial_frame.h"
+#include "checkpoint.h"
+#include "tone_map.h"
 #include "vec2.h"
 #include "material.h"
+#include "scene.h"
+#include "tiles.h"
+#include "sampler.h"
+#include "radiance_cascades.h"
+#include "distance_grid.h"
+#include "light_sampler.h"
 #include <random>
 #include <memory>
 #include <functional>
+#include <type_traits>
+#include <atomic>
 
 namespace Lights2D
 {
-    struct Nearest
+    enum class Integrator
     {
-        // SDF Scene function returns Nearest data
-        float distance;
-        Material mtl;
-        Nearest() : distance(10e5), mtl() {}
+        Splitting,      // Traces both the reflected and the refracted ray at each hit, up to max_recursion_depth
+        PathTracing     // Follows a single branch per bounce, chosen by Fresnel reflectance, ended by Russian roulette
     };
 
+    enum class Engine
+    {
+        MonteCarlo,         // Random rays per pixel, estimated with the integrator and sampler
+        RadianceCascades    // Probe cascades traced and merged once per frame, without noise, at a fixed cost
+    };
 
     struct FrameConfig
     {
@@ -28,7 +43,35 @@ namespace Lights2D
         uint32_t ray_march_max_iterations;      // If the images produced have "black edges / artifacts" probably increasing this attribute would give better results 
         float aspect_ratio;                     // Should be manually set width / height
         bool antialias;                         // Recommended if smooth edges are desired
-        float gamma;
+        float gamma;                            // Encoding gamma of the output image
+        float exposure;                         // Radiance is multiplied by it before tone mapping
+        bool dither;                            // Adds blue noise of one quantization step before rounding
+        uint32_t tile_size;                     // Frame is split in tile_size x tile_size tasks, 16 or 32 work well
+        uint32_t threads;                       // Worker threads used by render(), 0 lets TBB use every core
+        uint32_t packet_width;                  // Primary rays marched together: 0 picks 8 (AVX2) or 4 at run time, 1 disables packets
+        Integrator integrator;
+        uint32_t roulette_depth;                // Bounces a path makes before Russian roulette can end it
+        float adaptive_tolerance;               // Relative error a pixel stops sampling at, 0 always takes samples per pixel
+        uint32_t min_samples;                   // Adaptive sampling never takes fewer samples per pixel
+        uint32_t adaptive_round;                // Samples taken between convergence checks
+        SamplerType sampler;
+        uint32_t seed;                          // Decorrelates the random numbers of different frames
+        uint32_t sample_begin;                  // Range of sample indices taken, [sample_begin, sample_end), to split a frame between processes
+        uint32_t sample_end;                    // 0 means samples
+        std::vector<Tile> regions;              // Pixel rectangles rendered, in frame coordinates. Empty renders the whole frame,
+                                                // otherwise the pixels of img outside them are left as they were
+        Engine engine;
+        uint32_t cascade_directions;            // Radiance cascades: directions of the probes of the first cascade,
+        float cascade_interval;                 // and the length of their interval in pixels
+        float grid_error;                       // Marches a baked distance grid with this error, in scene units, 0 marches the SDF
+        uint32_t grid_megabytes;                // Memory budget of the grid, its error grows until it fits
+        bool scene_bounds;                      // Ends rays that leave the bounds of scenes that declare them
+        float relaxation;                       // Steps of scenes that declare lipschitz() are stretched by it, 1.2 to 1.8,
+                                                // and fall back to plain steps once one overshoots. 1 marches plainly
+        float hit_footprint;                    // Hit distance in pixels per scene unit travelled, rays stop as they get closer
+                                                // than the pixels they cover. 0 keeps MARCH_HIT_DIST, grazing rays take every iteration
+        float light_sampling;                   // Fraction of the primary rays sent toward the lights of scenes that declare lights(),
+                                                // weighted against the uniform rays by multiple importance sampling. Below 1, 0 disables
         FrameConfig(
             uint32_t width,
             uint32_t height,
@@ -44,47 +87,285 @@ namespace Lights2D
             ray_march_max_iterations(ray_march_max_iterations),
             aspect_ratio(static_cast<float>(width) / static_cast<float>(height)),
             antialias(antialias),
-            gamma(2.2f)
+            gamma(2.2f),
+            exposure(1.0f),
+            dither(false),
+            tile_size(16),
+            threads(0),
+            packet_width(0),
+            integrator(Integrator::Splitting),
+            roulette_depth(3),
+            adaptive_tolerance(0.0f),
+            min_samples(32),
+            adaptive_round(16),
+            sampler(SamplerType::Sobol),
+            seed(0),
+            sample_begin(0),
+            sample_end(0),
+            engine(Engine::MonteCarlo),
+            cascade_directions(4),
+            cascade_interval(1.0f),
+            grid_error(0.0f),
+            grid_megabytes(64),
+            scene_bounds(true),
+            relaxation(1.0f),
+            hit_footprint(0.0f),
+            light_sampling(0.0f)
             {}
     };
 
-    // Function pointer type definition. This function should be given as an argument to the constructor of the renderer
-    typedef std::function<Nearest(Vec2, float)> SignedDistanceFunction;
+    struct ProgressiveConfig
+    {
+        uint32_t pass_samples;                  // Samples per pixel added by each pass
+        uint32_t target_samples;                // Stops once every pixel has this many samples, 0 for no limit
+        float time_budget;                      // Seconds, stops before a pass that wouldn't finish in time, 0 for no limit
+    };
+
+    // Receives the tone mapped image and the samples per pixel after each pass of render_progressive.
+    // The image is the renderer's own, it's valid until the callback returns and the next pass overwrites it
+    typedef std::function<void(std::shared_ptr<const Image>, uint32_t)> ProgressiveCallback;
+
+    struct PixelEstimate
+    {
+        /*
+        Sum of the samples of a pixel, and the running mean and variance (Welford) of
+        the luminance of each round. Rounds are stratified, so the spread of their means
+        measures the error of the estimate far better than the spread of single samples
+        */
+        Color<float> sum;
+        int64_t fixed_sum[3] = { 0, 0, 0 };    // Exact sum, independent of the order of the samples
+        uint32_t count = 0;
+        uint32_t rounds = 0;
+        float mean = 0.0f;
+        float m2 = 0.0f;
+
+        void add(const Color<float>& sample)
+        {
+            sum += sample;
+            fixed_sum[0] += FixedPoint::from_float(sample.r);
+            fixed_sum[1] += FixedPoint::from_float(sample.g);
+            fixed_sum[2] += FixedPoint::from_float(sample.b);
+            count++;
+        }
+
+        Color<float> exact_sum() const
+        {
+            return { FixedPoint::to_float(fixed_sum[0]), FixedPoint::to_float(fixed_sum[1]), FixedPoint::to_float(fixed_sum[2]) };
+        }
+
+        void finish_round(const Color<float>& round_sum, uint32_t round_count)
+        {
+            float luminance = (0.2126f * round_sum.r + 0.7152f * round_sum.g + 0.0722f * round_sum.b) / round_count;
+            rounds++;
+            float delta = luminance - mean;
+            mean += delta / rounds;
+            m2 += delta * (luminance - mean);
+        }
+
+        bool converged(float tolerance) const
+        {
+            // Half width of the 95% confidence interval of the mean, relative to the mean.
+            // The mean is floored, so black pixels compare against an absolute error
+            if (rounds < 2)
+                return false;
+            float standard_error = sqrtf(m2 / (rounds - 1) / rounds);
+            return 1.96f * standard_error <= tolerance * std::max(mean, 0.01f);
+        }
+    };
+
+    struct MarchCounters
+    {
+        /*
+        Totals of the rays marched while a renderer has them. A ray that leaves the
+        scene bounds never hits anything, without them it would march until
+        ray_march_max_iterations, the iterations it didn't take are counted as saved.
+        Rays that run out of iterations without hitting or leaving are the black edges
+        along grazed surfaces
+        */
+        std::atomic<uint64_t> rays{ 0 };
+        std::atomic<uint64_t> iterations{ 0 };          // Evaluations of the SDF, every lane of a packet counts
+        std::atomic<uint64_t> culled_rays{ 0 };         // Ended by the scene bounds
+        std::atomic<uint64_t> saved_iterations{ 0 };
+        std::atomic<uint64_t> exhausted_rays{ 0 };      // Ended by ray_march_max_iterations
+        std::atomic<uint64_t> failed_steps{ 0 };        // Over-relaxed steps that overshot and were taken back
+
+        void add(uint64_t ray_count, uint64_t iteration_count, uint64_t culled_count, uint64_t saved_count,
+            uint64_t exhausted_count = 0, uint64_t failed_count = 0)
+        {
+            rays.fetch_add(ray_count, std::memory_order_relaxed);
+            iterations.fetch_add(iteration_count, std::memory_order_relaxed);
+            culled_rays.fetch_add(culled_count, std::memory_order_relaxed);
+            saved_iterations.fetch_add(saved_count, std::memory_order_relaxed);
+            exhausted_rays.fetch_add(exhausted_count, std::memory_order_relaxed);
+            failed_steps.fetch_add(failed_count, std::memory_order_relaxed);
+        }
 
+        void reset()
+        {
+            rays = 0;
+            iterations = 0;
+            culled_rays = 0;
+            saved_iterations = 0;
+            exhausted_rays = 0;
+            failed_steps = 0;
+        }
+    };
+
+    template <typename SDF>
     class Renderer
     {
+        /*
+        Renderer is specialized for the type of the scene SDF, so the compiler can
+        inline the scene into the ray march loop. Renderer<SignedDistanceFunction>
+        is the type erased fallback, it's compiled once in renderer.cpp
+        */
 
         public:
             std::shared_ptr<Image> img;
             FrameConfig config;
-            std::vector<uint32_t> height_values;
-            SignedDistanceFunction sdf;
+
+            // Float radiance of the frame, img is produced from it by the output stage
+            std::shared_ptr<Framebuffer> framebuffer;
+            std::vector<Tile> tiles;
+            BasicScene<SDF> scene;
             bool debug;
 
+            // When set, receives the samples taken by each pixel, relative to config.samples. Same size as img
+            std::shared_ptr<Image> sample_count_img;
+
+            // When set, receives the exact sums of the frame, so it can be merged with other sample ranges
+            std::shared_ptr<PartialFrame> partial;
+
+            // When set, counts the marches of the frame, from zero at every render
+            std::shared_ptr<MarchCounters> counters;
+
+            // Baked distances marched instead of the SDF away from surfaces, with config.grid_error. Baked by
+            // render() when missing or baked at another time, renderers of the same scene can share it
+            std::shared_ptr<const DistanceGrid> grid;
+
+            // A grid of a scene with a static part doesn't depend on the time, one serves every frame
+            static constexpr bool static_grid = has_static_part<SDF>::value;
+
         public:
-            Renderer(FrameConfig config, SignedDistanceFunction sdf, float time, std::shared_ptr<Image> image)
-                :   sdf(sdf),
+            Renderer(FrameConfig config, const BasicScene<SDF>& scene, float time, std::shared_ptr<Image> image)
+                :   Renderer(config, scene, time, image, Tile{ 0, 0, config.width, config.height }) {}
+
+            // Renders only the pixels of region, img and the framebuffer have the size of the region
+            Renderer(FrameConfig config, const BasicScene<SDF>& scene, float time, std::shared_ptr<Image> image, const Tile& region)
+                :   img(image),
                     config(config),
-                    img(image),
-                    _time(time)
+                    framebuffer(std::make_shared<Framebuffer>(region.width(), region.height())),
+                    scene(scene),
+                    debug(false),
+                    _time(time),
+                    _region(region)
                     {
-
-                    height_values.resize(config.height);
-                    for (uint32_t y = 0; y < config.height; y++)
-                        height_values[y] = y;
+                        _generate_tiles();
+                        _sampler = Samplers::create(config.sampler, config.seed);
+                        _packet_width = _select_packet_width(config.packet_width);
+                        _update_lights();
                     }
 
+            // Renders every tile, or the radiance cascades with Engine::RadianceCascades, and tone maps the frame
+            // into img, in a task arena limited to config.threads workers
             void render();
 
+            // Same as render(), in the task arena of the caller, so frames rendered concurrently share its workers
+            void render_in_arena();
+
+            // Moves the renderer to another frame of a sequence, the buffers and tiles are kept
+            void set_frame(float time, uint32_t seed);
+
+            // Moves the renderer to another part of the frame. The buffers are kept if the size is the same,
+            // otherwise the framebuffer and img are replaced
+            void set_region(const Tile& region);
+            const Tile& region() const { return _region; }
+
+            // Bakes grid for the current time, in the task arena of the caller
+            void bake_grid();
+
+            // Renders the radiance of the pixels of a single tile. Can be called concurrently for disjoint tiles
+            void render_tile(const Tile& tile);
+
+            // Renders passes of progressive.pass_samples into the framebuffer until the target or the time budget
+            // is reached, calling on_pass after each one. Sampling isn't adaptive. Returns the samples per pixel taken
+            uint32_t render_progressive(const ProgressiveConfig& progressive, ProgressiveCallback on_pass = nullptr);
+
+            // Renders config.samples in passes of pass_samples, saving the exact sums to checkpoint_path when
+            // checkpoint_interval seconds have passed since the last save, and once done. A checkpoint of the same
+            // frame in the file is resumed, the result is the same bits as an uninterrupted run. Sets partial.
+            // Returns false if a checkpoint can't be written
+            bool render_checkpointed(const std::string& checkpoint_path, uint32_t pass_samples, float checkpoint_interval);
+
         protected:
             Vec2 gradient(Vec2 p);
 
         private:
-            Color<float> _sample(Vec2 uv, uint32_t sample_index);
+            // Packets and duals require a scene whose operator() is a template on the scalar type
+            static constexpr bool _supports_packets =
+                std::is_invocable_r_v<BasicNearest<Float4>, const SDF&, Vector2<Float4>, float>;
+            static constexpr bool _supports_duals =
+                std::is_invocable_r_v<BasicNearest<Dual>, const SDF&, Vector2<Dual>, float>;
+
+            static uint32_t _select_packet_width(uint32_t requested)
+            {
+                if (!_supports_packets || requested == 1)
+                    return 1;
+                if (Simd::cpu_supports_avx2() && (requested == 0 || requested >= 8))
+                    return 8;
+                return 4;
+            }
+
+            void _generate_tiles();
+            void _update_grid();
+            float _grid_step(Vec2 point) const;
+            void _update_lights();
+            bool _clip(Vec2 origin, Vec2 direction, float& t_begin, float& t_end) const;
+            void _count(uint32_t iterations, bool culled, uint32_t saved, bool exhausted = false, uint32_t failed = 0);
+            float _lipschitz() const;
+            float _relaxation() const;
+            float _hit_slope() const;
+            void _render_cascades();
+            bool _march_interval(Vec2 origin, Vec2 direction, float t_begin, float t_end, float& t, Nearest& nearest);
+            Vec2 _pixel_point(float x, float y) const;
+            void _tone_map(const ToneMapper& tone_mapper);
+            Vec2 _pixel_uv(uint32_t x, uint32_t y) const;
+            uint32_t _fingerprint(uint32_t pass_samples) const;
+            void _render_tile_pass(const Tile& tile, uint32_t first, uint32_t samples);
+            uint32_t _stratum(uint32_t sample_index, uint32_t first, uint32_t samples, uint32_t& strata) const;
+            void _sample_pixel(uint32_t x, uint32_t y, Vec2 uv, uint32_t first, uint32_t samples, PixelEstimate& estimate);
+            void _sample_packets(uint32_t x, uint32_t y, Vec2 uv, uint32_t first, uint32_t samples, PixelEstimate& estimate);
+
+            template <int N>
+            void _march_packet(const float* origin_x, const float* origin_y, const float* direction_x, const float* direction_y,
+                uint32_t lanes, float* t_out, int32_t* hit_out);
+            void _march_packet_4(const float* origin_x, const float* origin_y, const float* direction_x, const float* direction_y,
+                uint32_t lanes, float* t_out, int32_t* hit_out);
+#ifdef LIGHTS2D_SIMD_DISPATCH
+            void _march_packet_avx2(const float* origin_x, const float* origin_y, const float* direction_x, const float* direction_y,
+                uint32_t lanes, float* t_out, int32_t* hit_out);
+#endif
+
+            void _primary_ray(Vec2 uv, uint32_t stratum, uint32_t strata, SampleStream& stream, Vec2& origin, Vec2& direction, float& weight);
+            Color<float> _sample(Vec2 uv, uint32_t stratum, uint32_t strata, SampleStream& stream);
+            bool _march(Vec2 origin, Vec2 direction, float& t, Nearest& nearest);
             Color<float> _ray_march(Vec2 origin, Vec2 direction, uint32_t depth=0);
             Color<float> _hit(Vec2 origin, Vec2 direction, float t, const Nearest& nearest, uint32_t depth=0);
+            Color<float> _trace_path(Vec2 origin, Vec2 direction, float t, Nearest nearest, SampleStream& stream);
         private:
             float _time;
+            uint32_t _packet_width;
+            std::shared_ptr<const Sampler> _sampler;
+            LightSampler _lights;               // Of the current time, empty without light sampling
+            Tile _region;                       // Pixels covered by img and the framebuffer, in frame coordinates
+            std::vector<Tile> _regions;         // Disjoint rectangles of the config regions inside _region, or _region
+
+            // Set while render_progressive runs, passes are stratified on their own
+            bool _progressive = false;
     };
+
+    extern template class Renderer<SignedDistanceFunction>;
 }
+
+#include "renderer_impl.h"
 #endif 
\ No newline at end of file
@@ -0,0 +1,1191 @@
+#pragma once
+#ifndef RENDERER_IMPL_H
+#define RENDERER_IMPL_H
+// Renderer template definitions, included by renderer.h
+#include <iostream>
+#include "utils.h"
+#include "sdf_functions.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
+#define MARCH_HIT_DIST 1e-4f
+#define OFFSET 1e-3f
+#define GRID_NEAR 4.0f
+
+namespace Lights2D
+{
+    template <typename SDF>
+    void Renderer<SDF>::render()
+    {
+        int concurrency = config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(config.threads);
+        tbb::task_arena arena(concurrency);
+        arena.execute([this]() { render_in_arena(); });
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::render_in_arena()
+    {
+        _update_grid();
+        if (counters)
+            counters->reset();
+        if (config.engine == Engine::RadianceCascades)
+        {
+            _render_cascades();
+            _tone_map(ToneMapper(config.exposure, config.gamma, config.dither));
+            return;
+        }
+
+        // Each tile is a task, idle workers steal the remaining tiles from busy ones
+        std::atomic<uint32_t> finished_tiles(0);
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, tiles.size(), 1),
+            [this, &finished_tiles](const tbb::blocked_range<size_t>& range)
+            {
+                for (size_t i = range.begin(); i != range.end(); i++)
+                {
+                    render_tile(tiles[i]);
+
+                    uint32_t finished = ++finished_tiles;
+                    if (debug)
+                        std::cout << "Calculating: " << 100.0f * finished / tiles.size() << "%" << std::endl;
+                }
+            },
+            tbb::simple_partitioner()
+        );
+
+        // Output stage, once every tile is done
+        _tone_map(ToneMapper(config.exposure, config.gamma, config.dither));
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_render_cascades()
+    {
+        /*
+        Radiance cascades: instead of random rays per pixel, every level of probes traces
+        a fixed set of rays over its own interval of distances, from the top level, whose
+        interval ends past the frame, down to the first one, with a probe per pixel. A ray
+        that hits something in its interval takes the radiance of the hit, one that
+        escapes it takes what the level above sees from there. The pixel is the mean of
+        the directions of its probe, the same quantity the Monte Carlo engine estimates.
+        Hits go through _hit, so reflections and refractions split as with
+        Integrator::Splitting. Every level traces about 4 directions per pixel.
+        Probes are on the grid of the frame. A region traces the probes of its pixels and,
+        at each level above, the halo of probes the level below merges, so regions and
+        bands join up with the render of the whole frame
+        */
+        uint32_t width = _region.width(), height = _region.height();
+        float pixel_size = 2.0f / config.height;
+        float base_interval = std::max(config.cascade_interval, 0.01f);
+        uint32_t base_directions = std::max(config.cascade_directions, 1u);
+
+        // The last interval reaches twice the diagonal of the frame, so lights outside of it still reach every pixel
+        float range = 2.0f * std::sqrt(static_cast<float>(config.width) * config.width + static_cast<float>(config.height) * config.height);
+        uint32_t levels = Cascade::levels(range, base_interval);
+
+        // Windows of probes from the first level up, the probes of the region, then what each level merges
+        std::vector<std::unique_ptr<Cascade>> cascades(levels);
+        for (uint32_t level = 0; level < levels; level++)
+        {
+            cascades[level] = std::make_unique<Cascade>(level, config.width, config.height, base_directions, base_interval);
+            Cascade& cascade = *cascades[level];
+            if (level == 0)
+            {
+                cascade.set_window(_region.x0, _region.y0, _region.x1, _region.y1);
+                continue;
+            }
+            const Cascade& lower = *cascades[level - 1];
+            uint32_t x_begin, x_end, y_begin, y_end;
+            Cascade::merged_window(lower.x0, lower.x0 + lower.width, lower.spacing, cascade.frame_width, x_begin, x_end);
+            Cascade::merged_window(lower.y0, lower.y0 + lower.height, lower.spacing, cascade.frame_height, y_begin, y_end);
+            cascade.set_window(x_begin, y_begin, x_end, y_end);
+        }
+
+        std::unique_ptr<Cascade> upper;
+        for (uint32_t level = levels; level-- > 0;)
+        {
+            std::unique_ptr<Cascade> cascade = std::move(cascades[level]);
+            float t_begin = cascade->start * pixel_size, t_end = cascade->end * pixel_size;
+            tbb::parallel_for(
+                tbb::blocked_range<size_t>(0, cascade->radiance.size(), 64),
+                [&](const tbb::blocked_range<size_t>& rays)
+                {
+                    for (size_t i = rays.begin(); i != rays.end(); i++)
+                    {
+                        uint32_t direction = static_cast<uint32_t>(i % cascade->directions);
+                        size_t probe = i / cascade->directions;
+                        float px = cascade->probe_x(static_cast<uint32_t>(probe % cascade->width));
+                        float py = cascade->probe_y(static_cast<uint32_t>(probe / cascade->width));
+
+                        Vec2 origin = _pixel_point(px, py);
+                        float angle = cascade->angle(direction);
+                        Vec2 ray_direction(cosf(angle), sinf(angle));
+
+                        // Pixels inside an object see its boundary from inside, as with Monte Carlo, instead of
+                        // the probes above, which are averaged with probes outside of it
+                        float end = level == 0 && scene.sdf(origin, _time).distance <= 0.0f ? INFINITY : t_end;
+
+                        float t;
+                        Nearest nearest;
+                        if (_march_interval(origin, ray_direction, t_begin, end, t, nearest))
+                            cascade->radiance[i] = _hit(origin, ray_direction, t, nearest, 0);
+                        else
+                            cascade->radiance[i] = upper ? upper->merged(px, py, direction) : Color<float>(0.0f);
+                    }
+                });
+            upper = std::move(cascade);
+        }
+
+        // The first level has a probe per pixel
+        tbb::parallel_for(
+            tbb::blocked_range<uint32_t>(0, height, 8),
+            [&](const tbb::blocked_range<uint32_t>& rows)
+            {
+                for (uint32_t y = rows.begin(); y != rows.end(); y++)
+                {
+                    for (uint32_t x = 0; x < width; x++)
+                    {
+                        Color<float> sum;
+                        for (uint32_t direction = 0; direction < upper->directions; direction++)
+                            sum += upper->at(x, y, direction);
+                        Color<float> radiance = sum * (1.0f / upper->directions);
+                        framebuffer->set(x, y, radiance, 1);
+                        if (partial)
+                        {
+                            int64_t fixed[3] = { FixedPoint::from_float(radiance.r), FixedPoint::from_float(radiance.g), FixedPoint::from_float(radiance.b) };
+                            partial->set(x, y, fixed, 1);
+                        }
+                    }
+                }
+            });
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::set_region(const Tile& region)
+    {
+        if (region.width() != _region.width() || region.height() != _region.height())
+        {
+            framebuffer = std::make_shared<Framebuffer>(region.width(), region.height());
+            img = std::make_shared<Image>(region.width(), region.height());
+        }
+        _region = region;
+        _generate_tiles();
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_generate_tiles()
+    {
+        // With regions, only their pixels get tiles, so the cost follows their area
+        if (config.regions.empty())
+        {
+            _regions = { _region };
+            tiles = Tiles::generate(_region, config.tile_size);
+            return;
+        }
+        _regions = Tiles::disjoint(config.regions, _region);
+        tiles.clear();
+        for (const Tile& region : _regions)
+        {
+            std::vector<Tile> region_tiles = Tiles::generate(region, config.tile_size);
+            tiles.insert(tiles.end(), region_tiles.begin(), region_tiles.end());
+        }
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_tone_map(const ToneMapper& tone_mapper)
+    {
+        // Pixels outside the regions keep what img had, so a region patches a previous render
+        if (config.regions.empty())
+        {
+            tone_mapper(*framebuffer, *img, _region.x0, _region.y0);
+            return;
+        }
+        for (const Tile& region : _regions)
+        {
+            tbb::parallel_for(
+                tbb::blocked_range<uint32_t>(region.y0, region.y1, 8),
+                [&](const tbb::blocked_range<uint32_t>& rows) {
+                    tone_mapper.map_rect(*framebuffer, *img, region.x0 - _region.x0, region.x1 - _region.x0,
+                        rows.begin() - _region.y0, rows.end() - _region.y0, _region.x0, _region.y0);
+                });
+        }
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::set_frame(float time, uint32_t seed)
+    {
+        _time = time;
+        config.seed = seed;
+        _sampler = Samplers::create(config.sampler, seed);
+        _update_lights();
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::render_tile(const Tile& tile)
+    {
+        for (uint32_t y = tile.y0; y < tile.y1; y++)
+        {
+            for (uint32_t x = tile.x0; x < tile.x1; x++)
+            {
+                Vec2 uv = _pixel_uv(x, y);
+
+                /*
+                Without a tolerance, every pixel takes config.samples. Otherwise samples are
+                taken in rounds of adaptive_round, until the estimate converges or reaches
+                config.samples
+                */
+                PixelEstimate estimate;
+                uint32_t begin = config.sample_begin;
+                uint32_t end = config.sample_end > 0 ? std::min(config.sample_end, config.samples) : config.samples;
+                uint32_t round = config.adaptive_tolerance > 0.0f ? std::max(config.adaptive_round, 1u) : config.samples;
+                while (begin + estimate.count < end)
+                {
+                    uint32_t first = begin + estimate.count;
+                    Color<float> previous_sum = estimate.sum;
+                    uint32_t samples = std::min(round, end - first);
+                    if (_packet_width > 1 && !grid)
+                        _sample_packets(x, y, uv, first, samples, estimate);
+                    else
+                        _sample_pixel(x, y, uv, first, samples, estimate);
+                    estimate.finish_round(estimate.sum - previous_sum, samples);
+
+                    if (estimate.count >= config.min_samples && estimate.converged(config.adaptive_tolerance))
+                        break;
+                }
+
+                if (sample_count_img)
+                    sample_count_img->set_pixel(x - _region.x0, y - _region.y0, (Color<uint8_t>)Color<float>(static_cast<float>(estimate.count) / config.samples));
+
+                if (partial)
+                    partial->set(x - _region.x0, y - _region.y0, estimate.fixed_sum, estimate.count);
+                framebuffer->set(x - _region.x0, y - _region.y0, estimate.exact_sum(), estimate.count);
+            }
+        }
+    }
+
+    template <typename SDF>
+    uint32_t Renderer<SDF>::render_progressive(const ProgressiveConfig& progressive, ProgressiveCallback on_pass)
+    {
+        /*
+        Each pass adds pass_samples to every pixel of the framebuffer, continuing the
+        sample indices where the previous pass stopped, so the passes together are the
+        same samples a single render would take. The time of the last pass predicts the
+        next one, which only starts if it fits in the budget. The first pass always
+        runs, so there's an image even with a tiny budget
+        */
+        using Clock = std::chrono::steady_clock;
+        auto seconds_since = [](Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+
+        uint32_t pass_samples = std::max(progressive.pass_samples, 1u);
+        uint32_t target = progressive.target_samples;
+        if (target == 0 && progressive.time_budget <= 0.0f)
+            target = config.samples;
+        // Without a target, the time budget still stops before the fixed point sums could overflow
+        target = target == 0 ? FixedPoint::max_samples : std::min(target, FixedPoint::max_samples);
+
+        int concurrency = config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(config.threads);
+        tbb::task_arena arena(concurrency);
+        ToneMapper tone_mapper(config.exposure, config.gamma, config.dither);
+
+        framebuffer->clear();
+        _progressive = true;
+        arena.execute([this]() { _update_grid(); });
+        if (counters)
+            counters->reset();
+
+        Clock::time_point start = Clock::now();
+        double pass_time = 0.0;
+        uint32_t samples = 0;
+        while (target == 0 || samples < target)
+        {
+            if (samples > 0 && progressive.time_budget > 0.0f && seconds_since(start) + pass_time > progressive.time_budget)
+                break;
+
+            uint32_t count = target == 0 ? pass_samples : std::min(pass_samples, target - samples);
+            Clock::time_point pass_start = Clock::now();
+            arena.execute([&]()
+            {
+                tbb::parallel_for(
+                    tbb::blocked_range<size_t>(0, tiles.size(), 1),
+                    [&](const tbb::blocked_range<size_t>& range)
+                    {
+                        for (size_t i = range.begin(); i != range.end(); i++)
+                            _render_tile_pass(tiles[i], samples, count);
+                    },
+                    tbb::simple_partitioner()
+                );
+
+                // Snapshots are only needed by the callback, otherwise the frame is mapped once at the end
+                if (on_pass)
+                    _tone_map(tone_mapper);
+            });
+            samples += count;
+            pass_time = seconds_since(pass_start);
+
+            if (debug)
+                std::cout << "Pass of " << count << " samples: " << pass_time << "s, " << samples << " samples per pixel" << std::endl;
+
+            if (on_pass)
+                on_pass(img, samples);
+        }
+
+        _progressive = false;
+        if (!on_pass)
+            arena.execute([&]() { _tone_map(tone_mapper); });
+        return samples;
+    }
+
+    template <typename SDF>
+    bool Renderer<SDF>::render_checkpointed(const std::string& checkpoint_path, uint32_t pass_samples, float checkpoint_interval)
+    {
+        /*
+        Same passes as render_progressive, but accumulated in the fixed point sums of
+        partial, which are the whole state of the render. Sample indices continue from
+        the checkpoint, and the sums are exact, so stopping and resuming anywhere
+        doesn't change the result
+        */
+        using Clock = std::chrono::steady_clock;
+
+        pass_samples = std::max(pass_samples, 1u);
+        uint32_t fingerprint = _fingerprint(pass_samples);
+        partial = std::make_shared<PartialFrame>(_region.width(), _region.height(), 0, 0);
+        if (Checkpoints::load(checkpoint_path, fingerprint, *partial) && debug)
+            std::cout << "Resuming from " << partial->sample_end << " samples per pixel" << std::endl;
+
+        int concurrency = config.threads == 0 ? tbb::task_arena::automatic : static_cast<int>(config.threads);
+        tbb::task_arena arena(concurrency);
+        bool saved = true;
+        _progressive = true;
+        arena.execute([this]() { _update_grid(); });
+        if (counters)
+            counters->reset();
+
+        Clock::time_point last_save = Clock::now();
+        while (partial->sample_end < config.samples)
+        {
+            uint32_t first = partial->sample_end;
+            uint32_t count = std::min(pass_samples, config.samples - first);
+            arena.execute([&]()
+            {
+                tbb::parallel_for(
+                    tbb::blocked_range<size_t>(0, tiles.size(), 1),
+                    [&](const tbb::blocked_range<size_t>& range)
+                    {
+                        for (size_t i = range.begin(); i != range.end(); i++)
+                            _render_tile_pass(tiles[i], first, count);
+                    },
+                    tbb::simple_partitioner()
+                );
+            });
+            partial->sample_end = first + count;
+
+            bool done = partial->sample_end >= config.samples;
+            if (done || std::chrono::duration<double>(Clock::now() - last_save).count() >= checkpoint_interval)
+            {
+                saved = Checkpoints::save(checkpoint_path, fingerprint, *partial) && saved;
+                last_save = Clock::now();
+                if (debug)
+                    std::cout << "Checkpoint at " << partial->sample_end << " samples per pixel" << std::endl;
+            }
+        }
+
+        _progressive = false;
+        partial->to_framebuffer(*framebuffer);
+        arena.execute([&]() { _tone_map(ToneMapper(config.exposure, config.gamma, config.dither)); });
+        return saved;
+    }
+
+    template <typename SDF>
+    uint32_t Renderer<SDF>::_fingerprint(uint32_t pass_samples) const
+    {
+        // Everything that changes the samples of the frame, the scene itself is up to the caller
+        auto bits = [](float value) {
+            uint32_t result;
+            std::memcpy(&result, &value, sizeof(result));
+            return result;
+        };
+        uint32_t values[] = {
+            config.width, config.height, config.samples, config.max_recursion_depth, config.ray_march_max_iterations,
+            config.antialias, static_cast<uint32_t>(config.integrator), config.roulette_depth,
+            static_cast<uint32_t>(config.sampler), config.seed, _packet_width, pass_samples, bits(_time),
+            _region.x0, _region.y0, _region.x1, _region.y1,
+            static_cast<uint32_t>(config.engine), config.cascade_directions, bits(config.cascade_interval),
+            bits(config.light_sampling), bits(config.relaxation), bits(config.hit_footprint), config.scene_bounds,
+            bits(config.grid_error), config.grid_megabytes
+        };
+        uint32_t hash = 0;
+        for (uint32_t value : values)
+            hash = Hash::combine(hash, value);
+        for (const Tile& region : _regions)
+            for (uint32_t value : { region.x0, region.y0, region.x1, region.y1 })
+                hash = Hash::combine(hash, value);
+        return hash;
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_render_tile_pass(const Tile& tile, uint32_t first, uint32_t samples)
+    {
+        for (uint32_t y = tile.y0; y < tile.y1; y++)
+        {
+            for (uint32_t x = tile.x0; x < tile.x1; x++)
+            {
+                PixelEstimate estimate;
+                if (_packet_width > 1 && !grid)
+                    _sample_packets(x, y, _pixel_uv(x, y), first, samples, estimate);
+                else
+                    _sample_pixel(x, y, _pixel_uv(x, y), first, samples, estimate);
+                framebuffer->add(x - _region.x0, y - _region.y0, estimate.sum, estimate.count);
+                if (partial)
+                    partial->add(x - _region.x0, y - _region.y0, estimate.fixed_sum, estimate.count);
+            }
+        }
+    }
+
+    template <typename SDF>
+    Vec2 Renderer<SDF>::_pixel_uv(uint32_t x, uint32_t y) const
+    {
+        return Vec2(
+            static_cast<float>(x) / config.width,
+            1.0f - static_cast<float>(y) / config.height
+        );
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::bake_grid()
+    {
+        // The bounds reach half a unit past the frame, where several scenes have their lights
+        Vec2 extent(config.aspect_ratio + 0.5f, 1.5f);
+        auto baked = std::make_shared<DistanceGrid>(Vec2::flip(extent), extent, config.grid_error, static_cast<size_t>(config.grid_megabytes) << 20);
+        if constexpr (static_grid)
+            baked->bake([this](Vec2 point) { return scene.sdf.static_part(point).distance; });
+        else
+            baked->bake([this](Vec2 point) { return scene.sdf(point, _time).distance; });
+        baked->baked_time = _time;
+        grid = baked;
+        if (debug)
+            std::cout << "Distance grid: " << baked->brick_count() << " bricks, " << baked->bytes() / 1024 << "KB, error " << baked->error() << std::endl;
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_update_grid()
+    {
+        if (config.grid_error > 0.0f && (!grid || (!static_grid && grid->baked_time != _time)))
+            bake_grid();
+    }
+
+    template <typename SDF>
+    float Renderer<SDF>::_grid_step(Vec2 point) const
+    {
+        // A step the grid guarantees is free of surfaces, 0 when the SDF has to be evaluated:
+        // near a surface, where the bound is smaller than the grid error, or outside the grid
+        float bound = grid->lower_bound(point);
+        if constexpr (has_animated_part<SDF>::value)
+        {
+            float animated = scene.sdf.animated_part(point, _time).distance;
+            bound = std::min(bound, animated > 0.0f ? animated : -animated);
+        }
+        return bound > grid->error() ? bound : 0.0f;
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_update_lights()
+    {
+        if constexpr (has_lights<SDF>::value)
+        {
+            if (config.light_sampling > 0.0f)
+            {
+                _lights = LightSampler(scene.sdf.lights(_time));
+                return;
+            }
+        }
+        _lights = LightSampler();
+    }
+
+    template <typename SDF>
+    Vec2 Renderer<SDF>::_pixel_point(float x, float y) const
+    {
+        // Scene position of a point given in pixels, as _primary_ray places the pixels
+        Vec2 origin = (Vec2(x / config.width, 1.0f - y / config.height) - 0.5f) * 2.0f;
+        origin.x *= config.aspect_ratio;
+        return origin;
+    }
+
+    template <typename SDF>
+    bool Renderer<SDF>::_clip(Vec2 origin, Vec2 direction, float& t_begin, float& t_end) const
+    {
+        // Narrows [t_begin, t_end] to the scene bounds, false when the ray misses them. They grow
+        // by the hit distance, a ray stops that far from a surface
+        if constexpr (has_bounds<SDF>::value)
+        {
+            if (!config.scene_bounds)
+                return true;
+            Bounds bounds = scene.sdf.bounds();
+            bounds.expand(2.0f * MARCH_HIT_DIST);
+            float t_enter, t_exit;
+            if (!bounds.clip(origin, direction, t_enter, t_exit))
+                return false;
+            t_begin = std::max(t_begin, t_enter);
+            t_end = std::min(t_end, t_exit);
+            return t_begin <= t_end;
+        }
+        return true;
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_count(uint32_t iterations, bool culled, uint32_t saved, bool exhausted, uint32_t failed)
+    {
+        if (counters)
+            counters->add(1, iterations, culled ? 1 : 0, saved, exhausted ? 1 : 0, failed);
+    }
+
+    template <typename SDF>
+    float Renderer<SDF>::_lipschitz() const
+    {
+        if constexpr (has_lipschitz<SDF>::value)
+            return std::max(scene.sdf.lipschitz(), 1e-3f);
+        return 1.0f;
+    }
+
+    template <typename SDF>
+    float Renderer<SDF>::_relaxation() const
+    {
+        // Without a known bound the distance may already be an overestimate, stretching it would tunnel
+        if constexpr (has_lipschitz<SDF>::value)
+            return std::max(config.relaxation, 1.0f);
+        return 1.0f;
+    }
+
+    template <typename SDF>
+    float Renderer<SDF>::_hit_slope() const
+    {
+        // Growth of the hit distance per scene unit, a pixel is 2 / height scene units
+        return config.hit_footprint * 2.0f / config.height;
+    }
+
+    template <typename SDF>
+    bool Renderer<SDF>::_march_interval(Vec2 origin, Vec2 direction, float t_begin, float t_end, float& t, Nearest& nearest)
+    {
+        // Same as _march, but starting at t_begin, and missing once past t_end. The interval would end
+        // at t_end anyway, rays it ends early aren't counted as saving iterations
+        if (!_clip(origin, direction, t_begin, t_end))
+        {
+            _count(0, true, 0);
+            return false;
+        }
+        t = t_begin;
+        float inverse_lipschitz = 1.0f / _lipschitz();
+        float relaxation = _relaxation();
+        float hit_slope = _hit_slope();
+        float radius = 0.0f, step = 0.0f, previous = 0.0f;
+        uint32_t i = 0, failed = 0;
+        while (i < config.ray_march_max_iterations)
+        {
+            Vec2 point = origin + direction * t;
+            float grid_step = grid ? _grid_step(point) : 0.0f;
+            if (grid_step > 0.0f)
+            {
+                t += grid_step;
+                radius = step = 0.0f;
+                if (t >= t_end)
+                    break;
+                continue;
+            }
+
+            i++;
+            float hit_distance = std::max(MARCH_HIT_DIST, hit_slope * t);
+            nearest = scene.sdf(point, _time);
+            float unsigned_distance = nearest.distance > 0.0f ? nearest.distance : -nearest.distance;
+            float next_radius = unsigned_distance * inverse_lipschitz;
+            if (step > radius && (next_radius + radius < step || nearest.distance * previous < 0.0f))
+            {
+                // See _march
+                t += radius - step;
+                step = radius;
+                relaxation = 1.0f;
+                failed++;
+                continue;
+            }
+            if (unsigned_distance < hit_distance)
+            {
+                _count(i, false, 0, false, failed);
+                return true;
+            }
+            radius = next_radius;
+            previous = nearest.distance;
+            step = t + relaxation * radius < t_end ? relaxation * radius : radius;
+            t += step;
+            if (t >= t_end)
+                break;
+        }
+        _count(i, false, 0, i == config.ray_march_max_iterations, failed);
+        return false;
+    }
+
+    template <typename SDF>
+    bool Renderer<SDF>::_march(Vec2 origin, Vec2 direction, float& t, Nearest& nearest)
+    {
+        // Past t_end the ray has left the scene bounds, it can't hit anything anymore
+        t = 0.0f;
+        float t_end = INFINITY;
+        if (!_clip(origin, direction, t, t_end))
+        {
+            _count(0, true, config.ray_march_max_iterations);
+            return false;
+        }
+
+        /*
+        The distance divided by the Lipschitz bound is the radius of a circle without
+        surfaces. Over-relaxed steps go relaxation times further, which is safe as long as
+        the circle at the new point overlaps the previous one, and the distance keeps its
+        sign, rays also march inside objects. When either fails, a surface may lie in the
+        gap, the step is taken back to the edge of the previous circle and the ray
+        continues plainly. Steps that would cross t_end are plain, a ray is only
+        culled past the bounds when nothing was skipped. The hit distance grows with the
+        distance travelled, by hit_footprint pixels per scene unit
+        */
+        float inverse_lipschitz = 1.0f / _lipschitz();
+        float relaxation = _relaxation();
+        float hit_slope = _hit_slope();
+        float radius = 0.0f, step = 0.0f, previous = 0.0f;
+        uint32_t failed = 0;
+
+        bool use_grid = grid != nullptr;
+        for (uint32_t i = 0; i < config.ray_march_max_iterations;)
+        {
+            
+            Vec2 point = origin + direction * t;
+
+            // Away from surfaces the grid gives the step, only evaluations of the SDF count as iterations
+            float grid_step = use_grid ? _grid_step(point) : 0.0f;
+            if (grid_step > 0.0f)
+            {
+                t += grid_step;
+                radius = step = 0.0f;
+                if (t > t_end)
+                {
+                    _count(i, true, config.ray_march_max_iterations - i, false, failed);
+                    return false;
+                }
+                continue;
+            }
+            i++;
+
+            // Nearest data with sdf
+            float hit_distance = std::max(MARCH_HIT_DIST, hit_slope * t);
+            nearest = scene.sdf(point, _time);
+
+            float sign = nearest.distance > 0.0f ? 1.0f : -1.0f;
+            float unsigned_distance = sign * nearest.distance;
+            float next_radius = unsigned_distance * inverse_lipschitz;
+
+            // The over-relaxed step overshot, or crossed a surface
+            if (step > radius && (next_radius + radius < step || nearest.distance * previous < 0.0f))
+            {
+                t += radius - step;
+                step = radius;
+                relaxation = 1.0f;
+                failed++;
+                continue;
+            }
+
+            // Hit
+            if (unsigned_distance < hit_distance)
+            {
+                _count(i, false, 0, false, failed);
+                return true;
+            }
+
+            // Close to a surface the grid bound is below its error, the lookup would be wasted
+            use_grid = grid && unsigned_distance > GRID_NEAR * grid->error();
+            radius = next_radius;
+            previous = nearest.distance;
+            step = t + relaxation * radius <= t_end ? relaxation * radius : radius;
+            t += step;
+            if (t > t_end)
+            {
+                _count(i, true, config.ray_march_max_iterations - i, false, failed);
+                return false;
+            }
+        }
+        _count(config.ray_march_max_iterations, false, 0, true, failed);
+        return false;
+    }
+
+    template <typename SDF>
+    Color<float> Renderer<SDF>::_ray_march(Vec2 origin, Vec2 direction, uint32_t depth)
+    {
+        float t;
+        Nearest nearest;
+        if (_march(origin, direction, t, nearest))
+            return _hit(origin, direction, t, nearest, depth);
+
+        return Color(0.0f);
+    }
+
+    template <typename SDF>
+    Color<float> Renderer<SDF>::_hit(Vec2 origin, Vec2 direction, float t, const Nearest& nearest, uint32_t depth)
+    {
+       
+        // The material is resolved only here, the SDF just carries the material ids
+        Material material = scene.materials.resolve(nearest.mtl);
+
+        // Color of the intersected material
+        Color color = material.emission * material.emission_intensity;
+
+        bool inside_object = nearest.distance <= 0.0f;
+
+        // Check for reflection and refraction
+        if (depth <= config.max_recursion_depth && (material.reflectivity > 0.0f || material.ior > 0.0f))
+        {
+
+            Vec2 point = origin + direction * t;
+
+            // Gets the gradient and flips if necessary to get the normal
+            Vec2 normal = Vec2::normalize(gradient(point));
+
+            // The hit footprint stops rays away from the surface, the offsets below have to cross it
+            if (std::abs(nearest.distance) >= MARCH_HIT_DIST)
+                point -= normal * nearest.distance;
+            if (inside_object)
+                normal *= -1.0f;
+
+            float reflectance = material.reflectivity;
+            if (material.ior > 0.0f)
+            {
+
+                float ior = inside_object ? material.ior : 1.0f / material.ior;
+                Vec2 refracted;
+                bool can_refract = Utils::refract(direction, normal, ior, refracted);
+                if (can_refract)
+                {
+                    // Updates reflectance - Only if it can refract
+                    float cos_angle = Utils::clamp(Vec2::dot(Vec2::flip(direction), normal), 0.0f, 1.0f);
+                    reflectance = Utils::reflectance(cos_angle, ior);
+
+                    // Offsets the origin inside the object
+                    Vec2 refracted_origin = point - normal * OFFSET;
+
+                    Color refracted_color = _ray_march(refracted_origin, Vec2::normalize(refracted), depth + 1);
+
+                    // Refracts the amount of light that isn't reflected
+                    color += refracted_color * (1.0f - reflectance);
+                }       
+                else
+                {
+                    // Snell's law breaks - total internal reflection
+                    reflectance = 1.0f;
+                }
+            }
+
+            if (reflectance > 0.0f)
+            {
+                Vec2 reflected = Utils::reflect(direction, normal);
+                // Offsets the origin away of the surface
+                Vec2 reflected_origin = point + normal * OFFSET;
+                    
+                Color reflected_color = _ray_march(reflected_origin, Vec2::normalize(reflected), depth + 1);
+                color += reflected_color * reflectance; 
+            }
+        }
+
+        // If we casted the ray inside the object, apply material absorption (Beer - Lambert)
+        if (inside_object)
+            return color * Utils::beer_lambert(material.absorption, t);
+
+        return color;
+    
+    }
+
+    template <typename SDF>
+    Color<float> Renderer<SDF>::_trace_path(Vec2 origin, Vec2 direction, float t, Nearest nearest, SampleStream& stream)
+    {
+        /*
+        Iterative version of _hit, starting at the first hit. Instead of splitting, each
+        bounce continues with the reflected ray with probability equal to the reflectance,
+        or with the refracted ray otherwise. Since the probability is the weight of the
+        branch, the throughput doesn't change. Once the path made roulette_depth bounces,
+        it survives with a probability equal to its brightest throughput channel, and the
+        survivors are scaled up, so the expected color is the same as splitting
+        */
+        Color<float> color;
+        Color<float> throughput(1.0f);
+
+        for (uint32_t depth = 0;; depth++)
+        {
+            Material material = scene.materials.resolve(nearest.mtl);
+            bool inside_object = nearest.distance <= 0.0f;
+
+            // Absorption of the segment that reached this hit, it also attenuates the rest of the path
+            if (inside_object)
+                throughput *= Utils::beer_lambert(material.absorption, t);
+
+            color += throughput * material.emission * material.emission_intensity;
+
+            if (depth > config.max_recursion_depth || (material.reflectivity <= 0.0f && material.ior <= 0.0f))
+                break;
+
+            Vec2 point = origin + direction * t;
+            Vec2 normal = Vec2::normalize(gradient(point));
+            if (std::abs(nearest.distance) >= MARCH_HIT_DIST)
+                point -= normal * nearest.distance;
+            if (inside_object)
+                normal *= -1.0f;
+
+            // Both decisions of a bounce always take a dimension, so later bounces use the same dimensions
+            float choice = stream.next();
+            float roulette = stream.next();
+
+            bool reflect = true;
+            Vec2 refracted;
+            if (material.ior > 0.0f)
+            {
+                float ior = inside_object ? material.ior : 1.0f / material.ior;
+                if (Utils::refract(direction, normal, ior, refracted))
+                {
+                    float cos_angle = Utils::clamp(Vec2::dot(Vec2::flip(direction), normal), 0.0f, 1.0f);
+                    reflect = choice < Utils::reflectance(cos_angle, ior);
+                }
+            }
+            else
+            {
+                // Plain mirrors don't choose, they reflect a fraction of the light
+                throughput *= material.reflectivity;
+            }
+
+            if (reflect)
+            {
+                origin = point + normal * OFFSET;
+                direction = Vec2::normalize(Utils::reflect(direction, normal));
+            }
+            else
+            {
+                origin = point - normal * OFFSET;
+                direction = Vec2::normalize(refracted);
+            }
+
+            if (depth + 1 >= config.roulette_depth)
+            {
+                float survival = std::min(std::max(throughput.r, std::max(throughput.g, throughput.b)), 0.95f);
+                if (roulette >= survival)
+                    break;
+                throughput /= survival;
+            }
+
+            if (!_march(origin, direction, t, nearest))
+                break;
+        }
+        return color;
+    }
+
+    template <typename SDF>
+    uint32_t Renderer<SDF>::_stratum(uint32_t sample_index, uint32_t first, uint32_t samples, uint32_t& strata) const
+    {
+        /*
+        Independent samplers split the circle of directions in config.samples strata. When sampling is
+        adaptive and config.samples is a power of 2, strata are visited in bit reversed
+        order, so every round covers the circle evenly and the rounds together are the
+        same stratification as a fixed count render. Otherwise each round is stratified
+        on its own, so stopping after any round doesn't leave directions unsampled
+        */
+        strata = config.samples;
+        if (_sampler->is_stratified())
+        {
+            // Low discrepancy sequences already spread the angles of the samples
+            strata = 1;
+            return 0;
+        }
+
+        // A progressive pass can't know how many samples will follow it
+        if (_progressive)
+        {
+            strata = samples;
+            return sample_index - first;
+        }
+
+        if (config.adaptive_tolerance <= 0.0f)
+            return sample_index;
+
+        if ((config.samples & (config.samples - 1)) == 0)
+        {
+            uint32_t bits = 0;
+            while ((1u << bits) < config.samples)
+                bits++;
+            uint32_t reversed = 0;
+            for (uint32_t bit = 0; bit < bits; bit++)
+                reversed |= ((sample_index >> bit) & 1u) << (bits - 1 - bit);
+            return reversed;
+        }
+
+        strata = samples;
+        return sample_index - first;
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_sample_pixel(uint32_t x, uint32_t y, Vec2 uv, uint32_t first, uint32_t samples, PixelEstimate& estimate)
+    {
+        for (uint32_t sample = first; sample < first + samples; sample++)
+        {
+            SampleStream stream(_sampler.get(), x, y, sample);
+
+            // Gaussian antialiasing
+            Vec2 offset(
+                stream.next() / config.width,
+                stream.next() / config.height
+            );
+            uint32_t strata;
+            uint32_t stratum = _stratum(sample, first, samples, strata);
+            estimate.add(_sample(uv + offset * config.antialias, stratum, strata, stream));
+        }
+    }
+
+    template <typename SDF>
+    void Renderer<SDF>::_sample_packets(uint32_t x, uint32_t y, Vec2 uv, uint32_t first_sample, uint32_t samples, PixelEstimate& estimate)
+    {
+        /*
+        The samples of the pixel are marched in packets of _packet_width rays. Each lane
+        has the sample stream _sample_pixel would use, so both give the same image.
+        Only the march to the first hit is done in packets, the hits and the
+        secondary rays are shaded one ray at a time
+        */
+        alignas(32) float origin_x[8], origin_y[8], direction_x[8], direction_y[8], t[8], weight[8];
+        alignas(32) int32_t hit[8];
+        SampleStream streams[8];
+
+        for (uint32_t first = first_sample; first < first_sample + samples; first += _packet_width)
+        {
+            uint32_t lanes = std::min(_packet_width, first_sample + samples - first);
+            for (uint32_t lane = 0; lane < 8; lane++)
+            {
+                Vec2 origin, direction;
+                if (lane < lanes)
+                {
+                    SampleStream& stream = streams[lane];
+                    stream = SampleStream(_sampler.get(), x, y, first + lane);
+                    Vec2 offset(
+                        stream.next() / config.width,
+                        stream.next() / config.height
+                    );
+                    uint32_t strata;
+                    uint32_t stratum = _stratum(first + lane, first_sample, samples, strata);
+                    _primary_ray(uv + offset * config.antialias, stratum, strata, stream, origin, direction, weight[lane]);
+                }
+                origin_x[lane] = origin.x;
+                origin_y[lane] = origin.y;
+                direction_x[lane] = direction.x;
+                direction_y[lane] = direction.y;
+            }
+
+#ifdef LIGHTS2D_SIMD_DISPATCH
+            if (_packet_width == 8)
+                _march_packet_avx2(origin_x, origin_y, direction_x, direction_y, lanes, t, hit);
+            else
+#endif
+                _march_packet_4(origin_x, origin_y, direction_x, direction_y, lanes, t, hit);
+
+            for (uint32_t lane = 0; lane < lanes; lane++)
+            {
+                if (!hit[lane])
+                {
+                    estimate.add(Color<float>(0.0f));
+                    continue;
+                }
+
+                Vec2 origin(origin_x[lane], origin_y[lane]);
+                Vec2 direction(direction_x[lane], direction_y[lane]);
+                Nearest nearest = scene.sdf(origin + direction * t[lane], _time);
+                if (config.integrator == Integrator::PathTracing)
+                    estimate.add(_trace_path(origin, direction, t[lane], nearest, streams[lane]) * weight[lane]);
+                else
+                    estimate.add(_hit(origin, direction, t[lane], nearest, 0) * weight[lane]);
+            }
+        }
+    }
+
+    template <typename SDF>
+    template <int N>
+    void Renderer<SDF>::_march_packet(
+        const float* origin_x,
+        const float* origin_y,
+        const float* direction_x,
+        const float* direction_y,
+        uint32_t lanes,
+        float* t_out,
+        int32_t* hit_out)
+    {
+        // Same loop as _march, lanes that hit or leave the scene bounds are masked off until the whole packet is done.
+        // Each lane falls back to plain steps on its own
+        typedef Packet<N> P;
+        Vector2<P> origin(P::load(origin_x), P::load(origin_y));
+        Vector2<P> direction(P::load(direction_x), P::load(direction_y));
+
+        alignas(32) float t_begin[N], t_end[N];
+        for (uint32_t lane = 0; lane < N; lane++)
+        {
+            t_begin[lane] = 0.0f;
+            t_end[lane] = INFINITY;
+            if (lane < lanes && !_clip(Vec2(origin_x[lane], origin_y[lane]), Vec2(direction_x[lane], direction_y[lane]), t_begin[lane], t_end[lane]))
+                t_end[lane] = -1.0f;
+        }
+        P t = P::load(t_begin);
+        P end = P::load(t_end);
+        typename P::Mask active = P::lane_index() < P(static_cast<float>(lanes));
+        typename P::Mask culled = active & (t > end);
+        active = active & ~culled;
+        typename P::Mask hit;
+
+        float inverse_lipschitz = 1.0f / _lipschitz();
+        float hit_slope = _hit_slope();
+        P relaxation(_relaxation());
+        P radius(0.0f), step(0.0f), previous(0.0f);
+        uint32_t failed = 0;
+
+        uint32_t i = 0;
+        for (; i < config.ray_march_max_iterations && active.any(); i++)
+        {
+            Vector2<P> point = origin + direction * t;
+            P distance = scene.sdf(point, _time).distance;
+            P unsigned_distance = abs(distance);
+            P next_radius = unsigned_distance * inverse_lipschitz;
+
+            typename P::Mask overshot = active & (step > radius) & ((next_radius + radius < step) | (distance * previous < P(0.0f)));
+            t = select(overshot, t + radius - step, t);
+            step = select(overshot, radius, step);
+            relaxation = select(overshot, P(1.0f), relaxation);
+            if (counters)
+                for (uint32_t lane = 0; lane < lanes; lane++)
+                    failed += overshot[lane] ? 1 : 0;
+
+            typename P::Mask marching = active & ~overshot;
+            typename P::Mask hit_now = marching & (unsigned_distance < max(hit_slope * t, MARCH_HIT_DIST));
+            hit = hit | hit_now;
+            active = active & ~hit_now;
+            marching = marching & ~hit_now;
+
+            radius = select(marching, next_radius, radius);
+            previous = select(marching, distance, previous);
+            P relaxed = relaxation * next_radius;
+            step = select(marching, select(t + relaxed <= end, relaxed, next_radius), step);
+            t = select(marching, t + step, t);
+
+            typename P::Mask left = active & (t > end);
+            culled = culled | left;
+            active = active & ~left;
+        }
+
+        // Culled lanes never hit, without the bounds the packet would have marched until the last iteration
+        if (counters)
+        {
+            uint32_t culled_lanes = 0, exhausted_lanes = 0;
+            for (uint32_t lane = 0; lane < lanes; lane++)
+            {
+                culled_lanes += culled[lane] ? 1 : 0;
+                exhausted_lanes += active[lane] ? 1 : 0;
+            }
+            uint32_t saved = culled_lanes > 0 ? (config.ray_march_max_iterations - i) * N : 0;
+            counters->add(lanes, i * N, culled_lanes, saved, exhausted_lanes, failed);
+        }
+
+        t.store(t_out);
+        hit.store(hit_out);
+    }
+
+    template <typename SDF>
+    LIGHTS2D_FLATTEN void Renderer<SDF>::_march_packet_4(
+        const float* origin_x, const float* origin_y, const float* direction_x, const float* direction_y,
+        uint32_t lanes, float* t_out, int32_t* hit_out)
+    {
+        if constexpr (_supports_packets)
+            _march_packet<4>(origin_x, origin_y, direction_x, direction_y, lanes, t_out, hit_out);
+    }
+
+#ifdef LIGHTS2D_SIMD_DISPATCH
+    template <typename SDF>
+    LIGHTS2D_TARGET_AVX2 void Renderer<SDF>::_march_packet_avx2(
+        const float* origin_x, const float* origin_y, const float* direction_x, const float* direction_y,
+        uint32_t lanes, float* t_out, int32_t* hit_out)
+    {
+        // The scene is inlined here, so it's compiled with AVX2 as well
+        if constexpr (_supports_packets)
+            _march_packet<8>(origin_x, origin_y, direction_x, direction_y, lanes, t_out, hit_out);
+    }
+#endif
+
+    template <typename SDF>
+    void Renderer<SDF>::_primary_ray(Vec2 uv, uint32_t stratum, uint32_t strata, SampleStream& stream, Vec2& origin, Vec2& direction, float& weight)
+    {
+        origin = (uv - 0.5f) * 2.0f;
+        origin.x *= config.aspect_ratio;
+
+        // Jittered sampling
+        float u = (stratum + stream.next()) / strata;
+        float angle = 2.0f * PI * u;
+        weight = 1.0f;
+
+        /*
+        With lights, the angle is drawn toward them with probability light_sampling, or
+        uniformly otherwise, the same jittered u mapped either way. Weighting by the uniform
+        density over the density of the mixture is the balance heuristic of both strategies,
+        the lights add no bias, the uniform rays still find everything else
+        */
+        if (!_lights.empty())
+        {
+            float fraction = std::min(config.light_sampling, 0.99f);
+            float light_pdf;
+            if (stream.next() < fraction)
+                angle = _lights.sample(origin, u, light_pdf);
+            else
+                light_pdf = _lights.pdf(origin, angle);
+            weight = 1.0f / (fraction * 2.0f * PI * light_pdf + 1.0f - fraction);
+        }
+        direction = Vec2(cos(angle), sin(angle));
+    }
+
+    template <typename SDF>
+    Color<float> Renderer<SDF>::_sample(Vec2 uv, uint32_t stratum, uint32_t strata, SampleStream& stream)
+    {
+        Vec2 origin, direction;
+        float weight;
+        _primary_ray(uv, stratum, strata, stream, origin, direction, weight);
+
+        if (config.integrator == Integrator::PathTracing)
+        {
+            float t;
+            Nearest nearest;
+            if (_march(origin, direction, t, nearest))
+                return _trace_path(origin, direction, t, nearest, stream) * weight;
+            return Color(0.0f);
+        }
+
+        Color color = _ray_march(origin, direction);
+        return color * weight;
+    }
+
+    template <typename SDF>
+    Vec2 Renderer<SDF>::gradient(Vec2 p)
+    {
+        /*
+        Since sdf function is a scalar field, we know that the gradient vector
+        of sdf is perpendicular to each of the level curves. The normal of the "sdf"
+        is the gradient vector at the level curve 0.
+        Scenes that can be evaluated with Dual give the exact gradient in a single
+        call, the type erased scene falls back to forward differences
+        */
+        if constexpr (_supports_duals)
+            return scene.sdf(Dual::variable(p), _time).distance.gradient;
+        else
+        {
+            constexpr float epsilon = 0.0001f;
+
+            float sdf_source = scene.sdf(p, _time).distance;
+            return {
+                (scene.sdf(Vec2(p.x + epsilon, p.y), _time).distance - sdf_source) / epsilon,
+                (scene.sdf(Vec2(p.x, p.y + epsilon), _time).distance - sdf_source) / epsilon
+            };
+        }
+    }
+}
+#endif
@@ -0,0 +1,341 @@
+#pragma once
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include <stdint.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+/*
+Samplers give the random numbers of the renderer. They're stateless, a value is
+addressed by the pixel, the sample index within the pixel and the dimension (which
+random number of the sample it is), so the result doesn't depend on the order the
+rays are traced, the thread or the packet width. The frame seed decorrelates frames.
+Dimensions 0 and 1 are the antialiasing offset, 2 is the ray angle, with light
+sampling 3 picks the lights or uniform angles, and path tracing uses 2 more per
+bounce
+*/
+
+namespace Lights2D
+{
+    enum class SamplerType
+    {
+        PCG,        // Independent random numbers
+        Sobol,      // Owen scrambled Sobol (0, 2) sequence, padded in pairs of dimensions
+        R2,         // Additive recurrence of the plastic number, rotated per pixel
+        BlueNoise   // R2 rotated by a blue noise tile, so the error of neighbour pixels differs
+    };
+
+    namespace Hash
+    {
+        static uint32_t pcg(uint32_t v)
+        {
+            // PCG RXS-M-XS output of a single LCG step, as a hash (Jarzynski and Olano)
+            uint32_t state = v * 747796405u + 2891336453u;
+            uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            return (word >> 22u) ^ word;
+        }
+
+        static uint32_t combine(uint32_t seed, uint32_t v)
+        {
+            return pcg(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+        }
+
+        static float to_float(uint32_t v)
+        {
+            // Upper 24 bits, so the result is always below 1
+            return (v >> 8) * (1.0f / 16777216.0f);
+        }
+    }
+
+    class Sampler
+    {
+        public:
+            Sampler(uint32_t seed) : _seed(seed) {}
+            virtual ~Sampler() {}
+
+            // Value in [0, 1)
+            virtual float get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const = 0;
+
+            // Independent samplers need the angle to be stratified by the renderer, sequences already are
+            virtual bool is_stratified() const { return true; }
+
+        protected:
+            uint32_t _pixel_seed(uint32_t x, uint32_t y) const
+            {
+                return Hash::combine(Hash::combine(_seed, x), y);
+            }
+
+            uint32_t _seed;
+    };
+
+    class PCGSampler : public Sampler
+    {
+        public:
+            using Sampler::Sampler;
+
+            float get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const override
+            {
+                return Hash::to_float(Hash::combine(Hash::combine(_pixel_seed(x, y), index), dimension));
+            }
+
+            bool is_stratified() const override { return false; }
+    };
+
+    class SobolSampler : public Sampler
+    {
+        /*
+        Only the first two Sobol dimensions are used. Higher dimensions are built from
+        the same pair, with the index shuffled and the values scrambled by a different
+        seed, so the pairs are decorrelated from each other (Burley, Practical Hash-based
+        Owen Scrambling, 2020). Every power of 2 prefix of a pair is well stratified
+        */
+        public:
+            using Sampler::Sampler;
+
+            float get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const override
+            {
+                uint32_t seed = Hash::combine(_pixel_seed(x, y), dimension >> 1);
+                uint32_t shuffled = _nested_uniform_scramble(index, seed);
+                uint32_t value = (dimension & 1) ? _sobol_1(shuffled) : _reverse_bits(shuffled);
+                return Hash::to_float(_nested_uniform_scramble(value, Hash::combine(seed, dimension & 1)));
+            }
+
+        private:
+            static uint32_t _reverse_bits(uint32_t v)
+            {
+                v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+                v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+                v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+                v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+                return (v >> 16) | (v << 16);
+            }
+
+            static uint32_t _sobol_1(uint32_t index)
+            {
+                // Second Sobol dimension, its direction numbers come from the polynomial x + 1
+                uint32_t result = 0;
+                uint32_t direction = 0x80000000u;
+                for (; index; index >>= 1)
+                {
+                    if (index & 1)
+                        result ^= direction;
+                    direction ^= direction >> 1;
+                }
+                return result;
+            }
+
+            static uint32_t _laine_karras_permutation(uint32_t v, uint32_t seed)
+            {
+                v += seed;
+                v ^= v * 0x6c50b47cu;
+                v ^= v * 0xb82f1e52u;
+                v ^= v * 0xc7afe638u;
+                v ^= v * 0x8d22f6e6u;
+                return v;
+            }
+
+            static uint32_t _nested_uniform_scramble(uint32_t v, uint32_t seed)
+            {
+                // Owen scrambling, each bit is flipped depending on the bits above it
+                return _reverse_bits(_laine_karras_permutation(_reverse_bits(v), seed));
+            }
+    };
+
+    class R2Sampler : public Sampler
+    {
+        /*
+        Dimensions 2k and 2k + 1 follow the R2 sequence, frac(offset + index * alpha), with
+        alpha = (1 / g, 1 / g^2) and g the plastic number. The offsets are a random
+        rotation per pixel and pair. Computed in 32 bit fixed point, so large indices
+        don't lose precision
+        */
+        public:
+            using Sampler::Sampler;
+
+            float get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const override
+            {
+                uint32_t offset = Hash::combine(Hash::combine(_pixel_seed(x, y), dimension >> 1), dimension & 1);
+                return Hash::to_float(offset + index * _alpha[dimension & 1]);
+            }
+
+        protected:
+            // 2^32 / g and 2^32 / g^2
+            static constexpr uint32_t _alpha[2] = { 3242174889u, 2447445413u };
+    };
+
+    class BlueNoiseSampler : public R2Sampler
+    {
+        /*
+        Same as R2, but the rotation of each pixel is read from a blue noise tile. The
+        first samples of neighbour pixels are as different as possible, so the error
+        looks like fine grain instead of clumps. Each pair of dimensions reads the tile at
+        a different offset, and the frame seed moves the offsets
+        */
+        public:
+            static constexpr uint32_t tile_size = 64;
+
+            BlueNoiseSampler(uint32_t seed) : R2Sampler(seed), _tile(tile()) {}
+
+            float get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const override
+            {
+                uint32_t shift = Hash::combine(_seed, dimension);
+                uint32_t tile_x = (x + (shift & 0xffff)) % tile_size;
+                uint32_t tile_y = (y + (shift >> 16)) % tile_size;
+                uint32_t offset = _tile[tile_x + tile_y * tile_size];
+                return Hash::to_float(offset + index * _alpha[dimension & 1]);
+            }
+
+            static const std::vector<uint32_t>& tile()
+            {
+                static const std::vector<uint32_t> noise = _void_and_cluster();
+                return noise;
+            }
+
+        private:
+            const std::vector<uint32_t>& _tile;
+
+            static std::vector<uint32_t> _void_and_cluster()
+            {
+                /*
+                Builds a tile_size x tile_size blue noise tile with the void and cluster method
+                (Ulichney 1993). The energy of a pixel is the sum of a toroidal Gaussian of the
+                distance to every set pixel. The initial 10% of points are relaxed by moving the
+                tightest cluster to the largest void, then ranked by removing clusters, and the
+                remaining pixels are ranked by filling the largest void. The ranks are spread
+                over the 32 bit range
+                */
+                constexpr uint32_t size = tile_size;
+                constexpr uint32_t count = size * size;
+                constexpr float sigma = 1.5f;
+
+                std::vector<float> kernel(count);
+                for (uint32_t y = 0; y < size; y++)
+                {
+                    for (uint32_t x = 0; x < size; x++)
+                    {
+                        float dx = static_cast<float>(std::min(x, size - x));
+                        float dy = static_cast<float>(std::min(y, size - y));
+                        kernel[x + y * size] = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+                    }
+                }
+
+                std::vector<uint8_t> set(count, 0);
+                std::vector<float> energy(count, 0.0f);
+
+                auto splat = [&](uint32_t pixel, float sign) {
+                    uint32_t px = pixel % size, py = pixel / size;
+                    for (uint32_t y = 0; y < size; y++)
+                        for (uint32_t x = 0; x < size; x++)
+                            energy[x + y * size] += sign * kernel[(x - px + size) % size + ((y - py + size) % size) * size];
+                };
+
+                auto tightest_cluster = [&]() {
+                    uint32_t best = 0;
+                    float best_energy = -1.0f;
+                    for (uint32_t i = 0; i < count; i++)
+                        if (set[i] && energy[i] > best_energy)
+                            best = i, best_energy = energy[i];
+                    return best;
+                };
+
+                auto largest_void = [&]() {
+                    uint32_t best = 0;
+                    float best_energy = 1e30f;
+                    for (uint32_t i = 0; i < count; i++)
+                        if (!set[i] && energy[i] < best_energy)
+                            best = i, best_energy = energy[i];
+                    return best;
+                };
+
+                // Initial random points
+                uint32_t initial = count / 10;
+                for (uint32_t placed = 0, i = 0; placed < initial; i++)
+                {
+                    uint32_t pixel = Hash::pcg(i) % count;
+                    if (!set[pixel])
+                    {
+                        set[pixel] = 1;
+                        splat(pixel, 1.0f);
+                        placed++;
+                    }
+                }
+
+                // Relaxation
+                for (uint32_t iteration = 0; iteration < count; iteration++)
+                {
+                    uint32_t cluster = tightest_cluster();
+                    set[cluster] = 0;
+                    splat(cluster, -1.0f);
+
+                    uint32_t void_pixel = largest_void();
+                    set[void_pixel] = 1;
+                    splat(void_pixel, 1.0f);
+                    if (void_pixel == cluster)
+                        break;
+                }
+
+                std::vector<uint32_t> rank(count);
+                std::vector<uint8_t> initial_set = set;
+                std::vector<float> initial_energy = energy;
+
+                // Ranks the initial points, the tightest clusters get the highest ranks among them
+                for (uint32_t r = initial; r > 0; r--)
+                {
+                    uint32_t cluster = tightest_cluster();
+                    set[cluster] = 0;
+                    splat(cluster, -1.0f);
+                    rank[cluster] = r - 1;
+                }
+
+                // Fills the largest voids with the rest of the ranks
+                set = initial_set;
+                energy = initial_energy;
+                for (uint32_t r = initial; r < count; r++)
+                {
+                    uint32_t void_pixel = largest_void();
+                    set[void_pixel] = 1;
+                    splat(void_pixel, 1.0f);
+                    rank[void_pixel] = r;
+                }
+
+                std::vector<uint32_t> tile(count);
+                for (uint32_t i = 0; i < count; i++)
+                    tile[i] = static_cast<uint32_t>((static_cast<uint64_t>(rank[i]) << 32) / count);
+                return tile;
+            }
+    };
+
+    namespace Samplers
+    {
+        static std::unique_ptr<Sampler> create(SamplerType type, uint32_t seed)
+        {
+            switch (type)
+            {
+                case SamplerType::PCG: return std::make_unique<PCGSampler>(seed);
+                case SamplerType::R2: return std::make_unique<R2Sampler>(seed);
+                case SamplerType::BlueNoise: return std::make_unique<BlueNoiseSampler>(seed);
+                case SamplerType::Sobol:
+                default: return std::make_unique<SobolSampler>(seed);
+            }
+        }
+    }
+
+    struct SampleStream
+    {
+        /*
+        Dimensions of a single sample, consumed in order by the renderer
+        */
+        const Sampler* sampler;
+        uint32_t x, y, index;
+        uint32_t dimension = 0;
+
+        SampleStream() : sampler(nullptr), x(0), y(0), index(0) {}
+        SampleStream(const Sampler* sampler, uint32_t x, uint32_t y, uint32_t index)
+            : sampler(sampler), x(x), y(y), index(index) {}
+
+        float next() { return sampler->get(x, y, index, dimension++); }
+    };
+}
+#endif
@@ -0,0 +1,186 @@
+#pragma once
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "vec2.h"
+#include "material.h"
+#include "light_sampler.h"
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <cmath>
+
+namespace Lights2D
+{
+    template <typename T>
+    struct BasicNearest
+    {
+        // SDF Scene function returns Nearest data
+        T distance;
+        MaterialBlend mtl;
+        BasicNearest() : distance(10e5f), mtl() {}
+
+        void update(const T& other_distance, const MaterialBlend& other_mtl)
+        {
+            // Keeps the closest object. Packets and duals only keep the distance, materials are resolved per ray
+            if constexpr (!std::is_same_v<T, float>)
+                distance = min(distance, other_distance);
+            else if (other_distance < distance)
+            {
+                distance = other_distance;
+                mtl = other_mtl;
+            }
+        }
+
+        void update(const T& other_distance, MaterialId other_mtl)
+        {
+            if constexpr (!std::is_same_v<T, float>)
+                distance = min(distance, other_distance);
+            else if (other_distance < distance)
+            {
+                distance = other_distance;
+                mtl = MaterialBlend(other_mtl);
+            }
+        }
+    };
+
+    typedef BasicNearest<float> Nearest;
+
+    // Function pointer type definition. This function is evaluated at each step of the ray march
+    typedef std::function<Nearest(Vec2, float)> SignedDistanceFunction;
+
+    template <typename SDF>
+    struct BasicScene
+    {
+        /*
+        BasicScene is what the renderer draws. The materials are created when the scene is
+        built, and the sdf refers to them by MaterialId. The renderer resolves the
+        Material only when a ray hits a surface.
+        SDF is the type of the signed distance function. When it's the scene type
+        itself, the renderer can inline it, Scene erases it with std::function
+        */
+        MaterialTable materials;
+        SDF sdf;
+
+        BasicScene() {}
+        BasicScene(const MaterialTable& materials, const SDF& sdf) : materials(materials), sdf(sdf) {}
+
+        // Any scene can be converted to the type erased Scene
+        template <typename OtherSDF>
+        BasicScene(const BasicScene<OtherSDF>& other) : materials(other.materials), sdf(other.sdf) {}
+    };
+
+    typedef BasicScene<SignedDistanceFunction> Scene;
+
+    /*
+    A scene type can split its SDF for the baked distance grid: static_part(Vector2<T>)
+    is what doesn't depend on the time, baked once and shared by every frame, and
+    animated_part(Vector2<T>, float time) what moves, evaluated at every step instead
+    of being baked. operator() stays the whole scene. Scenes without static_part are
+    baked whole, at the time of each frame
+    */
+    template <typename SDF, typename = void>
+    struct has_static_part : std::false_type {};
+    template <typename SDF>
+    struct has_static_part<SDF, std::void_t<decltype(std::declval<const SDF&>().static_part(std::declval<Vec2>()))>> : std::true_type {};
+
+    template <typename SDF, typename = void>
+    struct has_animated_part : std::false_type {};
+    template <typename SDF>
+    struct has_animated_part<SDF, std::void_t<decltype(std::declval<const SDF&>().animated_part(std::declval<Vec2>(), 0.0f))>> : std::true_type {};
+
+    struct Bounds
+    {
+        // Axis aligned box, min_x > max_x when empty
+        float min_x, min_y, max_x, max_y;
+
+        static Bounds empty() { return { INFINITY, INFINITY, -INFINITY, -INFINITY }; }
+        static Bounds everything() { return { -INFINITY, -INFINITY, INFINITY, INFINITY }; }
+        void grow(const Bounds& other)
+        {
+            min_x = std::min(min_x, other.min_x);
+            min_y = std::min(min_y, other.min_y);
+            max_x = std::max(max_x, other.max_x);
+            max_y = std::max(max_y, other.max_y);
+        }
+        void expand(float amount)
+        {
+            min_x -= amount;
+            min_y -= amount;
+            max_x += amount;
+            max_y += amount;
+        }
+        bool finite() const { return std::isfinite(min_x) && std::isfinite(min_y) && std::isfinite(max_x) && std::isfinite(max_y); }
+
+        // Range [t_enter, t_exit] of the ray inside the box, false if the ray misses it
+        bool clip(Vec2 origin, Vec2 direction, float& t_enter, float& t_exit) const
+        {
+            t_enter = -INFINITY;
+            t_exit = INFINITY;
+            if (min_x > max_x || min_y > max_y)
+                return false;
+            float o[2] = { origin.x, origin.y }, d[2] = { direction.x, direction.y };
+            float lo[2] = { min_x, min_y }, hi[2] = { max_x, max_y };
+            for (int axis = 0; axis < 2; axis++)
+            {
+                if (d[axis] == 0.0f)
+                {
+                    if (o[axis] < lo[axis] || o[axis] > hi[axis])
+                        return false;
+                    continue;
+                }
+                float inverse = 1.0f / d[axis];
+                float t0 = (lo[axis] - o[axis]) * inverse, t1 = (hi[axis] - o[axis]) * inverse;
+                t_enter = std::max(t_enter, std::min(t0, t1));
+                t_exit = std::min(t_exit, std::max(t0, t1));
+            }
+            return t_enter <= t_exit;
+        }
+    };
+
+    /*
+    A scene type can declare bounds(), a Bounds that holds every surface of the scene at
+    any time. The renderer ends rays once they leave it, instead of marching the empty
+    space past the scene until ray_march_max_iterations
+    */
+    template <typename SDF, typename = void>
+    struct has_bounds : std::false_type {};
+    template <typename SDF>
+    struct has_bounds<SDF, std::void_t<decltype(std::declval<const SDF&>().bounds())>> : std::true_type {};
+
+    /*
+    A scene type can declare lipschitz(), a bound on how fast its distance changes, 1 for
+    exact distances and the unions, intersections and smooth unions of them. The march
+    divides the distance by it, and only scenes that declare it take over-relaxed steps,
+    an SDF of unknown quality marches plainly
+    */
+    template <typename SDF, typename = void>
+    struct has_lipschitz : std::false_type {};
+    template <typename SDF>
+    struct has_lipschitz<SDF, std::void_t<decltype(std::declval<const SDF&>().lipschitz())>> : std::true_type {};
+
+    /*
+    A scene type can declare lights(float time), a std::vector<LightShape> holding its
+    emitters at that time. Primary rays are then also sent toward them, see
+    FrameConfig::light_sampling
+    */
+    template <typename SDF, typename = void>
+    struct has_lights : std::false_type {};
+    template <typename SDF>
+    struct has_lights<SDF, std::void_t<decltype(std::declval<const SDF&>().lights(0.0f))>> : std::true_type {};
+
+    template <typename SceneFunction>
+    static BasicScene<SceneFunction> compile_scene()
+    {
+        /*
+        Builds a scene from a callable type, whose constructor registers the materials
+        in the table, and whose operator()(Vec2, float) is the signed distance function.
+        When the type has a template operator()(Vector2<T>, float) returning BasicNearest<T>,
+        the renderer also marches packets of rays with it, and computes normals with Dual
+        */
+        MaterialTable materials;
+        SceneFunction sdf(materials);
+        return BasicScene<SceneFunction>(materials, sdf);
+    }
+}
+#endif
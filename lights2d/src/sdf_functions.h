@@ -12,117 +12,143 @@ namespace Lights2D
     namespace SDF
     {
 
-        static float combine_union(float d1, float d2)
+        /*
+        The functions are templates on the scalar type T. T is float for single rays,
+        and Packet<N> when N rays are marched at once. Branches are written with
+        select(), so every lane evaluates both sides and keeps its own result
+        */
+
+        template <typename T>
+        static T combine_union(T d1, T d2)
         {
             return min(d1, d2);
         }
 
-        static float combine_subtract(float d1, float d2)
+        template <typename T>
+        static T combine_subtract(T d1, T d2)
         {
             return max(d1, -d2);
         }
 
-        static float smooth_t(float d1, float d2, float k)
+        template <typename T>
+        static T smooth_t(T d1, T d2, float k)
         {
             return clamp(0.5f + 0.5f * (d2 - d1) / k, 0.0f, 1.0f);
         }
 
 
-        static float combine_union_s(float d1, float d2, float k, float h)
+        template <typename T>
+        static T combine_union_s(T d1, T d2, float k, T h)
         {
             // Smooth union when h is already calculated
             return mix(d2, d1, h) - k * h * (1.0f - h);
         }
 
-        static float combine_union_s(float d1, float d2, float k)
+        template <typename T>
+        static T combine_union_s(T d1, T d2, float k)
         {
             // Smooth union
-            float h = smooth_t(d1, d2, k);
+            T h = smooth_t(d1, d2, k);
             return mix(d2, d1, h) - k * h * (1.0f - h);
         }
 
-        static float combine_intersect(float d1, float d2)
+        template <typename T>
+        static T combine_intersect(T d1, T d2)
         {
             return max(d1, d2);
         }
 
-        static float combine_subtract_s(float d1, float d2, float k)
+        template <typename T>
+        static T combine_subtract_s(T d1, T d2, float k)
         {
             // Smooth subtract
-            float h = smooth_t(d1, d2, k);
+            T h = smooth_t(d1, d2, k);
             return mix(d2, -d1, h) - k * h * (1.0f - h);
         }
 
-        static float circle(Vec2 pos, Vec2 center, float radius)
+        template <typename T>
+        static T circle(Vector2<T> pos, Vec2 center, float radius)
         {
-            return Vec2::length(pos - center) - radius;
+            return Vector2<T>::length(pos - center) - radius;
         }
 
-        static float box(Vec2 pos, Vec2 center, Vec2 size)
+        template <typename T>
+        static T box(Vector2<T> pos, Vec2 center, Vec2 size)
         {
-            Vec2 q = abs(pos - center) - size;
-            return Vec2::length(max(q, 0.0f)) + min(max(q.x, q.y), 0.0f);
+            Vector2<T> q = abs(pos - center) - size;
+            return Vector2<T>::length(max(q, 0.0f)) + min(max(q.x, q.y), 0.0f);
         }
 
-        static float round_box(Vec2 pos, Vec2 center, Vec2 size, float r)
+        template <typename T>
+        static T round_box(Vector2<T> pos, Vec2 center, Vec2 size, float r)
         {
-            Vec2 q = abs(pos - center) - size;
-            return Vec2::length(max(q, 0.0f)) + min(max(q.x, q.y), 0.0f) - r;
-        }    
+            Vector2<T> q = abs(pos - center) - size;
+            return Vector2<T>::length(max(q, 0.0f)) + min(max(q.x, q.y), 0.0f) - r;
+        }
 
-        static float line(Vec2 pos, Vec2 a, Vec2 b, float r)
+        template <typename T>
+        static T line(Vector2<T> pos, Vec2 a, Vec2 b, float r)
         {
-            Vec2 pa = pos - a;
+            Vector2<T> pa = pos - a;
             Vec2 ba = b - a;
-            float h = Utils::clamp(Vec2::dot(pa, ba) / Vec2::dot(ba, ba), 0.0f, 1.0f);
-            return Vec2::length(pa - ba * h) - r;
+            T h = clamp(Vector2<T>::dot(pa, ba) / Vec2::dot(ba, ba), 0.0f, 1.0f);
+            return Vector2<T>::length(pa - Vector2<T>(ba) * h) - r;
         }
 
-        static float plane(Vec2 p, Vec2 p0, Vec2 normal)
+        template <typename T>
+        static T plane(Vector2<T> p, Vec2 p0, Vec2 normal)
         {
-            return Vec2::dot(p - p0, normal);
+            return Vector2<T>::dot(p - p0, normal);
         }
-        
-        static float arc(Vec2 p, Vec2 sc, float ra, float rb)
+
+        template <typename T>
+        static T arc(Vector2<T> p, Vec2 sc, float ra, float rb)
         {
             // sc is the vec2(sin, cos) of the arc's aperture
-            p.x = std::abs(p.x);
-            return ((sc.y*p.x>sc.x*p.y) ? Vec2::length(p-sc*ra) : std::abs(Vec2::length(p)-ra)) - rb;
+            p.x = abs(p.x);
+            return select(
+                sc.y * p.x > sc.x * p.y,
+                Vector2<T>::length(p - sc * ra),
+                abs(Vector2<T>::length(p) - ra)) - rb;
         }
 
-        static float heart(Vec2 p, Vec2 center)
+        template <typename T>
+        static T heart(Vector2<T> p, Vec2 center)
         {
             p -= center;
-            p.x = std::abs(p.x);
+            p.x = abs(p.x);
 
-            if( p.y+p.x>1.0 )
-                return sqrt(Vec2::length_squared(p-Vec2(0.25f,0.75f))) - sqrt(2.0f)/4.0f;
-            return sqrt(min(Vec2::length_squared(p-Vec2(0.00f,1.00f)),
-                            Vec2::length_squared(p-0.5f*max(p.x+p.y,0.0)))) * sign(p.x-p.y);
+            T upper = sqrt(Vector2<T>::length_squared(p - Vec2(0.25f, 0.75f))) - sqrt(2.0f) / 4.0f;
+            T lower = sqrt(min(Vector2<T>::length_squared(p - Vec2(0.00f, 1.00f)),
+                               Vector2<T>::length_squared(p - max(p.x + p.y, 0.0f) * 0.5f))) * sign(p.x - p.y);
+            return select(p.y + p.x > 1.0f, upper, lower);
         }
 
-        static float egg(Vec2 p, Vec2 center, float ra, float rb)
+        template <typename T>
+        static T egg(Vector2<T> p, Vec2 center, float ra, float rb)
         {
             p -= center;
             const float k = sqrt(3.0f);
-            p.x = std::abs(p.x);
+            p.x = abs(p.x);
             float r = ra - rb;
-            return ((p.y<0.0)       ? Vec2::length(Vec2(p.x,  p.y    )) - r :
-                    (k*(p.x+r)<p.y) ? Vec2::length(Vec2(p.x,  p.y-k*r)) :
-                                    Vec2::length(Vec2(p.x+r,p.y    )) - 2.0f*r) - rb;
+            T below = Vector2<T>::length(p) - r;
+            T tip = Vector2<T>::length(Vector2<T>(p.x, p.y - k * r));
+            T side = Vector2<T>::length(Vector2<T>(p.x + r, p.y)) - 2.0f * r;
+            return select(p.y < 0.0f, below, select(k * (p.x + r) < p.y, tip, side)) - rb;
         }
 
-        static float pentagon(Vec2 p, float r)
+        template <typename T>
+        static T pentagon(Vector2<T> p, float r)
         {
             const float k0 = 0.809016994f;
             const float k1 = 0.587785252f;
             const float k2 = 0.726542528f;
 
-            p.x = std::abs(p.x);
-            p -= Vec2(-k0,k1) * 2.0f*min(Vec2::dot(Vec2(-k0,k1),p),0.0);
-            p -= Vec2( k0,k1) * 2.0f*min(Vec2::dot(Vec2( k0,k1),p),0.0);
-            p -= Vec2(clamp(p.x,-r*k2,r*k2),r);    
-            return Vec2::length(p)*sign(p.y);
+            p.x = abs(p.x);
+            p -= Vector2<T>(Vec2(-k0, k1)) * (2.0f * min(Vector2<T>::dot(p, Vec2(-k0, k1)), 0.0f));
+            p -= Vector2<T>(Vec2( k0, k1)) * (2.0f * min(Vector2<T>::dot(p, Vec2( k0, k1)), 0.0f));
+            p -= Vector2<T>(clamp(p.x, -r * k2, r * k2), T(r));
+            return Vector2<T>::length(p) * sign(p.y);
         }
 
     }
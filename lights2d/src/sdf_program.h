@@ -0,0 +1,518 @@
+#pragma once
+#ifndef SDF_PROGRAM_H
+#define SDF_PROGRAM_H
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "vec2.h"
+#include "scene.h"
+
+/*
+The SDF of a scene compiled to a tape of instructions for a small interpreter.
+Evaluating the scene with Vector2<Expr> records every operation in an ExprGraph,
+instead of computing it, with the time already applied. The graph is then pruned for
+every cell of a grid over the scene: interval arithmetic over the bounds of the cell
+tells the minimums, maximums and selects whose result is always the same operand
+there, and what's left is a much shorter tape. A smooth union far from both shapes
+still evaluates both, but the distant objects of the scene are gone.
+Only --benchmark program uses it: even pruned, the interpreter is 2 to 5 times
+slower than the inlined C++ operator() the renderer marches
+*/
+
+namespace Lights2D
+{
+    enum class Opcode : uint16_t
+    {
+        X, Y, Const,
+        Add, Sub, Mul, Div, Neg,
+        Min, Max, Abs, Sqrt, Sign,
+        Less, LessEqual,                // 1 or 0
+        Select                          // a != 0 ? b : c
+    };
+
+    struct ExprNode
+    {
+        Opcode op;
+        uint32_t a, b, c;
+        float value;                    // Of constants
+
+        bool operator==(const ExprNode& other) const
+        {
+            return op == other.op && a == other.a && b == other.b && c == other.c
+                && std::memcmp(&value, &other.value, sizeof(float)) == 0;
+        }
+    };
+
+    class ExprGraph
+    {
+        /*
+        Nodes in the order they are created, so operands always come before their users.
+        Equal nodes are created once, and operations on constants are folded
+        */
+        public:
+            std::vector<ExprNode> nodes;
+            uint32_t output = 0;
+
+        public:
+            ExprGraph()
+            {
+                add({ Opcode::X, 0, 0, 0, 0.0f });
+                add({ Opcode::Y, 0, 0, 0, 0.0f });
+            }
+
+            // The graph Expr operations are recorded in, on this thread
+            static ExprGraph*& active()
+            {
+                static thread_local ExprGraph* graph = nullptr;
+                return graph;
+            }
+
+            uint32_t add(const ExprNode& node)
+            {
+                auto found = _index.find(node);
+                if (found != _index.end())
+                    return found->second;
+                uint32_t index = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(node);
+                _index[node] = index;
+                return index;
+            }
+
+            uint32_t constant(float value) { return add({ Opcode::Const, 0, 0, 0, value }); }
+
+            uint32_t operation(Opcode op, uint32_t a, uint32_t b = 0, uint32_t c = 0)
+            {
+                bool constant_operands = nodes[a].op == Opcode::Const
+                    && (arity(op) < 2 || nodes[b].op == Opcode::Const)
+                    && (arity(op) < 3 || nodes[c].op == Opcode::Const);
+                if (constant_operands)
+                    return constant(apply(op, nodes[a].value, nodes[b].value, nodes[c].value));
+                if (op == Opcode::Select && nodes[a].op == Opcode::Const)
+                    return nodes[a].value != 0.0f ? b : c;
+                return add({ op, a, b, c, 0.0f });
+            }
+
+            static uint32_t arity(Opcode op)
+            {
+                switch (op)
+                {
+                    case Opcode::X: case Opcode::Y: case Opcode::Const: return 0;
+                    case Opcode::Neg: case Opcode::Abs: case Opcode::Sqrt: case Opcode::Sign: return 1;
+                    case Opcode::Select: return 3;
+                    default: return 2;
+                }
+            }
+
+            // The operation on values, as the interpreter runs it. Same results as the float SDF functions
+            static float apply(Opcode op, float a, float b, float c)
+            {
+                switch (op)
+                {
+                    case Opcode::Add: return a + b;
+                    case Opcode::Sub: return a - b;
+                    case Opcode::Mul: return a * b;
+                    case Opcode::Div: return a / b;
+                    case Opcode::Neg: return -a;
+                    case Opcode::Min: return a < b ? a : b;
+                    case Opcode::Max: return a > b ? a : b;
+                    case Opcode::Abs: return std::abs(a);
+                    case Opcode::Sqrt: return std::sqrt(a);
+                    case Opcode::Sign: return a > 0.0f ? 1.0f : 0.0f;
+                    case Opcode::Less: return a < b ? 1.0f : 0.0f;
+                    case Opcode::LessEqual: return a <= b ? 1.0f : 0.0f;
+                    case Opcode::Select: return a != 0.0f ? b : c;
+                    default: return 0.0f;
+                }
+            }
+
+        private:
+            struct NodeHash
+            {
+                size_t operator()(const ExprNode& node) const
+                {
+                    uint32_t bits;
+                    std::memcpy(&bits, &node.value, sizeof(float));
+                    size_t hash = static_cast<size_t>(node.op);
+                    for (uint32_t v : { node.a, node.b, node.c, bits })
+                        hash = hash * 0x9e3779b97f4a7c15ull + v;
+                    return hash;
+                }
+            };
+            std::unordered_map<ExprNode, uint32_t, NodeHash> _index;
+    };
+
+    struct ExprMask
+    {
+        uint32_t node;
+    };
+
+    struct Expr
+    {
+        /*
+        A value of the SDF while it's being compiled: the node of the active graph that
+        computes it. Comparisons give an ExprMask, for select, so branches are recorded
+        the same way packets evaluate them
+        */
+        uint32_t node;
+
+        Expr() : Expr(0.0f) {}
+        Expr(float value) : node(ExprGraph::active()->constant(value)) {}
+        explicit Expr(uint32_t node, bool) : node(node) {}
+
+        static Vector2<Expr> position() { return { Expr(0, true), Expr(1, true) }; }
+
+        static Expr operation(Opcode op, const Expr& a, const Expr& b = Expr(0, true), const Expr& c = Expr(0, true))
+        {
+            return Expr(ExprGraph::active()->operation(op, a.node, b.node, c.node), true);
+        }
+
+        Expr operator-() const { return operation(Opcode::Neg, *this); }
+        void operator+=(const Expr& other) { *this = *this + other; }
+        void operator-=(const Expr& other) { *this = *this - other; }
+        void operator*=(const Expr& other) { *this = *this * other; }
+        void operator/=(const Expr& other) { *this = *this / other; }
+
+        friend Expr operator+(const Expr& a, const Expr& b) { return operation(Opcode::Add, a, b); }
+        friend Expr operator-(const Expr& a, const Expr& b) { return operation(Opcode::Sub, a, b); }
+        friend Expr operator*(const Expr& a, const Expr& b) { return operation(Opcode::Mul, a, b); }
+        friend Expr operator/(const Expr& a, const Expr& b) { return operation(Opcode::Div, a, b); }
+
+        friend ExprMask operator<(const Expr& a, const Expr& b) { return { operation(Opcode::Less, a, b).node }; }
+        friend ExprMask operator>(const Expr& a, const Expr& b) { return { operation(Opcode::Less, b, a).node }; }
+        friend ExprMask operator<=(const Expr& a, const Expr& b) { return { operation(Opcode::LessEqual, a, b).node }; }
+        friend ExprMask operator>=(const Expr& a, const Expr& b) { return { operation(Opcode::LessEqual, b, a).node }; }
+    };
+
+    // Expr versions of the scalar math used by the SDF functions, found by argument dependent lookup
+
+    static Expr select(const ExprMask& mask, const Expr& a, const Expr& b) { return Expr::operation(Opcode::Select, Expr(mask.node, true), a, b); }
+    static Expr min(const Expr& a, const Expr& b) { return Expr::operation(Opcode::Min, a, b); }
+    static Expr max(const Expr& a, const Expr& b) { return Expr::operation(Opcode::Max, a, b); }
+    static Expr abs(const Expr& a) { return Expr::operation(Opcode::Abs, a); }
+    static Expr sqrt(const Expr& a) { return Expr::operation(Opcode::Sqrt, a); }
+    static Expr sign(const Expr& a) { return Expr::operation(Opcode::Sign, a); }
+    static Expr clamp(const Expr& a, float min_value, float max_value) { return min(max(a, min_value), max_value); }
+    static Expr mix(const Expr& a, const Expr& b, const Expr& t) { return a + (b - a) * t; }
+
+    struct Interval
+    {
+        float lo, hi;
+
+        static Interval everything() { return { -INFINITY, INFINITY }; }
+        bool is_constant() const { return lo == hi; }
+    };
+
+    class SdfProgram
+    {
+        /*
+        Tapes of the graph: the whole graph, used outside the grid, and one per cell,
+        shared by the cells that prune to the same instructions. The registers of a tape
+        are x, y, its constants, then the temporaries, that are reused once their last
+        reader is done. The interpreter is a loop over the instructions, each reads
+        three registers and writes one, without branches besides the dispatch
+        */
+        public:
+            static constexpr uint32_t max_registers = 1024;
+
+            // SDF types with a template operator() that accepts Vector2<Expr>
+            template <typename SDF>
+            static constexpr bool compilable = std::is_invocable_r_v<BasicNearest<Expr>, const SDF&, Vector2<Expr>, float>;
+
+            float compiled_time = 0.0f;
+
+        public:
+            // Records sdf at time, and prunes it on cells of cell_size over [bounds_min, bounds_max]
+            template <typename SDF>
+            SdfProgram(const SDF& sdf, float time, Vec2 bounds_min, Vec2 bounds_max, float cell_size)
+                :   compiled_time(time),
+                    _min(bounds_min),
+                    _inverse_cell_size(1.0f / cell_size)
+            {
+                ExprGraph graph;
+                ExprGraph*& active = ExprGraph::active();
+                ExprGraph* previous = active;
+                active = &graph;
+                graph.output = sdf(Expr::position(), time).distance.node;
+                active = previous;
+
+                _graph_nodes = static_cast<uint32_t>(graph.nodes.size());
+                _cells_x = std::max(static_cast<uint32_t>(std::ceil((bounds_max.x - bounds_min.x) * _inverse_cell_size)), 1u);
+                _cells_y = std::max(static_cast<uint32_t>(std::ceil((bounds_max.y - bounds_min.y) * _inverse_cell_size)), 1u);
+
+                std::unordered_map<std::string, uint32_t> unique;
+                _add_tape(graph, nullptr, unique);
+                if (!valid())
+                    return;
+                _cell_tapes.resize(static_cast<size_t>(_cells_x) * _cells_y);
+                for (uint32_t y = 0; y < _cells_y; y++)
+                {
+                    for (uint32_t x = 0; x < _cells_x; x++)
+                    {
+                        Interval bounds[2] = {
+                            { bounds_min.x + x * cell_size, bounds_min.x + (x + 1) * cell_size },
+                            { bounds_min.y + y * cell_size, bounds_min.y + (y + 1) * cell_size } };
+                        _cell_tapes[y * _cells_x + x] = _add_tape(graph, bounds, unique);
+                    }
+                }
+            }
+
+            float distance(Vec2 point) const
+            {
+                float gx = (point.x - _min.x) * _inverse_cell_size;
+                float gy = (point.y - _min.y) * _inverse_cell_size;
+                uint32_t tape = 0;
+                if (gx >= 0.0f && gy >= 0.0f && gx < _cells_x && gy < _cells_y)
+                    tape = _cell_tapes[static_cast<uint32_t>(gy) * _cells_x + static_cast<uint32_t>(gx)];
+                return _run(_tapes[tape], point);
+            }
+
+            // Distance with the tape of the whole graph
+            float full_distance(Vec2 point) const { return _run(_tapes[0], point); }
+
+            // False when the whole graph needs more than max_registers, the SDF has to be evaluated instead
+            bool valid() const { return !_tapes.empty(); }
+
+            uint32_t graph_nodes() const { return _graph_nodes; }
+            uint32_t full_length() const { return _tapes[0].instruction_count; }
+            uint32_t tape_count() const { return static_cast<uint32_t>(_tapes.size()); }
+
+            // Instructions of the tape of a cell, averaged over the cells
+            float mean_cell_length() const
+            {
+                double total = 0.0;
+                if (_cell_tapes.empty())
+                    return 0.0f;
+                for (uint32_t tape : _cell_tapes)
+                    total += _tapes[tape].instruction_count;
+                return static_cast<float>(total / _cell_tapes.size());
+            }
+
+        private:
+            struct Instruction
+            {
+                Opcode op;
+                uint16_t out, a, b, c;
+            };
+
+            struct Tape
+            {
+                uint32_t first_instruction, instruction_count;
+                uint32_t first_constant, constant_count;
+                uint32_t result;
+            };
+
+            Vec2 _min;
+            float _inverse_cell_size;
+            uint32_t _cells_x = 0, _cells_y = 0;
+            uint32_t _graph_nodes = 0;
+            std::vector<Instruction> _instructions;
+            std::vector<float> _constants;
+            std::vector<Tape> _tapes;
+            std::vector<uint32_t> _cell_tapes;
+
+            float _run(const Tape& tape, Vec2 point) const
+            {
+                float registers[max_registers];
+                registers[0] = point.x;
+                registers[1] = point.y;
+                std::memcpy(&registers[2], &_constants[tape.first_constant], tape.constant_count * sizeof(float));
+                const Instruction* instruction = &_instructions[tape.first_instruction];
+                const Instruction* end = instruction + tape.instruction_count;
+                for (; instruction != end; instruction++)
+                    registers[instruction->out] = ExprGraph::apply(instruction->op, registers[instruction->a], registers[instruction->b], registers[instruction->c]);
+                return registers[tape.result];
+            }
+
+            static Interval _interval(Opcode op, Interval a, Interval b, Interval c)
+            {
+                // Bounds of the operation over the intervals. Not outward rounded, a choice at a tie is off by rounding only
+                auto span = [](float v0, float v1, float v2, float v3) {
+                    if (std::isnan(v0) || std::isnan(v1) || std::isnan(v2) || std::isnan(v3))
+                        return Interval::everything();
+                    return Interval{ std::min(std::min(v0, v1), std::min(v2, v3)), std::max(std::max(v0, v1), std::max(v2, v3)) };
+                };
+                switch (op)
+                {
+                    case Opcode::Add: return { a.lo + b.lo, a.hi + b.hi };
+                    case Opcode::Sub: return { a.lo - b.hi, a.hi - b.lo };
+                    case Opcode::Mul: return span(a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi);
+                    case Opcode::Div:
+                        if (b.lo <= 0.0f && b.hi >= 0.0f)
+                            return Interval::everything();
+                        return span(a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi);
+                    case Opcode::Neg: return { -a.hi, -a.lo };
+                    case Opcode::Min: return { std::min(a.lo, b.lo), std::min(a.hi, b.hi) };
+                    case Opcode::Max: return { std::max(a.lo, b.lo), std::max(a.hi, b.hi) };
+                    case Opcode::Abs:
+                        if (a.lo >= 0.0f)
+                            return a;
+                        if (a.hi <= 0.0f)
+                            return { -a.hi, -a.lo };
+                        return { 0.0f, std::max(-a.lo, a.hi) };
+                    case Opcode::Sqrt: return { std::sqrt(std::max(a.lo, 0.0f)), std::sqrt(std::max(a.hi, 0.0f)) };
+                    case Opcode::Sign: return a.lo > 0.0f ? Interval{ 1.0f, 1.0f } : a.hi <= 0.0f ? Interval{ 0.0f, 0.0f } : Interval{ 0.0f, 1.0f };
+                    case Opcode::Less: return a.hi < b.lo ? Interval{ 1.0f, 1.0f } : a.lo >= b.hi ? Interval{ 0.0f, 0.0f } : Interval{ 0.0f, 1.0f };
+                    case Opcode::LessEqual: return a.hi <= b.lo ? Interval{ 1.0f, 1.0f } : a.lo > b.hi ? Interval{ 0.0f, 0.0f } : Interval{ 0.0f, 1.0f };
+                    case Opcode::Select:
+                        if (a.lo == a.hi)
+                            return a.lo != 0.0f ? b : c;
+                        return { std::min(b.lo, c.lo), std::max(b.hi, c.hi) };
+                    default: return Interval::everything();
+                }
+            }
+
+            uint32_t _add_tape(const ExprGraph& graph, const Interval* bounds, std::unordered_map<std::string, uint32_t>& unique)
+            {
+                /*
+                Every node gets the node its value comes from: itself, or the operand a
+                minimum, maximum or select always picks in the bounds. Nodes whose interval is
+                a single value become constants. Without bounds nothing is pruned
+                */
+                size_t count = graph.nodes.size();
+                std::vector<uint32_t> source(count);
+                std::vector<Interval> intervals(count);
+                std::vector<uint8_t> constant(count, 0);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const ExprNode& node = graph.nodes[i];
+                    source[i] = i;
+                    if (node.op == Opcode::X || node.op == Opcode::Y)
+                    {
+                        intervals[i] = bounds ? bounds[node.op == Opcode::Y] : Interval::everything();
+                        continue;
+                    }
+                    if (node.op == Opcode::Const)
+                    {
+                        intervals[i] = { node.value, node.value };
+                        constant[i] = 1;
+                        continue;
+                    }
+
+                    uint32_t arity = ExprGraph::arity(node.op);
+                    uint32_t a = source[node.a], b = arity > 1 ? source[node.b] : a, c = arity > 2 ? source[node.c] : a;
+                    intervals[i] = _interval(node.op, intervals[a], intervals[b], intervals[c]);
+                    if (!bounds)
+                        continue;
+
+                    uint32_t picked = i;
+                    if (node.op == Opcode::Min)
+                        picked = intervals[a].hi <= intervals[b].lo ? a : intervals[b].hi <= intervals[a].lo ? b : i;
+                    else if (node.op == Opcode::Max)
+                        picked = intervals[a].lo >= intervals[b].hi ? a : intervals[b].lo >= intervals[a].hi ? b : i;
+                    else if (node.op == Opcode::Select && intervals[a].is_constant())
+                        picked = intervals[a].lo != 0.0f ? b : c;
+                    else if (node.op == Opcode::Abs && intervals[a].lo >= 0.0f)
+                        picked = a;
+
+                    if (picked != i)
+                    {
+                        source[i] = picked;
+                        intervals[i] = intervals[picked];
+                    }
+                    else if (intervals[i].is_constant() && std::isfinite(intervals[i].lo))
+                        constant[i] = 1;
+                }
+
+                // Nodes the output needs, from the last to the first
+                std::vector<uint8_t> live(count, 0);
+                live[source[graph.output]] = 1;
+                for (uint32_t i = static_cast<uint32_t>(count); i-- > 0;)
+                {
+                    const ExprNode& node = graph.nodes[i];
+                    if (!live[i] || source[i] != i || constant[i])
+                        continue;
+                    uint32_t arity = ExprGraph::arity(node.op);
+                    if (arity > 0) live[source[node.a]] = 1;
+                    if (arity > 1) live[source[node.b]] = 1;
+                    if (arity > 2) live[source[node.c]] = 1;
+                }
+
+                // Constants first, then the instructions with their last reader
+                std::vector<uint32_t> reg(count, 0);
+                std::vector<float> constants;
+                std::vector<uint32_t> order;
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    if (!live[i])
+                        continue;
+                    const ExprNode& node = graph.nodes[i];
+                    if (node.op == Opcode::X || node.op == Opcode::Y)
+                        reg[i] = node.op == Opcode::Y;
+                    else if (constant[i])
+                    {
+                        reg[i] = 2 + static_cast<uint32_t>(constants.size());
+                        constants.push_back(intervals[i].lo);
+                    }
+                    else
+                        order.push_back(i);
+                }
+
+                std::vector<uint32_t> last_reader(count, 0);
+                for (uint32_t k = 0; k < order.size(); k++)
+                {
+                    const ExprNode& node = graph.nodes[order[k]];
+                    uint32_t arity = ExprGraph::arity(node.op);
+                    if (arity > 0) last_reader[source[node.a]] = k;
+                    if (arity > 1) last_reader[source[node.b]] = k;
+                    if (arity > 2) last_reader[source[node.c]] = k;
+                }
+                last_reader[source[graph.output]] = UINT32_MAX;
+
+                std::vector<Instruction> instructions;
+                std::vector<uint32_t> free_registers;
+                uint32_t next_register = 2 + static_cast<uint32_t>(constants.size());
+                for (uint32_t k = 0; k < order.size(); k++)
+                {
+                    uint32_t i = order[k];
+                    const ExprNode& node = graph.nodes[i];
+                    uint32_t arity = ExprGraph::arity(node.op);
+                    uint32_t operands[3] = { source[node.a], arity > 1 ? source[node.b] : source[node.a], arity > 2 ? source[node.c] : source[node.a] };
+
+                    // The output can take the register of an operand read for the last time
+                    for (uint32_t j = 0; j < arity; j++)
+                    {
+                        uint32_t operand = operands[j];
+                        bool temporary = reg[operand] >= 2 + constants.size();
+                        bool repeated = (j > 0 && operands[0] == operand) || (j > 1 && operands[1] == operand);
+                        if (temporary && !repeated && last_reader[operand] == k)
+                            free_registers.push_back(reg[operand]);
+                    }
+                    if (free_registers.empty())
+                        reg[i] = next_register++;
+                    else
+                    {
+                        reg[i] = free_registers.back();
+                        free_registers.pop_back();
+                    }
+                    instructions.push_back({ node.op, static_cast<uint16_t>(reg[i]), static_cast<uint16_t>(reg[operands[0]]),
+                        static_cast<uint16_t>(reg[operands[1]]), static_cast<uint16_t>(reg[operands[2]]) });
+                }
+
+                // Cells that prune the same way share the tape. Past the register file, the cell marches the whole tape
+                uint32_t result = reg[source[graph.output]];
+                if (next_register > max_registers)
+                    return 0;           // Without bounds, no tape is added and the program isn't valid
+                std::string key(reinterpret_cast<const char*>(instructions.data()), instructions.size() * sizeof(Instruction));
+                key.append(reinterpret_cast<const char*>(constants.data()), constants.size() * sizeof(float));
+                key.append(reinterpret_cast<const char*>(&result), sizeof(result));
+                auto found = unique.find(key);
+                if (found != unique.end())
+                    return found->second;
+
+                Tape tape = {
+                    static_cast<uint32_t>(_instructions.size()), static_cast<uint32_t>(instructions.size()),
+                    static_cast<uint32_t>(_constants.size()), static_cast<uint32_t>(constants.size()), result };
+                _instructions.insert(_instructions.end(), instructions.begin(), instructions.end());
+                _constants.insert(_constants.end(), constants.begin(), constants.end());
+                _tapes.push_back(tape);
+                unique[key] = static_cast<uint32_t>(_tapes.size() - 1);
+                return static_cast<uint32_t>(_tapes.size() - 1);
+            }
+    };
+}
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+#ifndef SIMD_H
+#define SIMD_H
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <type_traits>
+
+/*
+Packet<N> holds N floats that are processed with the same instruction. It uses the
+GCC / Clang vector extensions, so the compiler emits SSE or NEON for 4 lanes, and
+AVX for 8 lanes when the function is compiled for it. Functions that should run
+with AVX2 are marked with LIGHTS2D_TARGET_AVX2, and called only when
+Simd::cpu_supports_avx2() returns true, so the same binary runs on older CPUs
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define LIGHTS2D_SIMD_DISPATCH 1
+#define LIGHTS2D_TARGET_AVX2 __attribute__((target("avx2"), flatten))
+#endif
+#define LIGHTS2D_FLATTEN __attribute__((flatten))
+
+namespace Lights2D
+{
+    namespace Simd
+    {
+        // GCC ignores vector_size with a template dependent size, so each width is spelled out
+        template <int N>
+        struct Vectors;
+
+        template <>
+        struct Vectors<4>
+        {
+            typedef float Float __attribute__((vector_size(16)));
+            typedef int32_t Int __attribute__((vector_size(16)));
+        };
+
+        template <>
+        struct Vectors<8>
+        {
+            typedef float Float __attribute__((vector_size(32)));
+            typedef int32_t Int __attribute__((vector_size(32)));
+        };
+    }
+
+    template <int N>
+    struct PacketMask
+    {
+        // Each lane is all ones when true, and zero when false
+        typedef typename Simd::Vectors<N>::Int Native;
+        Native m;
+
+        PacketMask() : m(Native {}) {}
+        PacketMask(Native m) : m(m) {}
+        explicit PacketMask(bool value) : m(Native {} + (value ? -1 : 0)) {}
+
+        PacketMask operator&(const PacketMask& other) const { return m & other.m; }
+        PacketMask operator|(const PacketMask& other) const { return m | other.m; }
+        PacketMask operator~() const { return ~m; }
+
+        bool any() const
+        {
+            int32_t result = 0;
+            for (int i = 0; i < N; i++)
+                result |= m[i];
+            return result != 0;
+        }
+
+        bool operator[](int lane) const { return m[lane] != 0; }
+
+        void store(int32_t* destination) const { memcpy(destination, &m, sizeof(m)); }
+    };
+
+    template <int N>
+    struct Packet
+    {
+        typedef typename Simd::Vectors<N>::Float Native;
+        typedef PacketMask<N> Mask;
+        static constexpr int width = N;
+        Native v;
+
+        Packet() : v(Native {}) {}
+        Packet(float value) : v(Native {} + value) {}
+        Packet(Native v) : v(v) {}
+
+        static Packet load(const float* source)
+        {
+            Packet packet;
+            memcpy(&packet.v, source, sizeof(Native));
+            return packet;
+        }
+
+        static Packet lane_index()
+        {
+            Packet packet;
+            for (int i = 0; i < N; i++)
+                packet.v[i] = static_cast<float>(i);
+            return packet;
+        }
+
+        void store(float* destination) const { memcpy(destination, &v, sizeof(Native)); }
+        float operator[](int lane) const { return v[lane]; }
+
+        Packet operator-() const { return -v; }
+        Packet operator+(const Packet& other) const { return v + other.v; }
+        Packet operator-(const Packet& other) const { return v - other.v; }
+        Packet operator*(const Packet& other) const { return v * other.v; }
+        Packet operator/(const Packet& other) const { return v / other.v; }
+        void operator+=(const Packet& other) { v += other.v; }
+        void operator-=(const Packet& other) { v -= other.v; }
+        void operator*=(const Packet& other) { v *= other.v; }
+        void operator/=(const Packet& other) { v /= other.v; }
+
+        friend Packet operator+(float a, const Packet& b) { return a + b.v; }
+        friend Packet operator-(float a, const Packet& b) { return a - b.v; }
+        friend Packet operator*(float a, const Packet& b) { return a * b.v; }
+        friend Packet operator/(float a, const Packet& b) { return a / b.v; }
+
+        Mask operator<(const Packet& other) const { return v < other.v; }
+        Mask operator>(const Packet& other) const { return v > other.v; }
+        Mask operator<=(const Packet& other) const { return v <= other.v; }
+        Mask operator>=(const Packet& other) const { return v >= other.v; }
+    };
+
+    typedef Packet<4> Float4;
+    typedef Packet<8> Float8;
+
+    // Packet versions of the scalar math used by the SDF functions, found by argument dependent lookup
+
+    template <int N>
+    static Packet<N> select(const PacketMask<N>& mask, const Packet<N>& a, const Packet<N>& b)
+    {
+        return mask.m ? a.v : b.v;
+    }
+
+    template <int N>
+    static Packet<N> min(const Packet<N>& a, const Packet<N>& b) { return a.v < b.v ? a.v : b.v; }
+
+    template <int N>
+    static Packet<N> max(const Packet<N>& a, const Packet<N>& b) { return a.v > b.v ? a.v : b.v; }
+
+    template <int N>
+    static Packet<N> min(const Packet<N>& a, float b) { return min(a, Packet<N>(b)); }
+
+    template <int N>
+    static Packet<N> max(const Packet<N>& a, float b) { return max(a, Packet<N>(b)); }
+
+    template <int N>
+    static Packet<N> abs(const Packet<N>& a) { return a.v < 0.0f ? -a.v : a.v; }
+
+    template <int N>
+    static Packet<N> clamp(const Packet<N>& a, float min_value, float max_value)
+    {
+        return min(max(a, min_value), max_value);
+    }
+
+    template <int N>
+    static Packet<N> mix(const Packet<N>& a, const Packet<N>& b, const Packet<N>& t) { return a + (b - a) * t; }
+
+    template <int N>
+    static Packet<N> sign(const Packet<N>& a)
+    {
+        // Same convention as Utils::sign, 1 for positive values and 0 otherwise
+        return select(a > Packet<N>(0.0f), Packet<N>(1.0f), Packet<N>(0.0f));
+    }
+
+    template <int N>
+    static Packet<N> sqrt(const Packet<N>& a)
+    {
+        // Written per lane, it's vectorized into a single sqrtps / vsqrtps (requires -fno-math-errno)
+        Packet<N> result;
+        for (int i = 0; i < N; i++)
+            result.v[i] = __builtin_sqrtf(a.v[i]);
+        return result;
+    }
+
+    namespace Simd
+    {
+        template <typename T>
+        struct is_packet : std::false_type {};
+
+        template <int N>
+        struct is_packet<Packet<N>> : std::true_type {};
+
+        static bool cpu_supports_avx2()
+        {
+#ifdef LIGHTS2D_SIMD_DISPATCH
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        }
+    }
+}
+#endif
@@ -0,0 +1,135 @@
+#pragma once
+#ifndef TILES_H
+#define TILES_H
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+namespace Lights2D
+{
+    struct Tile
+    {
+        /*
+        Rectangle of pixels rendered as a single task. Bounds are half open,
+        the tile covers [x0, x1) x [y0, y1)
+        */
+        uint32_t x0, y0, x1, y1;
+
+        uint32_t width() const { return x1 - x0; }
+        uint32_t height() const { return y1 - y0; }
+        uint32_t area() const { return width() * height(); }
+    };
+
+    namespace Tiles
+    {
+        static uint32_t part_1_by_1(uint32_t v)
+        {
+            // Spreads the lower 16 bits of v, leaving a zero bit between each of them
+            v &= 0x0000ffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        }
+
+        static uint32_t morton_encode(uint32_t x, uint32_t y)
+        {
+            return part_1_by_1(x) | (part_1_by_1(y) << 1);
+        }
+
+        static std::vector<Tile> generate(uint32_t width, uint32_t height, uint32_t tile_size)
+        {
+            /*
+            Splits the frame in tiles of tile_size x tile_size pixels. Tiles in the last
+            row and column are clipped to the frame. The tiles are sorted in Morton (Z) order,
+            so tiles that are close in the vector are also close in the frame. When the
+            scheduler splits the vector in ranges, each worker gets a compact region
+            */
+            tile_size = std::max(tile_size, 1u);
+            uint32_t tiles_x = (width + tile_size - 1) / tile_size;
+            uint32_t tiles_y = (height + tile_size - 1) / tile_size;
+
+            std::vector<std::pair<uint32_t, Tile>> ordered;
+            ordered.reserve(tiles_x * tiles_y);
+            for (uint32_t ty = 0; ty < tiles_y; ty++)
+            {
+                for (uint32_t tx = 0; tx < tiles_x; tx++)
+                {
+                    Tile tile;
+                    tile.x0 = tx * tile_size;
+                    tile.y0 = ty * tile_size;
+                    tile.x1 = std::min(tile.x0 + tile_size, width);
+                    tile.y1 = std::min(tile.y0 + tile_size, height);
+                    ordered.push_back({morton_encode(tx, ty), tile});
+                }
+            }
+
+            std::sort(
+                ordered.begin(),
+                ordered.end(),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+
+            std::vector<Tile> tiles;
+            tiles.reserve(ordered.size());
+            for (const auto& pair : ordered)
+                tiles.push_back(pair.second);
+            return tiles;
+        }
+
+        static std::vector<Tile> generate(const Tile& region, uint32_t tile_size)
+        {
+            // Tiles of a part of the frame, in frame coordinates
+            std::vector<Tile> tiles = generate(region.width(), region.height(), tile_size);
+            for (Tile& tile : tiles)
+                tile = { tile.x0 + region.x0, tile.y0 + region.y0, tile.x1 + region.x0, tile.y1 + region.y0 };
+            return tiles;
+        }
+
+        static std::vector<Tile> disjoint(const std::vector<Tile>& rectangles, const Tile& bounds)
+        {
+            /*
+            Rectangles covering the same pixels as the union of rectangles clipped to bounds,
+            without overlapping, so no pixel is rendered twice. The edges of the rectangles
+            cut the frame in horizontal slabs, and the x intervals that cover a slab merge
+            into the rectangles of the slab
+            */
+            std::vector<Tile> clipped;
+            std::vector<uint32_t> edges;
+            for (const Tile& rectangle : rectangles)
+            {
+                Tile tile = {
+                    std::max(rectangle.x0, bounds.x0), std::max(rectangle.y0, bounds.y0),
+                    std::min(rectangle.x1, bounds.x1), std::min(rectangle.y1, bounds.y1) };
+                if (tile.x0 >= tile.x1 || tile.y0 >= tile.y1)
+                    continue;
+                clipped.push_back(tile);
+                edges.push_back(tile.y0);
+                edges.push_back(tile.y1);
+            }
+            std::sort(edges.begin(), edges.end());
+            edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+            std::vector<Tile> result;
+            std::vector<std::pair<uint32_t, uint32_t>> intervals;
+            for (size_t i = 0; i + 1 < edges.size(); i++)
+            {
+                uint32_t y0 = edges[i], y1 = edges[i + 1];
+                intervals.clear();
+                for (const Tile& tile : clipped)
+                    if (tile.y0 <= y0 && tile.y1 >= y1)
+                        intervals.push_back({ tile.x0, tile.x1 });
+                std::sort(intervals.begin(), intervals.end());
+                for (size_t j = 0; j < intervals.size();)
+                {
+                    uint32_t x0 = intervals[j].first, x1 = intervals[j].second;
+                    for (j++; j < intervals.size() && intervals[j].first <= x1; j++)
+                        x1 = std::max(x1, intervals[j].second);
+                    result.push_back({ x0, y0, x1, y1 });
+                }
+            }
+            return result;
+        }
+    }
+}
+#endif
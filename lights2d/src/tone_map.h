@@ -0,0 +1,140 @@
+#pragma once
+#ifndef TONE_MAP_H
+#define TONE_MAP_H
+
+#include <stdint.h>
+#include <math.h>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <tbb/parallel_for.h>
+#include "image.h"
+#include "framebuffer.h"
+#include "sampler.h"
+
+namespace Lights2D
+{
+    class ToneMapper
+    {
+        /*
+        Output stage, converts the float radiance of a Framebuffer into an 8 or 16 bit
+        image. It applies the exposure, clamps to [0, 1], encodes with the gamma curve,
+        optionally adds blue noise dither of one quantization step, and rounds.
+        The gamma curve is a LUT indexed by sqrt(value) with linear interpolation. In
+        that domain the curve is almost a straight line, so a small LUT is also exact
+        enough for 16 bit output, and sqrt vectorizes, unlike powf
+        */
+        public:
+            ToneMapper(float exposure = 1.0f, float gamma = 2.2f, bool dither = false)
+                :   _exposure(exposure),
+                    _dither(dither),
+                    _lut(lut_size + 1)
+                    {
+                        for (uint32_t i = 0; i <= lut_size; i++)
+                        {
+                            float root = static_cast<float>(i) / lut_size;
+                            _lut[i] = powf(root * root, 1.0f / gamma);
+                        }
+                    }
+
+            // Maps the whole frame, splitting the rows between the workers of the current arena.
+            // origin is the position of the framebuffer in the frame when it holds only a part of
+            // it, the dither pattern follows the frame, so parts map to the same pixels as the whole
+            template <typename T>
+            void operator()(const Framebuffer& framebuffer, BasicImage<T>& image, uint32_t origin_x = 0, uint32_t origin_y = 0) const
+            {
+                tbb::parallel_for(
+                    tbb::blocked_range<uint32_t>(0, framebuffer.height, 8),
+                    [&](const tbb::blocked_range<uint32_t>& rows) {
+                        map_rows(framebuffer, image, rows.begin(), rows.end(), origin_x, origin_y);
+                    });
+            }
+
+            template <typename T>
+            void map_rows(const Framebuffer& framebuffer, BasicImage<T>& image, uint32_t y0, uint32_t y1, uint32_t origin_x = 0, uint32_t origin_y = 0) const
+            {
+                map_rect(framebuffer, image, 0, framebuffer.width, y0, y1, origin_x, origin_y);
+            }
+
+            // Maps the pixels of [x_begin, x_end) x [y0, y1) only, the rest of image is left as it is
+            template <typename T>
+            void map_rect(const Framebuffer& framebuffer, BasicImage<T>& image, uint32_t x_begin, uint32_t x_end, uint32_t y0, uint32_t y1,
+                uint32_t origin_x = 0, uint32_t origin_y = 0) const
+            {
+                constexpr float max_value = static_cast<float>(std::numeric_limits<T>::max());
+                constexpr uint32_t block = 64;
+                constexpr uint32_t noise_size = BlueNoiseSampler::tile_size;
+
+                // Channels of a block, first as positions in the LUT, then as output levels
+                alignas(32) float scales[block];
+                alignas(32) float channels[3][block];
+
+                for (uint32_t y = y0; y < y1; y++)
+                {
+                    for (uint32_t x0 = x_begin; x0 < x_end; x0 += block)
+                    {
+                        uint32_t count = std::min(block, x_end - x0);
+                        uint32_t first = x0 + y * framebuffer.width;
+                        const float* sums[3] = { &framebuffer.r[first], &framebuffer.g[first], &framebuffer.b[first] };
+                        const uint32_t* samples = &framebuffer.samples[first];
+
+                        // Vectorized: normalization, exposure, clamp and sqrt. Pixels without samples have a zero sum,
+                        // the max keeps 0 for NaN by taking it as second operand
+                        for (uint32_t i = 0; i < count; i++)
+                            scales[i] = _exposure / static_cast<float>(std::max(samples[i], 1u));
+
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                            for (uint32_t i = 0; i < count; i++)
+                            {
+                                float value = std::min(std::max(0.0f, sums[c][i] * scales[i]), 1.0f);
+                                channels[c][i] = __builtin_sqrtf(value) * lut_size;
+                            }
+                        }
+
+                        // Scalar: the LUT lookups are gathers. A saturated channel is at lut_size, it
+                        // interpolates the last interval with t = 1 instead of reading past the LUT
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                            for (uint32_t i = 0; i < count; i++)
+                            {
+                                float position = channels[c][i];
+                                uint32_t index = std::min(static_cast<uint32_t>(position), lut_size - 1);
+                                float t = position - index;
+                                channels[c][i] = (_lut[index] + (_lut[index + 1] - _lut[index]) * t) * max_value + 0.5f;
+                            }
+                        }
+
+                        if (_dither)
+                        {
+                            // Each channel reads the tile at a different offset
+                            const std::vector<uint32_t>& noise = BlueNoiseSampler::tile();
+                            for (uint32_t c = 0; c < 3; c++)
+                            {
+                                const uint32_t* row = &noise[((origin_y + y + c * 41) % noise_size) * noise_size];
+                                for (uint32_t i = 0; i < count; i++)
+                                    channels[c][i] += Hash::to_float(row[(origin_x + x0 + i + c * 23) % noise_size]) - 0.5f;
+                            }
+                        }
+
+                        for (uint32_t i = 0; i < count; i++)
+                        {
+                            image.buffer[first + i] = Color<T>(
+                                static_cast<T>(std::min(std::max(channels[0][i], 0.0f), max_value)),
+                                static_cast<T>(std::min(std::max(channels[1][i], 0.0f), max_value)),
+                                static_cast<T>(std::min(std::max(channels[2][i], 0.0f), max_value)));
+                        }
+                    }
+                }
+            }
+
+        private:
+            // Below 0.001 steps of 8 bit and 0.25 steps of 16 bit from powf
+            static constexpr uint32_t lut_size = 4096;
+
+            float _exposure;
+            bool _dither;
+            std::vector<float> _lut;
+    };
+}
+#endif
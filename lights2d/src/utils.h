@@ -2,34 +2,16 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <math.h>
-#include <random>
 #include "vec2.h"
+#include "simd.h"
+#include "dual.h"
 
 #define PI 3.141592653589794626433832f
 
 namespace Lights2D
 {
-    static thread_local std::uniform_real_distribution<float> distribution(0.0, 1.0);
-    static thread_local std::mt19937 generator;
     namespace Utils
     {
-
-
-        static void random_seed(uint32_t seed)
-        {
-            generator.seed(seed);
-        }
-        static float random()
-        {
-    		return distribution(generator);
-        }
-
-        static Vec2 random_norm_vec2()
-        {
-            float angle = 2.0f * PI * Utils::random();
-            return {cos(angle), sin(angle)};
-        }
-
         static Color<float> gamma_log(const Color<float>& color)
         {
             constexpr float inv_gamma = 1.0f / 2.2f;
@@ -131,7 +113,24 @@ namespace Lights2D
             return a > b ? a : b;
         }
 
-        static Vec2 max(Vec2 a, Vec2 b)
+        static float abs(float a)
+        {
+            return std::abs(a);
+        }
+
+        static float sqrt(float a)
+        {
+            return std::sqrt(a);
+        }
+
+        static float select(bool condition, float a, float b)
+        {
+            // Scalar version of the packet select, both branches are already evaluated
+            return condition ? a : b;
+        }
+
+        template <typename T>
+        static Vector2<T> max(Vector2<T> a, Vector2<T> b)
         {
             return {
                 max(a.x, b.x),
@@ -139,7 +138,8 @@ namespace Lights2D
             };
         }
 
-        static Vec2 max(Vec2 a, float v)
+        template <typename T>
+        static Vector2<T> max(Vector2<T> a, float v)
         {
             return {
                 max(a.x, v),
@@ -147,7 +147,8 @@ namespace Lights2D
             };
         }
 
-        static Vec2 min(Vec2 a, Vec2 b)
+        template <typename T>
+        static Vector2<T> min(Vector2<T> a, Vector2<T> b)
         {
             return {
                 min(a.x, b.x),
@@ -156,11 +157,12 @@ namespace Lights2D
         }
 
 
-        static Vec2 abs(Vec2 a)
+        template <typename T>
+        static Vector2<T> abs(Vector2<T> a)
         {
             return {
-                std::abs(a.x),
-                std::abs(a.y)
+                abs(a.x),
+                abs(a.y)
             };
         }
 
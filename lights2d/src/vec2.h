@@ -2,90 +2,105 @@
 #ifndef VEC2_H
 #define VEC2_H
 #include <math.h>
+#include <cmath>
+#include <type_traits>
 
 namespace Lights2D
 {
 
-    struct Vec2
+    template <typename T>
+    struct Vector2
     {
+        /*
+        T is float for the regular renderer. The SDF functions are also evaluated
+        with packets of floats, Vector2<Packet<N>>, to march several rays at once
+        */
         public:
-            float x, y;
+            T x, y;
 
         public:
-            Vec2(float x, float y) : x(x), y(y) {}
-            explicit Vec2(float v) : x(v), y(v) {}
-            Vec2() : x(0), y(0) {}
-
-            static float length(Vec2 vec) { return std::sqrt(vec.x * vec.x + vec.y * vec.y); }
-            static float length_squared(Vec2 vec) {return vec.x * vec.x + vec.y * vec.y; }
-            static Vec2 normalize(Vec2 vec) {return vec * (1.0f / length(vec)); }
-            static float dot(Vec2 a, Vec2 b) {return a.x * b.x + a.y * b.y; }
-            static Vec2 flip(const Vec2 a) { return {-a.x, -a.y}; }
+            Vector2(T x, T y) : x(x), y(y) {}
+            explicit Vector2(T v) : x(v), y(v) {}
+            Vector2() : x(0), y(0) {}
+
+            // Broadcasts a Vec2 to every lane of a packet
+            template <typename U, typename = std::enable_if_t<!std::is_same_v<U, T> && std::is_convertible_v<U, T>>>
+            Vector2(const Vector2<U>& other) : x(other.x), y(other.y) {}
+
+            static T length(Vector2 vec)
+            {
+                using std::sqrt;
+                return sqrt(vec.x * vec.x + vec.y * vec.y);
+            }
+            static T length_squared(Vector2 vec) {return vec.x * vec.x + vec.y * vec.y; }
+            static Vector2 normalize(Vector2 vec) {return vec * (1.0f / length(vec)); }
+            static T dot(Vector2 a, Vector2 b) {return a.x * b.x + a.y * b.y; }
+            static Vector2 flip(const Vector2 a) { return {-a.x, -a.y}; }
             // Operator overloading
-            Vec2 operator +(const Vec2& other) const
+            Vector2 operator +(const Vector2& other) const
             {
                 return {x + other.x, y + other.y};
             }
 
-            void operator +=(const Vec2& other)
+            void operator +=(const Vector2& other)
             {
                 x += other.x;
                 y += other.y;
             }
 
-            Vec2 operator -(const Vec2& other) const
+            Vector2 operator -(const Vector2& other) const
             {
                 return {x - other.x, y - other.y};
             }
 
-            void operator -=(const Vec2& other)
+            void operator -=(const Vector2& other)
             {
                 x -= other.x;
                 y -= other.y;
             }
 
-            Vec2 operator*(const Vec2& other) const
+            Vector2 operator*(const Vector2& other) const
             {
                 return {x * other.x, y * other.y};
-            }   
+            }
 
-            void operator*=(const Vec2& other)
+            void operator*=(const Vector2& other)
             {
                 x *= other.x;
                 y *= other.y;
             }
 
 
-            Vec2 operator+(float value) const
+            Vector2 operator+(const T& value) const
             {
                 return {x + value, y + value};
-            }   
+            }
 
-            void operator+=(float value)
+            void operator+=(const T& value)
             {
                 x += value;
                 y += value;
             }
 
 
-            Vec2 operator-(float value) const
+            Vector2 operator-(const T& value) const
             {
                 return {x - value, y - value};
-            }   
+            }
 
-            void operator-=(float value)
+            void operator-=(const T& value)
             {
                 x -= value;
                 y -= value;
             }
 
 
-            Vec2 operator*(float value) const
+            Vector2 operator*(const T& value) const
             {
                 return {x * value, y * value};
-            }   
+            }
 
-            void operator*=(float value)
+            void operator*=(const T& value)
             {
                 x *= value;
                 y *= value;
@@ -93,5 +108,7 @@ namespace Lights2D
 
 
     };
+
+    typedef Vector2<float> Vec2;
 }
-#endif
\ No newline at end of file
+#endif
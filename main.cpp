@@ -1,8 +1,12 @@
 #include "lights2d/lights2d.h"
 #include "scenes.h"
+#include "benchmarks.h"
+#include <cstdio>
+#include <cmath>
 #include <filesystem>
 #include <iostream>
 #include <string>
+#include <thread>
 
 // STB specific required definitions and include
 #define STB_IMAGE_IMPLEMENTATION
@@ -11,9 +15,7 @@
 
 using namespace Lights2D;
 
-static uint32_t current_image_index = 0;
-
-static void render_frame_callback(std::shared_ptr<Image> image_buffer,
+static bool render_frame_callback(std::shared_ptr<Image> image_buffer,
     uint32_t frame_index)
 {
     std::cout << "Frame " << frame_index << " rendered" << std::endl;
@@ -25,7 +27,7 @@ static void render_frame_callback(std::shared_ptr<Image> image_buffer,
         std::filesystem::create_directory(filepath);
     }
 
-    filepath += std::to_string(current_image_index++ + frame_index);
+    filepath += std::to_string(frame_index);
     filepath += ".png";
 
     bool status = stbi_write_png(
@@ -34,81 +36,744 @@ static void render_frame_callback(std::shared_ptr<Image> image_buffer,
         image_buffer->height, 3,
         &image_buffer->buffer[0],
         image_buffer->width * 3);
+    return status;
 }
 
-void parse_arguments(int argc, char* argv[],
-    uint32_t& width,
-    uint32_t& height,
-    uint32_t& samples_per_pixel,
-    uint32_t& ray_tracing_depth,
-    uint32_t& ray_marching_iterations)
+static void march_counters_callback(const MarchCounters& counters, uint32_t frame_index)
+{
+    uint64_t rays = std::max<uint64_t>(counters.rays, 1);
+    std::cout << "Frame " << frame_index << " marched " << counters.rays << " rays, " << counters.iterations << " iterations ("
+              << static_cast<double>(counters.iterations) / rays << " per ray), " << counters.culled_rays
+              << " ended by the scene bounds, " << counters.saved_iterations << " iterations saved, " << counters.exhausted_rays
+              << " out of iterations, " << counters.failed_steps << " over-relaxed steps taken back" << std::endl;
+}
+
+static void sample_count_callback(std::shared_ptr<Image> image_buffer,
+    uint32_t frame_index)
+{
+    // Written next to the frame, white pixels took every sample
+    std::string filepath = PROJECT_DIRECTORY_PATH;
+    filepath += "/renders/";
+
+    if (!std::filesystem::exists(filepath)) {
+        std::filesystem::create_directory(filepath);
+    }
+
+    filepath += std::to_string(frame_index);
+    filepath += "_samples.png";
+
+    stbi_write_png(
+        filepath.c_str(),
+        image_buffer->width,
+        image_buffer->height, 3,
+        &image_buffer->buffer[0],
+        image_buffer->width * 3);
+}
+
+// Creates directory and its parents, false with a message when it can't
+static bool create_output_directory(const std::filesystem::path& directory)
+{
+    std::error_code error;
+    if (directory.empty() || std::filesystem::is_directory(directory, error))
+        return true;
+    if (!std::filesystem::create_directories(directory, error) && !std::filesystem::is_directory(directory, error)) {
+        std::cerr << "Can't create the directory " << directory.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static std::string renders_directory()
+{
+    std::string directory = PROJECT_DIRECTORY_PATH;
+    directory += "/renders/";
+    if (!std::filesystem::exists(directory)) {
+        std::filesystem::create_directory(directory);
+    }
+    return directory;
+}
+
+struct Range {
+    // Part index of count parts, given as "index/count"
+    uint32_t index = 0;
+    uint32_t count = 1;
+};
+
+static bool merge_partial_frames(const std::vector<std::string>& filepaths, const FrameConfig& frame_config)
+{
+    /*
+    Adds the partial frames written by --sample-split, in order of their sample ranges,
+    and tone maps the result into the first path. The sums are fixed point, so the PNG
+    has the same bits however the samples were split
+    */
+    if (filepaths.size() < 2) {
+        std::cerr << "--merge needs an output path and at least one partial frame" << std::endl;
+        return false;
+    }
+
+    std::vector<PartialFrame> parts(filepaths.size() - 1);
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (!parts[i].read(filepaths[i + 1])) {
+            std::cerr << "Can't read partial frame " << filepaths[i + 1] << std::endl;
+            return false;
+        }
+    }
+    std::sort(parts.begin(), parts.end(), [](const PartialFrame& a, const PartialFrame& b) {
+        return a.sample_begin < b.sample_begin;
+    });
+
+    PartialFrame merged = parts[0];
+    for (size_t i = 1; i < parts.size(); i++) {
+        if (!merged.merge(parts[i])) {
+            std::cerr << "Partial frames don't match: sizes differ, sample ranges overlap or leave a gap, or cover more than "
+                      << FixedPoint::max_samples << " samples" << std::endl;
+            return false;
+        }
+    }
+    std::cout << "Merged samples " << merged.sample_begin << " to " << merged.sample_end << std::endl;
+
+    Framebuffer framebuffer(merged.width, merged.height);
+    merged.to_framebuffer(framebuffer);
+    Image image(merged.width, merged.height);
+    ToneMapper(frame_config.exposure, frame_config.gamma, frame_config.dither)(framebuffer, image);
+
+    return stbi_write_png(filepaths[0].c_str(), image.width, image.height, 3, &image.buffer[0], image.width * 3);
+}
+
+struct Arguments {
+    uint32_t width = 128;
+    uint32_t height = 128;
+    uint32_t samples_per_pixel = 128;
+    uint32_t ray_tracing_depth = 6;
+    uint32_t ray_marching_iterations = 64;
+    uint32_t tile_size = 16;
+    uint32_t threads = 0;
+    uint32_t packet_width = 0;
+    std::string integrator = "split";
+    std::string engine = "mc";
+    uint32_t cascade_directions = 4;
+    float cascade_interval = 1.0f;
+    float grid_error = 0.0f;
+    uint32_t grid_megabytes = 64;
+    std::string sampler = "sobol";
+    uint32_t seed = 0;
+    float exposure = 1.0f;
+    bool dither = false;
+    float budget_ms = 0.0f;
+    uint32_t pass_samples = 8;
+    std::string checkpoint;
+    float checkpoint_interval = 60.0f;
+    uint32_t band_rows = 0;
+    float adaptive_tolerance = 0.0f;
+    uint32_t min_samples = 32;
+    uint32_t adaptive_round = 16;
+    bool sample_map = false;
+    bool march_stats = false;
+    bool scene_bounds = true;
+    float relaxation = 1.0f;
+    float hit_footprint = 0.0f;
+    float light_sampling = 0.0f;
+    float start_time = 0.0f;
+    float end_time = 0.5f;
+    float frames_per_second = 1.0f;
+    Range shard;
+    Range sample_split;
+    std::vector<std::string> merge;
+    std::string output = "png";
+    std::string output_path;
+    int png_level = 6;
+    std::string scene = "rainbow_sdf";
+    std::string scene_file;
+    std::string save_scene;
+    std::string benchmark;
+    bool type_erased = false;
+};
+
+void parse_arguments(int argc, char* argv[], Arguments& arguments)
 {
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
 
-        auto getValue = [&](uint32_t& out) {
+        auto getString = [&](std::string& out) {
             if (i + 1 < argc) {
-                out = static_cast<uint32_t>(std::stoi(argv[++i]));
+                out = argv[++i];
             } else {
                 std::cerr << "Missing value after " << arg << std::endl;
                 std::exit(EXIT_FAILURE);
             }
         };
 
+        auto getValue = [&](uint32_t& out) {
+            std::string value;
+            getString(value);
+            out = static_cast<uint32_t>(std::stoi(value));
+        };
+
+        auto getFloat = [&](float& out) {
+            std::string value;
+            getString(value);
+            out = std::stof(value);
+        };
+
+        auto getRange = [&](Range& out) {
+            std::string value;
+            getString(value);
+            size_t slash = value.find('/');
+            if (slash == std::string::npos) {
+                std::cerr << arg << " expects index/count, as 0/4" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            out.index = static_cast<uint32_t>(std::stoi(value.substr(0, slash)));
+            out.count = static_cast<uint32_t>(std::stoi(value.substr(slash + 1)));
+            if (out.count == 0 || out.index >= out.count) {
+                std::cerr << arg << " index must be below count" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        };
+
         if (arg == "--width")
-            getValue(width);
+            getValue(arguments.width);
         else if (arg == "--height")
-            getValue(height);
+            getValue(arguments.height);
         else if (arg == "--samples")
-            getValue(samples_per_pixel);
+            getValue(arguments.samples_per_pixel);
         else if (arg == "--depth")
-            getValue(ray_tracing_depth);
+            getValue(arguments.ray_tracing_depth);
         else if (arg == "--iterations")
-            getValue(ray_marching_iterations);
+            getValue(arguments.ray_marching_iterations);
+        else if (arg == "--tile")
+            getValue(arguments.tile_size);
+        else if (arg == "--threads")
+            getValue(arguments.threads);
+        else if (arg == "--packet")
+            getValue(arguments.packet_width);
+        else if (arg == "--integrator")
+            getString(arguments.integrator);
+        else if (arg == "--engine")
+            getString(arguments.engine);
+        else if (arg == "--cascade-directions")
+            getValue(arguments.cascade_directions);
+        else if (arg == "--cascade-interval")
+            getFloat(arguments.cascade_interval);
+        else if (arg == "--grid")
+            getFloat(arguments.grid_error);
+        else if (arg == "--grid-memory")
+            getValue(arguments.grid_megabytes);
+        else if (arg == "--adaptive")
+            getFloat(arguments.adaptive_tolerance);
+        else if (arg == "--min-samples")
+            getValue(arguments.min_samples);
+        else if (arg == "--round")
+            getValue(arguments.adaptive_round);
+        else if (arg == "--sample-map")
+            arguments.sample_map = true;
+        else if (arg == "--march-stats")
+            arguments.march_stats = true;
+        else if (arg == "--no-bounds")
+            arguments.scene_bounds = false;
+        else if (arg == "--relaxation")
+            getFloat(arguments.relaxation);
+        else if (arg == "--hit-footprint")
+            getFloat(arguments.hit_footprint);
+        else if (arg == "--light-sampling")
+            getFloat(arguments.light_sampling);
+        else if (arg == "--sampler")
+            getString(arguments.sampler);
+        else if (arg == "--seed")
+            getValue(arguments.seed);
+        else if (arg == "--exposure")
+            getFloat(arguments.exposure);
+        else if (arg == "--dither")
+            arguments.dither = true;
+        else if (arg == "--budget")
+            getFloat(arguments.budget_ms);
+        else if (arg == "--pass")
+            getValue(arguments.pass_samples);
+        else if (arg == "--output")
+            getString(arguments.output);
+        else if (arg == "--output-path")
+            getString(arguments.output_path);
+        else if (arg == "--png-level") {
+            uint32_t level;
+            getValue(level);
+            arguments.png_level = static_cast<int>(std::min(level, 9u));
+        }
+        else if (arg == "--checkpoint")
+            getString(arguments.checkpoint);
+        else if (arg == "--checkpoint-interval")
+            getFloat(arguments.checkpoint_interval);
+        else if (arg == "--bands")
+            getValue(arguments.band_rows);
+        else if (arg == "--region") {
+            // Regions keep the rest of an existing image, and frames here always start from a new one
+            std::cerr << arg << " re-renders pixels into an existing image, it's only available through FrameConfig::regions" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        else if (arg == "--start")
+            getFloat(arguments.start_time);
+        else if (arg == "--end")
+            getFloat(arguments.end_time);
+        else if (arg == "--fps")
+            getFloat(arguments.frames_per_second);
+        else if (arg == "--shard")
+            getRange(arguments.shard);
+        else if (arg == "--sample-split")
+            getRange(arguments.sample_split);
+        else if (arg == "--merge") {
+            // Output path and partial frames, until the end of the arguments
+            while (i + 1 < argc)
+                arguments.merge.push_back(argv[++i]);
+        }
+        else if (arg == "--scene")
+            getString(arguments.scene);
+        else if (arg == "--scene-file")
+            getString(arguments.scene_file);
+        else if (arg == "--save-scene")
+            getString(arguments.save_scene);
+        else if (arg == "--type-erased")
+            arguments.type_erased = true;
+        else if (arg == "--benchmark")
+            getString(arguments.benchmark);
         else {
             std::cerr << "Unknown argument: " << arg << std::endl;
             std::exit(EXIT_FAILURE);
         }
     }
+
+    // The frame times step by 1 / fps from the start until past the end
+    if (!(arguments.frames_per_second > 0.0f) || !std::isfinite(arguments.frames_per_second)) {
+        std::cerr << "--fps expects a frame rate above 0" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (!std::isfinite(arguments.start_time) || !std::isfinite(arguments.end_time) || arguments.end_time < arguments.start_time) {
+        std::cerr << "--start and --end expect finite times with the end not before the start" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
 }
 
-int main(int argc, char** argv)
+template <typename Visitor>
+static bool visit_scene(const Arguments& arguments, Visitor visitor)
 {
-    // Creates FrameConfiguration
-    uint32_t width = 128;
-    uint32_t height = 128;
-    uint32_t samples_per_pixel = 128;
-    uint32_t ray_tracing_depth = 6;
-    uint32_t ray_marching_iterations = 64;
+    /*
+    Calls visitor(scene) with the scene of --scene-file when there's one, or else with
+    the scene of scenes.h named by --scene. Returns false if neither can be found
+    */
+    if (!arguments.scene_file.empty()) {
+        BasicScene<PrimitiveScene> scene;
+        std::string error;
+        if (!PrimitiveScene::load(arguments.scene_file, scene, error)) {
+            std::cerr << "Can't load " << arguments.scene_file << ": " << error << std::endl;
+            return false;
+        }
+        visitor(scene);
+        return true;
+    }
+
+    bool found = false;
+    Scenes::for_each_scene([&](const char* name, const auto& scene) {
+        if (found || arguments.scene != name)
+            return;
+        found = true;
+        visitor(scene);
+    });
+    if (!found)
+        std::cerr << "Unknown scene: " << arguments.scene << std::endl;
+    return found;
+}
+
+static bool render_banded(const Arguments& arguments, const FrameConfig& frame_config)
+{
+    /*
+    A single frame, at the start time, rendered and written band by band, so it
+    never is in memory as a whole. The bands are appended to a PNG with the
+    streaming encoder, or to an RGB24 stream
+    */
+    if (arguments.output != "png" && arguments.output != "rgb24") {
+        std::cerr << "--bands writes png or rgb24 output" << std::endl;
+        return false;
+    }
+    if (arguments.sample_split.count > 1 || !arguments.checkpoint.empty() || arguments.budget_ms > 0.0f || arguments.sample_map || arguments.march_stats) {
+        std::cerr << "--bands can't be combined with --sample-split, --checkpoint, --budget, --sample-map or --march-stats" << std::endl;
+        return false;
+    }
+
+    PngConfig png_config;
+    png_config.level = arguments.png_level;
+    PngEncoder encoder(png_config);
+    std::unique_ptr<StreamSink> stream;
+    if (arguments.output == "png") {
+        std::string path = arguments.output_path.empty() ? renders_directory() + "0.png" : arguments.output_path;
+        if (!encoder.begin(path, frame_config.width, frame_config.height)) {
+            std::cerr << "Can't open the output " << path << std::endl;
+            return false;
+        }
+    } else {
+        stream = StreamSink::open_target(arguments.output_path.empty() ? "-" : arguments.output_path, StreamFormat::RGB24, arguments.frames_per_second);
+        if (!stream) {
+            std::cerr << "Can't open the output " << arguments.output_path << std::endl;
+            return false;
+        }
+    }
 
+    BandCallback on_band = [&](const Image& band, uint32_t y0) {
+        bool written = stream ? stream->write(band, 0) : encoder.write_rows(band.buffer, band.height);
+        if (!written)
+            std::cerr << "Can't write rows " << y0 << " to " << y0 + band.height << std::endl;
+        return written;
+    };
+
+    BandConfig band_config;
+    band_config.band_rows = arguments.band_rows;
+    bool rendered = false;
+    bool found = visit_scene(arguments, [&](const auto& scene) {
+        if (arguments.type_erased)
+            rendered = render_bands(frame_config, band_config, Scene(scene), arguments.start_time, on_band);
+        else
+            rendered = render_bands(frame_config, band_config, scene, arguments.start_time, on_band);
+    });
+    if (!found)
+        return false;
+    if (!stream && !encoder.finish())
+        return false;
+    std::cout << "Frame 0 rendered" << std::endl;
+    return rendered;
+}
+
+int main(int argc, char** argv)
+{
     // Parse command-line arguments
-    parse_arguments(
-        argc,
-        argv,
-        width,
-        height,
-        samples_per_pixel,
-        ray_tracing_depth,
-        ray_marching_iterations);
+    Arguments arguments;
+    parse_arguments(argc, argv, arguments);
+
+    // Frames streamed to stdout can't share it with the log, which goes to stderr instead
+    bool stream_output = arguments.output == "rgb24" || arguments.output == "y4m";
+    if (stream_output && (arguments.output_path.empty() || arguments.output_path == "-"))
+        std::cout.rdbuf(std::cerr.rdbuf());
 
     // Print final configuration
     std::cout << "Configuration:\n"
-              << "Width: " << width << "\n"
-              << "Height: " << height << "\n"
-              << "Samples per pixel: " << samples_per_pixel << "\n"
-              << "Ray tracing depth: " << ray_tracing_depth << "\n"
-              << "Ray marching iterations: " << ray_marching_iterations << "\n";
+              << "Width: " << arguments.width << "\n"
+              << "Height: " << arguments.height << "\n"
+              << "Samples per pixel: " << arguments.samples_per_pixel << "\n"
+              << "Ray tracing depth: " << arguments.ray_tracing_depth << "\n"
+              << "Ray marching iterations: " << arguments.ray_marching_iterations << "\n"
+              << "Scene: " << (arguments.scene_file.empty() ? arguments.scene : arguments.scene_file) << "\n"
+              << "Tile size: " << arguments.tile_size << "\n"
+              << "Threads: " << (arguments.threads == 0 ? std::string("all") : std::to_string(arguments.threads)) << "\n"
+              << "Engine: " << arguments.engine << "\n"
+              << "Integrator: " << arguments.integrator << "\n"
+              << "Sampler: " << arguments.sampler << "\n"
+              << "Adaptive tolerance: " << (arguments.adaptive_tolerance > 0.0f ? std::to_string(arguments.adaptive_tolerance) : std::string("off")) << "\n"
+              << "Packet width: " << (arguments.packet_width == 0 ? std::string("auto") : std::to_string(arguments.packet_width)) << "\n";
 
+    // Creates FrameConfiguration
     FrameConfig frame_config = {
-        width,
-        height,
-        samples_per_pixel,
-        ray_tracing_depth,
-        ray_marching_iterations,
+        arguments.width,
+        arguments.height,
+        arguments.samples_per_pixel,
+        arguments.ray_tracing_depth,
+        arguments.ray_marching_iterations,
         true // Enables sampling offset
     };
-    SequenceConfig sequence_config = { 0.0f, 0.5f, 1.0f };
-    render_sequence(frame_config, sequence_config, Scenes::rainbow_sdf, render_frame_callback);
+    frame_config.tile_size = arguments.tile_size;
+    frame_config.threads = arguments.threads;
+    frame_config.packet_width = arguments.packet_width;
+    frame_config.adaptive_tolerance = arguments.adaptive_tolerance;
+    frame_config.min_samples = arguments.min_samples;
+    frame_config.adaptive_round = arguments.adaptive_round;
+
+    frame_config.seed = arguments.seed;
+    frame_config.exposure = arguments.exposure;
+    frame_config.dither = arguments.dither;
+    frame_config.grid_error = arguments.grid_error;
+    frame_config.grid_megabytes = arguments.grid_megabytes;
+    frame_config.scene_bounds = arguments.scene_bounds;
+    frame_config.relaxation = arguments.relaxation;
+    frame_config.hit_footprint = arguments.hit_footprint;
+    frame_config.light_sampling = arguments.light_sampling;
+
+    if (!arguments.merge.empty())
+        return merge_partial_frames(arguments.merge, frame_config) ? 0 : EXIT_FAILURE;
+
+    // Converts the scene file, usually authored in the text form, to the binary form mapped at startup
+    if (!arguments.save_scene.empty()) {
+        BasicScene<PrimitiveScene> scene;
+        std::string error;
+        if (!PrimitiveScene::load(arguments.scene_file, scene, error)) {
+            std::cerr << "Can't load " << arguments.scene_file << ": " << error << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!scene.sdf.save(arguments.save_scene)) {
+            std::cerr << "Can't write " << arguments.save_scene << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Saved " << scene.sdf.object_count() << " objects, " << scene.sdf.primitive_count() << " primitives, "
+                  << scene.sdf.bytes() << " bytes" << std::endl;
+        return 0;
+    }
+
+    // Every render sums its samples in fixed point, which has room for a limited number of them
+    if (frame_config.samples > FixedPoint::max_samples) {
+        std::cerr << "--samples is at most " << FixedPoint::max_samples << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // --budget and --checkpoint render the single frame at --start, without the callbacks of render_sequence
+    if (arguments.budget_ms > 0.0f || !arguments.checkpoint.empty()) {
+        SequenceConfig single_frame = { arguments.start_time, arguments.end_time, arguments.frames_per_second };
+        if (arguments.sample_map || arguments.march_stats || arguments.type_erased || arguments.shard.count > 1 || single_frame.frame_count() > 1) {
+            std::cerr << "--budget and --checkpoint render a single frame, without --sample-map, --march-stats, --type-erased, --shard "
+                      << "or an --end and --fps giving more than one frame" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Each process of a sample split takes a contiguous range of the sample indices of every frame
+    bool sample_split = arguments.sample_split.count > 1;
+    if (sample_split) {
+        if (arguments.adaptive_tolerance > 0.0f) {
+            std::cerr << "--sample-split needs every pixel to take its whole range, it can't be adaptive" << std::endl;
+            return EXIT_FAILURE;
+        }
+        // Only render_sequence hands out the partial frames, the single frame modes would write nothing
+        if (arguments.budget_ms > 0.0f || !arguments.checkpoint.empty()) {
+            std::cerr << "--sample-split writes partial frames of a sequence, it can't be combined with --budget or --checkpoint" << std::endl;
+            return EXIT_FAILURE;
+        }
+        uint64_t samples = frame_config.samples;
+        frame_config.sample_begin = static_cast<uint32_t>(samples * arguments.sample_split.index / arguments.sample_split.count);
+        frame_config.sample_end = static_cast<uint32_t>(samples * (arguments.sample_split.index + 1) / arguments.sample_split.count);
+    }
+
+    if (arguments.sampler == "pcg")
+        frame_config.sampler = SamplerType::PCG;
+    else if (arguments.sampler == "sobol")
+        frame_config.sampler = SamplerType::Sobol;
+    else if (arguments.sampler == "r2")
+        frame_config.sampler = SamplerType::R2;
+    else if (arguments.sampler == "bluenoise")
+        frame_config.sampler = SamplerType::BlueNoise;
+    else {
+        std::cerr << "Unknown sampler: " << arguments.sampler << " (pcg, sobol, r2 or bluenoise)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Without uniform rays, what the lights don't cover would never be sampled
+    if (arguments.light_sampling < 0.0f || arguments.light_sampling >= 1.0f) {
+        std::cerr << "--light-sampling is the fraction of rays sent toward the lights, at least 0 and below 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (arguments.integrator == "split")
+        frame_config.integrator = Integrator::Splitting;
+    else if (arguments.integrator == "path")
+        frame_config.integrator = Integrator::PathTracing;
+    else {
+        std::cerr << "Unknown integrator: " << arguments.integrator << " (split or path)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (arguments.engine == "mc")
+        frame_config.engine = Engine::MonteCarlo;
+    else if (arguments.engine == "cascades") {
+        frame_config.engine = Engine::RadianceCascades;
+        frame_config.cascade_directions = arguments.cascade_directions;
+        frame_config.cascade_interval = arguments.cascade_interval;
+        if (arguments.budget_ms > 0.0f || !arguments.checkpoint.empty() || sample_split) {
+            std::cerr << "--engine cascades renders a frame at once, without --budget, --checkpoint or --sample-split" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } else {
+        std::cerr << "Unknown engine: " << arguments.engine << " (mc or cascades)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (arguments.benchmark == "tiles") {
+        uint32_t max_threads = arguments.threads == 0 ? std::max(64u, std::thread::hardware_concurrency()) : arguments.threads;
+        Benchmarks::tile_scheduling(frame_config, max_threads);
+        return 0;
+    } else if (arguments.benchmark == "sdf") {
+        Benchmarks::sdf_throughput();
+        return 0;
+    } else if (arguments.benchmark == "dispatch") {
+        Benchmarks::sdf_dispatch(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "normals") {
+        Benchmarks::normals(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "integrators") {
+        Benchmarks::integrators(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "adaptive") {
+        Benchmarks::adaptive_sampling(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "samplers") {
+        Benchmarks::samplers(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "output") {
+        Benchmarks::output_stage(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "progressive") {
+        Benchmarks::progressive(frame_config, arguments.pass_samples);
+        return 0;
+    } else if (arguments.benchmark == "sequence") {
+        // Encodes the PNG in memory, so the benchmark doesn't depend on the disk
+        Benchmarks::sequence_pipelining(frame_config, [](std::shared_ptr<Image> image, uint32_t) {
+            size_t bytes = 0;
+            stbi_write_png_to_func([](void* context, void*, int size) { *static_cast<size_t*>(context) += size; },
+                &bytes, image->width, image->height, 3, &image->buffer[0], image->width * 3);
+        });
+        return 0;
+    } else if (arguments.benchmark == "throughput") {
+        Benchmarks::sequence_throughput(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "sinks") {
+        // A PNG file per frame, as render_frame_callback writes them, in the temporary directory
+        Benchmarks::output_sinks(frame_config, [](std::shared_ptr<Image> image, uint32_t frame_index) {
+            std::string filepath = (std::filesystem::temp_directory_path() / ("lights2d_benchmark_" + std::to_string(frame_index) + ".png")).string();
+            stbi_write_png(filepath.c_str(), image->width, image->height, 3, &image->buffer[0], image->width * 3);
+            std::filesystem::remove(filepath);
+        });
+        return 0;
+    } else if (arguments.benchmark == "png") {
+        Benchmarks::png_encoding(frame_config, [](const Image& image) {
+            size_t bytes = 0;
+            stbi_write_png_to_func([](void* context, void*, int size) { *static_cast<size_t*>(context) += size; },
+                &bytes, image.width, image.height, 3, &image.buffer[0], image.width * 3);
+            return bytes;
+        });
+        return 0;
+    } else if (arguments.benchmark == "primitives") {
+        Benchmarks::primitive_scenes(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "bounds") {
+        Benchmarks::scene_bounds(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "lights") {
+        Benchmarks::light_sampling(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "tracing") {
+        Benchmarks::sphere_tracing(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "program") {
+        Benchmarks::sdf_program(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "grid") {
+        Benchmarks::distance_grid(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "cascades") {
+        Benchmarks::radiance_cascades(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "regions") {
+        Benchmarks::regions(frame_config);
+        return 0;
+    } else if (arguments.benchmark == "packets") {
+        Benchmarks::packet_marching(frame_config);
+        return 0;
+    } else if (!arguments.benchmark.empty()) {
+        std::cerr << "Unknown benchmark: " << arguments.benchmark << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    SequenceConfig sequence_config = { arguments.start_time, arguments.end_time, arguments.frames_per_second };
+    sequence_config.shard_index = arguments.shard.index;
+    sequence_config.shard_count = arguments.shard.count;
+
+    if (arguments.band_rows > 0)
+        return render_banded(arguments, frame_config) ? 0 : EXIT_FAILURE;
+
+    // Frames go to a PNG each, with the parallel encoder or stb, or to a stream or raw sequence file sink.
+    // A frame that can't be written doesn't stop the others, but the process fails at the end
+    bool write_failed = false;
+    FrameRenderCallback on_render = [&write_failed](std::shared_ptr<Image> image, uint32_t frame_index) {
+        if (!render_frame_callback(image, frame_index)) {
+            std::cerr << "Can't write frame " << frame_index << std::endl;
+            write_failed = true;
+        }
+    };
+    std::shared_ptr<FrameSink> sink;
+    if (arguments.output == "png") {
+        PngConfig png_config;
+        png_config.level = arguments.png_level;
+        std::string directory = arguments.output_path.empty() ? renders_directory() : arguments.output_path + "/";
+        if (!create_output_directory(directory))
+            return EXIT_FAILURE;
+        sink = std::make_shared<PngSink>(directory, png_config);
+    } else if (stream_output) {
+        StreamFormat format = arguments.output == "y4m" ? StreamFormat::Y4M : StreamFormat::RGB24;
+        std::string target = arguments.output_path.empty() ? "-" : arguments.output_path;
+        if (target != "-" && target.rfind("fd:", 0) != 0 && !create_output_directory(std::filesystem::path(target).parent_path()))
+            return EXIT_FAILURE;
+        sink = StreamSink::open_target(target, format, arguments.frames_per_second);
+    } else if (arguments.output == "raw") {
+        std::string path = arguments.output_path.empty() ? renders_directory() + "sequence.l2rs" : arguments.output_path;
+        if (!create_output_directory(std::filesystem::path(path).parent_path()))
+            return EXIT_FAILURE;
+        auto writer = std::make_shared<RawSequenceWriter>(path, frame_config.width, frame_config.height,
+            sequence_config.frame_count(), arguments.frames_per_second);
+        if (writer->is_open())
+            sink = writer;
+    } else if (arguments.output != "stb") {
+        std::cerr << "Unknown output: " << arguments.output << " (png, stb, rgb24, y4m or raw)" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (arguments.output != "stb") {
+        if (!sink) {
+            std::cerr << "Can't open the output " << arguments.output_path << std::endl;
+            return EXIT_FAILURE;
+        }
+        on_render = [sink, &write_failed](std::shared_ptr<Image> image, uint32_t frame_index) {
+            if (!sink->write(*image, frame_index)) {
+                std::cerr << "Can't write frame " << frame_index << std::endl;
+                write_failed = true;
+            }
+            std::cout << "Frame " << frame_index << " rendered" << std::endl;
+        };
+    }
+
+    // With a sample split, frames are written as partial frames for --merge instead of images
+    PartialFrameCallback on_partial;
+    if (sample_split) {
+        uint32_t part = arguments.sample_split.index;
+        on_render = [part](std::shared_ptr<Image>, uint32_t frame_index) {
+            std::cout << "Frame " << frame_index << " part " << part << " rendered" << std::endl;
+        };
+        on_partial = [part, &write_failed](std::shared_ptr<const PartialFrame> partial, uint32_t frame_index) {
+            std::string filepath = renders_directory() + std::to_string(frame_index) + "_" + std::to_string(part) + ".partial";
+            if (!partial->write(filepath)) {
+                std::cerr << "Can't write " << filepath << std::endl;
+                write_failed = true;
+            }
+        };
+    }
 
-    return 0;
-}
\ No newline at end of file
+    // Renders with the renderer specialized for the scene type, unless the
+    // std::function fallback is requested
+    bool found = visit_scene(arguments, [&](const auto& scene) {
+        FrameRenderCallback on_sample_count = arguments.sample_map ? sample_count_callback : FrameRenderCallback();
+        MarchCountersCallback on_counters = arguments.march_stats ? march_counters_callback : MarchCountersCallback();
+        if (arguments.budget_ms > 0.0f) {
+            // A single frame, as good as the time budget allows, with --samples as the upper limit
+            auto image = std::make_shared<Image>(frame_config.width, frame_config.height);
+            Renderer renderer(frame_config, scene, sequence_config.start_time, image);
+            ProgressiveConfig progressive = { arguments.pass_samples, frame_config.samples, arguments.budget_ms / 1000.0f };
+            renderer.render_progressive(progressive, [](std::shared_ptr<const Image>, uint32_t samples) {
+                std::cout << "Pass done, " << samples << " samples per pixel" << std::endl;
+            });
+            on_render(image, 0);
+        } else if (!arguments.checkpoint.empty()) {
+            // A single frame, resumed from the checkpoint file if a previous run of it was stopped
+            auto image = std::make_shared<Image>(frame_config.width, frame_config.height);
+            Renderer renderer(frame_config, scene, sequence_config.start_time, image);
+            renderer.debug = false;
+            if (!renderer.render_checkpointed(arguments.checkpoint, arguments.pass_samples, arguments.checkpoint_interval))
+                std::cerr << "Can't write checkpoint " << arguments.checkpoint << std::endl;
+            on_render(image, 0);
+        } else if (arguments.type_erased)
+            render_sequence(frame_config, sequence_config, Scene(scene), on_render, on_sample_count, on_partial, on_counters);
+        else
+            render_sequence(frame_config, sequence_config, scene, on_render, on_sample_count, on_partial, on_counters);
+    });
+
+    return found && !write_failed ? 0 : EXIT_FAILURE;
+}
@@ -1,6 +1,17 @@
 /*
 This file contains a set of scenes. Here, different examples of how the signed_distance_function
-should be structured
+should be structured.
+Each scene is a type, its constructor creates the materials once and registers them in the
+MaterialTable, then operator() is the signed distance function, that only refers to the materials
+by MaterialId. operator() is a template on the scalar type, so the renderer can also evaluate
+packets of points at once. Scenes are built with compile_scene<Scenes::Type>()
+Scenes with content that doesn't move also expose it as static_part, so the baked distance
+grid is built once for a sequence, and what moves as animated_part.
+Scenes whose surfaces stay in a box at any time declare it as bounds(), rays that leave
+it end. Every scene here is built from exact distances joined by unions, subtractions,
+intersections and smooth unions, so their lipschitz() is 1 and the march may over-relax.
+Scenes with small emitters declare them as lights(time), primary rays are also sent
+toward them. Scenes that mostly glow don't need it
 */
 
 
@@ -8,590 +19,976 @@ should be structured
 #ifndef SCENES_H
 #define SCENES_H
 #include "lights2d/lights2d.h"
+#include <string>
+#include <vector>
 
 using namespace Lights2D;
 
 namespace Scenes
 {
-        
-    static void _eval(float distance, const Material& mtl, Nearest& nearest)
+
+    template <typename T>
+    static void _eval(T distance, MaterialId mtl, BasicNearest<T>& nearest)
+    {
+        nearest.update(distance, mtl);
+    }
+
+    template <typename T>
+    static void _eval(T distance, const MaterialBlend& mtl, BasicNearest<T>& nearest)
+    {
+        nearest.update(distance, mtl);
+    }
+
+
+    struct TestShapes
     {
-        if (distance < nearest.distance)
+        MaterialId white_mtl;
+
+        explicit TestShapes(MaterialTable& materials)
+            : white_mtl(materials.add(Material::create_light({1.0f}, 1.0f))) {}
+
+        float lipschitz() const { return 1.0f; }
+
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
         {
-            nearest.distance = distance;
-            nearest.mtl = mtl;
+            BasicNearest<T> nearest;
+            /*
+            // CIRCLE
+            _eval(SDF::circle(pos, Vec2(0.3f, 0.6f), 0.2f), white_mtl, nearest);
+            */
+
+            /*
+            // BOX
+            _eval(SDF::box(pos, {-0.4, -0.4}, {0.1, 0.1}), white_mtl, nearest);
+            */
+            /*
+            // ROUNDED BOX
+            _eval(SDF::box(pos, {-0.4, -0.4}, {0.1, 0.1}), white_mtl, nearest) - 0.05;
+            */
+
+            /*
+            // MOON
+            T outer_circle_distance = SDF::circle(pos, {-0.5f, 0.0f}, 0.4);
+            T inner_circle_distance = SDF::circle(pos, {-0.3f, 0.0f}, 0.3);
+            _eval(SDF::combine_subtract(outer_circle_distance, inner_circle_distance), white_mtl, nearest);
+            */
+
+            /*
+            // LINE
+            T line_distance = SDF::line(pos, Vec2(-0.5), Vec2(0.5), 0.07f);
+            _eval(line_distance, white_mtl, nearest);
+            */
+
+            /*
+            // ARC
+            float aperture = PI * 0.35;
+            T distance = SDF::arc(pos - Vec2(0.4, 0.0f), Vec2(sin(aperture), cos(aperture)), 0.3, 0.01);
+            _eval(distance, white_mtl, nearest);
+            */
+
+            /*
+            HEART
+            T distance = SDF::heart(pos, Vec2(0.0f, -0.5f));
+            _eval(distance, white_mtl, nearest);
+            */
+
+            /*
+            EGG
+            T distance = SDF::egg(pos, Vec2(0, -0.5), 0.3, 0.01);
+            _eval(distance, white_mtl, nearest);
+            */
+
+            /*
+            PENTAGON
+            T distance = SDF::pentagon(pos, 0.3f);
+            //_eval(distance, white_mtl, nearest);
+            */
+
+            return nearest;
         }
-    }      
+    };
 
-
-    static Nearest test_shapes_sdf(Vec2 pos, float time)
+    struct SmoothReflections
     {
-        Nearest nearest;
-        Material white_mtl = Material::create_light({1.0f}, 1.0f);
-        /*
-        // CIRCLE
-        _eval(SDF::circle(pos, Vec2(0.3f, 0.6f), 0.2f), white_mtl, nearest);
-        */
+        MaterialId white_light;
+        MaterialId reflective_walls;
 
-        /*
-        // BOX
-        _eval(SDF::box(pos, {-0.4, -0.4}, {0.1, 0.1}), white_mtl, nearest);
-        */
-        /*
-        // ROUNDED BOX
-        _eval(SDF::box(pos, {-0.4, -0.4}, {0.1, 0.1}), white_mtl, nearest) - 0.05;
-        */
+        explicit SmoothReflections(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light(Color(1.0f), 2.0f))),
+              reflective_walls(materials.add(Material::create_reflective(1.0f))) {}
 
-        /*
-        // MOON
-        float outer_circle_distance = SDF::circle(pos, {-0.5f, 0.0f}, 0.4);
-        float inner_circle_distance = SDF::circle(pos, {-0.3f, 0.0f}, 0.3);
-        _eval(SDF::combine_subtract(outer_circle_distance, inner_circle_distance), white_mtl, nearest);
-        */
+        Bounds bounds() const { return { -1.0f, -1.0f, 0.7f, 0.7f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            return {
+                LightShape::circle(Vec2(0.3f), 0.1f),
+                LightShape::circle(Vec2(-0.9f), 0.05f)
+            };
+        }
 
-        /*
-        // LINE
-        float line_distance = SDF::line(pos, Vec2(-0.5), Vec2(0.5), 0.07f);
-        _eval(line_distance, white_mtl, nearest);
-        */
-        
-        /*
-        // ARC
-        float aperture = PI * 0.35;
-        float distance = SDF::arc(pos - Vec2(0.4, 0.0f), Vec2(sin(aperture), cos(aperture)), 0.3, 0.01);
-        _eval(distance, white_mtl, nearest);
-        */
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
 
-        /*
-        HEART
-        float distance = SDF::heart(pos, Vec2(0.0f, -0.5f));
-        _eval(distance, white_mtl, nearest);
-        */
+            // Central light
+            _eval(SDF::circle(pos, Vec2(0.3f), 0.1f), white_light, nearest);
+            _eval(SDF::circle(pos, Vec2(-0.9f), 0.05f), white_light, nearest);
 
-        /*
-        EGG
-        float distance = SDF::egg(pos, Vec2(0, -0.5), 0.3, 0.01);
-        _eval(distance, white_mtl, nearest);
-        */
+            float k_smooth_factor = 0.4f;
 
-        /*
-        PENTAGON
-        float distance = SDF::pentagon(pos, 0.3f);
-        //_eval(distance, white_mtl, nearest);
-        */
+            // Calculates the distances
+            T box = SDF::box(pos, Vec2(-0.5f, 0.3f), Vec2(0.15f));
+            T line_x = SDF::line(pos, Vec2(-0.5f), Vec2(0.5f, -0.5f), 0.05f);
+            T line_y = SDF::line(pos, Vec2(-0.5f, -0.5f), Vec2(-0.5f, 0.5f), 0.05f);
 
-        return nearest;
-    }
+            // Interpolates just the distances, since the material is the same
+            T lines = SDF::combine_union_s(line_x, line_y, k_smooth_factor);
+            T objects = SDF::combine_union_s(lines, box, k_smooth_factor);
+
+            _eval(objects, reflective_walls, nearest);
+            return nearest;
+        }
+    };
 
-    static  Nearest smooth_reflections(Vec2 pos, float time)
+    struct Metaballs3
     {
-        Nearest nearest;
-        Material white_light = Material::create_light(Color(1.0f), 2.0f);
-        Material reflective_walls = Material::create_reflective(1.0f);
+        MaterialId mat0, mat1, mat2;
 
-        // Central light
-        _eval(SDF::circle(pos, Vec2(0.3f), 0.1f), white_light, nearest);
-        _eval(SDF::circle(pos, Vec2(-0.9f), 0.05f), white_light, nearest);
+        explicit Metaballs3(MaterialTable& materials)
+            : mat0(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(56, 192, 242) / 255.0f), 1.0f))),
+              mat1(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(58, 10, 200) / 255.0f), 1.0f))),
+              mat2(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(255, 10, 255) / 255.0f), 1.0f))) {}
 
-        float k_smooth_factor = 0.4f;
+        Bounds bounds() const { return { -0.5f, -0.5f, 0.5f, 0.5f }; }
+        float lipschitz() const { return 1.0f; }
 
-        // Calculates the distances
-        float box = SDF::box(pos, Vec2(-0.5f, 0.3f), Vec2(0.15f));
-        float line_x = SDF::line(pos, Vec2(-0.5f), Vec2(0.5f, -0.5f), 0.05f);
-        float line_y = SDF::line(pos, Vec2(-0.5f, -0.5f), Vec2(-0.5f, 0.5f), 0.05f);
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
 
-        // Interpolates just the distances, since the material is the same
-        float lines = SDF::combine_union_s(line_x, line_y, k_smooth_factor);
-        float objects = SDF::combine_union_s(lines, box, k_smooth_factor);
+            // Central light
+            T obj0 = SDF::circle(pos, Vec2(0.2f), 0.2f);
+            T obj1 = SDF::circle(pos, Vec2(-0.2f), 0.2f);
+            T obj2 = SDF::circle(pos, Vec2(0.1f, -0.2), 0.15f);
 
-        _eval(objects, reflective_walls, nearest);
-        return nearest;
-    }
+            float k_smooth_factor = 0.2f;
 
-    static Nearest metaballs_3(Vec2 pos, float time)
-    {
-        Nearest nearest;
-        Material mat0 = Material::create_light(Utils::gamma_exp(Color<float>(56, 192, 242) / 255.0f), 1.0f);
-        Material mat1 = Material::create_light(Utils::gamma_exp(Color<float>(58, 10, 200) / 255.0f), 1.0f);
-        Material mat2 = Material::create_light(Utils::gamma_exp(Color<float>(255, 10, 255) / 255.0f), 1.0f);
-        
-        // Central light
-        float obj0 = SDF::circle(pos, Vec2(0.2f), 0.2f);
-        float obj1 = SDF::circle(pos, Vec2(-0.2f), 0.2f);
-        float obj2 = SDF::circle(pos, Vec2(0.1f, -0.2), 0.15f);
+            T h;
+            T dist;
+            MaterialBlend mtl;
 
-        float k_smooth_factor = 0.2f;
+            h = SDF::smooth_t(obj0, obj1, k_smooth_factor);
+            mtl = MaterialBlend::mix(mat1, mat0, h);
+            dist = SDF::combine_union_s(obj0, obj1, k_smooth_factor, h);
 
-        float h;
-        float dist;
-        Material mtl;
 
-        h = SDF::smooth_t(obj0, obj1, k_smooth_factor);
-        mtl = Material::mix(mat1, mat0, h);
-        dist = SDF::combine_union_s(obj0, obj1, k_smooth_factor, h);
+            h = SDF::smooth_t(dist, obj2, k_smooth_factor);
+            mtl = MaterialBlend::mix(mat2, mtl, h);
+            dist = SDF::combine_union_s(dist, obj2, k_smooth_factor, h);
 
+            _eval(dist, mtl, nearest);
+            return nearest;
+        }
+    };
 
-        h = SDF::smooth_t(dist, obj2, k_smooth_factor);
-        mtl = Material::mix(mat2, mtl, h);
-        dist = SDF::combine_union_s(dist, obj2, k_smooth_factor, h);
 
-        _eval(dist, mtl, nearest);
-        return nearest;
-    }
+    struct CircleCut
+    {
+        MaterialId white_light;
+        MaterialId reflective;
 
+        explicit CircleCut(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 1.0f))),
+              reflective(materials.add(Material::create_reflective(0.9f))) {}
 
-    static Nearest circle_cut(Vec2 pos, float time)
-    {
-        // Rotates 2 lines with different angular speed
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 1.0f);
-
-        float angle1 = PI * time;
-        float angle2 = 2.0f * PI * time;
-        float length = 0.6f;
-        float static_circle_wall = SDF::circle(pos, Vec2(0.0f, -0.7f), 0.8f);
-
-        // Completes the range [0.0f, 1.0f, 0.0f] in 2 seconds
-        float t = abs(sin(time * PI));
-        float moving_circle = SDF::circle(pos, Vec2(0.0f, 0.0f), Utils::mix(0.0f, 1.0f, t));
-
-        float dist = SDF::combine_subtract(static_circle_wall, moving_circle);
-        _eval(dist, Material::create_reflective(0.9f), nearest);
-        _eval(SDF::circle(pos, Vec2(0.2f, 0.7f), 0.15f), white_light, nearest);
-        _eval(SDF::circle(pos, Vec2(-1.6f), 0.15f), white_light, nearest);
-        _eval(SDF::circle(pos, Vec2(1.6f, -1.0f), 0.15f), white_light, nearest);
-        return nearest;
-    }
+        Bounds bounds() const { return { -1.8f, -1.8f, 1.8f, 0.9f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            return {
+                LightShape::circle(Vec2(0.2f, 0.7f), 0.15f),
+                LightShape::circle(Vec2(-1.6f), 0.15f),
+                LightShape::circle(Vec2(1.6f, -1.0f), 0.15f)
+            };
+        }
+
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            // Rotates 2 lines with different angular speed
+            BasicNearest<T> nearest;
+
+            float angle1 = PI * time;
+            float angle2 = 2.0f * PI * time;
+            float length = 0.6f;
+            T static_circle_wall = SDF::circle(pos, Vec2(0.0f, -0.7f), 0.8f);
+
+            // Completes the range [0.0f, 1.0f, 0.0f] in 2 seconds
+            float t = std::abs(sin(time * PI));
+            T moving_circle = SDF::circle(pos, Vec2(0.0f, 0.0f), Utils::mix(0.0f, 1.0f, t));
+
+            T dist = SDF::combine_subtract(static_circle_wall, moving_circle);
+            _eval(dist, reflective, nearest);
+            _eval(SDF::circle(pos, Vec2(0.2f, 0.7f), 0.15f), white_light, nearest);
+            _eval(SDF::circle(pos, Vec2(-1.6f), 0.15f), white_light, nearest);
+            _eval(SDF::circle(pos, Vec2(1.6f, -1.0f), 0.15f), white_light, nearest);
+            return nearest;
+        }
+    };
 
-    static Nearest metaballs(Vec2 pos, float time)
+    struct Metaballs
     {
-        // Rotates 2 lines with different angular speed
-        Nearest nearest;
-        Material white_light = Material::create_light({powf(1.0f, 2.2f)}, 1.0f);
-        Material mat0 = Material::create_light(Utils::gamma_exp(Color<float>(255, 179, 38) / 255.0f), 1.0f);
-        Material mat1 = Material::create_light(Utils::gamma_exp(Color<float>(255, 81, 38) / 255.0f), 1.0f);
-        Material mat2 = Material::create_light(Utils::gamma_exp(Color<float>(38, 255, 165) / 255.0f), 1.0f);
-        Material mat3 = Material::create_light(Utils::gamma_exp(Color<float>(38, 219, 255) / 255.0f), 1.0f);
-
-        float top_light = SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(0.5f, 0.01f));
-
-        _eval(top_light, white_light, nearest);
-
-        // Loop time
-        float t = abs(sin(PI * time));
-
-        // Circle center - static
-        float circle_center = SDF::circle(pos, Vec2(0.0f, 0.2f * sin(2.0f * PI * time)), 0.25f);
-
-        // Circle 0
-        float min_distance0 = 0.3f;
-        float max_distance0 = 0.6f;
-        float distance0 = Utils::mix(min_distance0, max_distance0,  t);
-        float angle0 = 2.0f * time * PI;
-        Vec2 pos0(cos(angle0) * distance0, sin(angle0) * distance0);
-        float circle0_distance = SDF::circle(pos, pos0, 0.2f);
-
-        // Circle 1
-        float min_distance1 = 0.3f;
-        float max_distance1 = 0.55f;
-        float distance1 = Utils::mix(min_distance1, max_distance1,  t);
-        float angle1 = -2.0f * time * PI;
-        Vec2 pos1(0.2f + cos(angle1) * distance0, -0.2f * sin(angle1) * distance0);
-        float circle1_distance = SDF::circle(pos, pos1, 0.2f);
-
-        // Circle 2
-        float distance2 = Utils::mix(0.5f, 0.7f, t);
-        float angle2 = -2.0f * PI * time;
-        Vec2 pos2(-0.2f + cos(angle2) * distance2, -0.2f + sin(angle2) * distance2);
-        float circle2_distance = SDF::circle(pos, pos2, 0.3f);
-
-        std::pair<float, Material> objects[4];
-        objects[0] = {circle_center, mat0};
-        objects[1] = {circle0_distance, mat3};
-        objects[2] = {circle1_distance, mat2};
-        objects[3] = {circle2_distance, mat1};
-
-        float k_smooth_factor = 0.3f;
-
-        Material interpolated_mtl = Material::create_opaque();
-        float interpolated_sd = 0;
-        for (uint32_t i = 0; i < 4; i++)
-        {
-            auto pair = objects[i];
-            if (i == 0)
-            {
-                interpolated_mtl = pair.second;
-                interpolated_sd = pair.first;
-            }
-            else
-            {
-                // Interpolation factor
-                float h = SDF::smooth_t(interpolated_sd, pair.first, k_smooth_factor);
+        MaterialId white_light;
+        MaterialId mat0, mat1, mat2, mat3;
+
+        explicit Metaballs(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({powf(1.0f, 2.2f)}, 1.0f))),
+              mat0(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(255, 179, 38) / 255.0f), 1.0f))),
+              mat1(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(255, 81, 38) / 255.0f), 1.0f))),
+              mat2(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(38, 255, 165) / 255.0f), 1.0f))),
+              mat3(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(38, 219, 255) / 255.0f), 1.0f))) {}
 
-                // Interpolated distance
-                interpolated_sd = SDF::combine_union_s(interpolated_sd, pair.first, k_smooth_factor, h);
+        Bounds bounds() const { return { -1.3f, -1.3f, 1.1f, 1.25f }; }
+        float lipschitz() const { return 1.0f; }
 
-                // Interpolated color
-                interpolated_mtl = Material::mix(pair.second, interpolated_mtl, h);
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            // Rotates 2 lines with different angular speed
+            BasicNearest<T> nearest;
+
+            T top_light = SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(0.5f, 0.01f));
+
+            _eval(top_light, white_light, nearest);
+
+            // Loop time
+            float t = std::abs(sin(PI * time));
+
+            // Circle center - static
+            T circle_center = SDF::circle(pos, Vec2(0.0f, 0.2f * sin(2.0f * PI * time)), 0.25f);
+
+            // Circle 0
+            float min_distance0 = 0.3f;
+            float max_distance0 = 0.6f;
+            float distance0 = Utils::mix(min_distance0, max_distance0,  t);
+            float angle0 = 2.0f * time * PI;
+            Vec2 pos0(cos(angle0) * distance0, sin(angle0) * distance0);
+            T circle0_distance = SDF::circle(pos, pos0, 0.2f);
+
+            // Circle 1
+            float min_distance1 = 0.3f;
+            float max_distance1 = 0.55f;
+            float distance1 = Utils::mix(min_distance1, max_distance1,  t);
+            float angle1 = -2.0f * time * PI;
+            Vec2 pos1(0.2f + cos(angle1) * distance0, -0.2f * sin(angle1) * distance0);
+            T circle1_distance = SDF::circle(pos, pos1, 0.2f);
+
+            // Circle 2
+            float distance2 = Utils::mix(0.5f, 0.7f, t);
+            float angle2 = -2.0f * PI * time;
+            Vec2 pos2(-0.2f + cos(angle2) * distance2, -0.2f + sin(angle2) * distance2);
+            T circle2_distance = SDF::circle(pos, pos2, 0.3f);
+
+            std::pair<T, MaterialId> objects[4];
+            objects[0] = {circle_center, mat0};
+            objects[1] = {circle0_distance, mat3};
+            objects[2] = {circle1_distance, mat2};
+            objects[3] = {circle2_distance, mat1};
+
+            float k_smooth_factor = 0.3f;
+
+            MaterialBlend interpolated_mtl;
+            T interpolated_sd = 0.0f;
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                auto pair = objects[i];
+                if (i == 0)
+                {
+                    interpolated_mtl = pair.second;
+                    interpolated_sd = pair.first;
+                }
+                else
+                {
+                    // Interpolation factor
+                    T h = SDF::smooth_t(interpolated_sd, pair.first, k_smooth_factor);
+
+                    // Interpolated distance
+                    interpolated_sd = SDF::combine_union_s(interpolated_sd, pair.first, k_smooth_factor, h);
+
+                    // Interpolated color
+                    interpolated_mtl = MaterialBlend::mix(pair.second, interpolated_mtl, h);
+                }
             }
+            _eval(interpolated_sd, interpolated_mtl, nearest);
+            return nearest;
         }
-        _eval(interpolated_sd, interpolated_mtl, nearest);
-        return nearest;
-    }
+    };
 
 
-    static Nearest glass_metaballs(Vec2 pos, float time)
+    struct GlassMetaballs
     {
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 1.0f);
-        Material yellow_light = Material::create_light(Utils::gamma_exp(Color<float>(252, 241, 177) / 255.0f), 3.0f);
-        _eval(SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)), white_light, nearest);
-        _eval(SDF::circle(pos, Vec2(1.3f, 0.0f), 0.2f), yellow_light, nearest);
-
-        Material refractive_material = Material::create_refractive(0.2f, 1.4f);
-
-        _eval(
-            SDF::combine_union_s(
-                SDF::circle(pos, Vec2(0.4f * static_cast<float>(cos(time * 2.0f * PI)), -0.3f), 0.4f),
-                SDF::box(pos, Vec2(-0.4f * static_cast<float>(cos(time * 2.0f * PI)), 0.3f), Vec2(0.4f)),
-                0.3f
-            ),
-            refractive_material,
-            nearest
-        );
-        return nearest;
-    }
+        MaterialId white_light;
+        MaterialId yellow_light;
+        MaterialId refractive_material;
+
+        explicit GlassMetaballs(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 1.0f))),
+              yellow_light(materials.add(Material::create_light(Utils::gamma_exp(Color<float>(252, 241, 177) / 255.0f), 3.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.2f, 1.4f))) {}
+
+        Bounds bounds() const { return { -1.0f, -0.8f, 1.5f, 1.25f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            return {
+                LightShape::box(Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)),
+                LightShape::circle(Vec2(1.3f, 0.0f), 0.2f)
+            };
+        }
 
+        // The lights don't move, they're baked once for a sequence, the glass is evaluated at every step
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
+        {
+            BasicNearest<T> nearest;
+            _eval(SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)), white_light, nearest);
+            _eval(SDF::circle(pos, Vec2(1.3f, 0.0f), 0.2f), yellow_light, nearest);
+            return nearest;
+        }
 
-    static Nearest circular_lens(Vec2 pos, float time)
-    {
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 1.0f);
-        _eval(SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)), white_light, nearest);
-
-        Vec2 origin(0.0f, 0.0f);
-        float offset = 0.55f;
-        Material refractive_material = Material::create_refractive(0.2f, 1.4f);
-
-        _eval(
-            SDF::circle(pos, {0.0f, 0.0f}, 0.5f),
-            refractive_material,
-            nearest
-        );
-        return nearest;
-    }
+        template <typename T>
+        BasicNearest<T> animated_part(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
+            _eval(
+                SDF::combine_union_s(
+                    SDF::circle(pos, Vec2(0.4f * static_cast<float>(cos(time * 2.0f * PI)), -0.3f), 0.4f),
+                    SDF::box(pos, Vec2(-0.4f * static_cast<float>(cos(time * 2.0f * PI)), 0.3f), Vec2(0.4f)),
+                    0.3f
+                ),
+                refractive_material,
+                nearest
+            );
+            return nearest;
+        }
 
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest = static_part(pos);
+            BasicNearest<T> animated = animated_part(pos, time);
+            nearest.update(animated.distance, animated.mtl);
+            return nearest;
+        }
+    };
 
-    static Nearest glass_absorption(Vec2 pos, float time)
+
+    struct CircularLens
     {
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 1.0f);
+        MaterialId white_light;
+        MaterialId refractive_material;
 
-        _eval(SDF::line(pos, Vec2(-.6f, 0.65f), Vec2(0.6f, 0.65f), 0.02f), white_light, nearest);
-        Material refractive_material = Material::create_refractive(0.0f, 1.4f, Utils::gamma_exp(Color<float>(1.60f, 1.60f, 1.1f)));
-        _eval(SDF::box(pos, Vec2(0, -0.2), Vec2(.3f, 0.3f)) - 0.1f, refractive_material, nearest);
-        return nearest;
-    }
+        explicit CircularLens(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 1.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.2f, 1.4f))) {}
+
+        Bounds bounds() const { return { -1.0f, -0.5f, 1.0f, 1.25f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const { return { LightShape::box(Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)) }; }
+
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
+        {
+            BasicNearest<T> nearest;
+            _eval(SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)), white_light, nearest);
+
+            Vec2 origin(0.0f, 0.0f);
+            float offset = 0.55f;
+
+            _eval(
+                SDF::circle(pos, {0.0f, 0.0f}, 0.5f),
+                refractive_material,
+                nearest
+            );
+            return nearest;
+        }
 
-    
-    static Nearest convex_lens(Vec2 pos, float time)
+        // Nothing moves, the whole scene is baked once for a sequence
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            return static_part(pos);
+        }
+    };
+
+
+    struct GlassAbsorption
     {
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 20.0f);
-
-        _eval(SDF::circle(pos, Vec2(0.0f, 1.4f), 0.05), white_light, nearest);
-
-        Vec2 origin(0.0f, 0.3f);
-        float offset = 0.5f;
-        Material refractive_material = Material::create_refractive(0.2f, 1.5f);
-
-        _eval(
-            SDF::combine_intersect(
-                SDF::circle(pos, {origin.x, origin.y + offset}, 0.6f), 
-                SDF::circle(pos, {origin.x, origin.y - offset}, 0.6f)
-            ),
-            refractive_material,
-            nearest
-        );
-        return nearest;
-    }
+        MaterialId white_light;
+        MaterialId refractive_material;
+
+        explicit GlassAbsorption(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 1.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.0f, 1.4f, Utils::gamma_exp(Color<float>(1.60f, 1.60f, 1.1f))))) {}
+
+        Bounds bounds() const { return { -0.65f, -0.65f, 0.65f, 0.7f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const { return { LightShape::segment(Vec2(-0.6f, 0.65f), Vec2(0.6f, 0.65f), 0.02f) }; }
+
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
+
+            _eval(SDF::line(pos, Vec2(-.6f, 0.65f), Vec2(0.6f, 0.65f), 0.02f), white_light, nearest);
+            _eval(SDF::box(pos, Vec2(0, -0.2), Vec2(.3f, 0.3f)) - 0.1f, refractive_material, nearest);
+            return nearest;
+        }
+    };
 
 
-    static Nearest concave_lens(Vec2 pos, float time)
+    struct ConvexLens
     {
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 20.0f);
-
-        _eval(SDF::circle(pos, Vec2(0.0f, 1.4f), 0.05), white_light, nearest);
-
-        Vec2 origin(0.0f, 0.0f);
-        Material refractive_material = Material::create_refractive(0.2f, 1.5f);
-        float radius = 0.6f;
-        float lens_thickness = 0.1f;
-        _eval(
-            SDF::combine_subtract(
-                SDF::box(pos, origin, Vec2(0.4f, 0.3f)),
-                SDF::combine_union(
-                    SDF::circle(pos, {origin.x, origin.y + radius + lens_thickness * 0.5f}, radius), 
-                    SDF::circle(pos, {origin.x, origin.y - radius - lens_thickness * 0.5f}, radius)
-                )
-            ),
-            refractive_material,
-            nearest
-        );
-        return nearest;
-    }
+        MaterialId white_light;
+        MaterialId refractive_material;
+
+        explicit ConvexLens(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 20.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.2f, 1.5f))) {}
+
+        Bounds bounds() const { return { -0.6f, 0.0f, 0.6f, 1.5f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const { return { LightShape::circle(Vec2(0.0f, 1.4f), 0.05f) }; }
+
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
+        {
+            BasicNearest<T> nearest;
+
+            _eval(SDF::circle(pos, Vec2(0.0f, 1.4f), 0.05), white_light, nearest);
+
+            Vec2 origin(0.0f, 0.3f);
+            float offset = 0.5f;
+
+            _eval(
+                SDF::combine_intersect(
+                    SDF::circle(pos, {origin.x, origin.y + offset}, 0.6f),
+                    SDF::circle(pos, {origin.x, origin.y - offset}, 0.6f)
+                ),
+                refractive_material,
+                nearest
+            );
+            return nearest;
+        }
+
+        // Nothing moves, the whole scene is baked once for a sequence
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            return static_part(pos);
+        }
+    };
 
-    static Nearest semicircular_lens(Vec2 pos, float time)
+
+    struct ConcaveLens
     {
-        Nearest nearest;
-        Material white_light = Material::create_light({1.0f}, 20.0f);
-
-        _eval(SDF::circle(pos, Vec2(0.0f, 1.4f), 0.05), white_light, nearest);
-
-        Vec2 origin(0.0f, 0.3f);
-        Material refractive_material = Material::create_refractive(0.2f, 1.5f);
-        float radius = 0.9f;
-        float lens_thickness = 0.1f;
-        _eval(
-            SDF::combine_subtract(
-                SDF::circle(pos, origin, radius * 0.5f),
-                SDF::plane(pos, origin, Vec2(0, -1))
-            ),
-            refractive_material,
-            nearest
-        );
-        return nearest;
-    }
+        MaterialId white_light;
+        MaterialId refractive_material;
+
+        explicit ConcaveLens(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 20.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.2f, 1.5f))) {}
+
+        Bounds bounds() const { return { -0.45f, -0.35f, 0.45f, 1.5f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const { return { LightShape::circle(Vec2(0.0f, 1.4f), 0.05f) }; }
+
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
+        {
+            BasicNearest<T> nearest;
+
+            _eval(SDF::circle(pos, Vec2(0.0f, 1.4f), 0.05), white_light, nearest);
+
+            Vec2 origin(0.0f, 0.0f);
+            float radius = 0.6f;
+            float lens_thickness = 0.1f;
+            _eval(
+                SDF::combine_subtract(
+                    SDF::box(pos, origin, Vec2(0.4f, 0.3f)),
+                    SDF::combine_union(
+                        SDF::circle(pos, {origin.x, origin.y + radius + lens_thickness * 0.5f}, radius),
+                        SDF::circle(pos, {origin.x, origin.y - radius - lens_thickness * 0.5f}, radius)
+                    )
+                ),
+                refractive_material,
+                nearest
+            );
+            return nearest;
+        }
+
+        // Nothing moves, the whole scene is baked once for a sequence
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            return static_part(pos);
+        }
+    };
 
-    static Nearest sample_scene(Vec2 pos, float time)
+    struct SemicircularLens
     {
-        Nearest nearest;
+        MaterialId white_light;
+        MaterialId refractive_material;
+
+        explicit SemicircularLens(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 20.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.2f, 1.5f))) {}
+
+        Bounds bounds() const { return { -0.5f, -0.2f, 0.5f, 1.5f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const { return { LightShape::circle(Vec2(0.0f, 1.4f), 0.05f) }; }
+
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
+        {
+            BasicNearest<T> nearest;
+
+            _eval(SDF::circle(pos, Vec2(0.0f, 1.4f), 0.05), white_light, nearest);
+
+            Vec2 origin(0.0f, 0.3f);
+            float radius = 0.9f;
+            float lens_thickness = 0.1f;
+            _eval(
+                SDF::combine_subtract(
+                    SDF::circle(pos, origin, radius * 0.5f),
+                    SDF::plane(pos, origin, Vec2(0, -1))
+                ),
+                refractive_material,
+                nearest
+            );
+            return nearest;
+        }
 
-        Material purple_mtl = Material::create_light({0.9f, 0.4f, 1.0f}, 1.5f);
-        Material pink_mtl = Material::create_light({0.8f, 0.0f, 0.21f}, 1.0f);
-        Material opaque_mtl = Material::create_opaque();
-        Material reflective_mtl = Material::create_reflective(0.6f);
-        
-        // Lights
+        // Nothing moves, the whole scene is baked once for a sequence
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
         {
-            Material lights_material = Material::create_light({1.0f}, 1.0f);
-            // Top light    
-            _eval(SDF::box(pos, Vec2(0.0, 1.0f - 0.1f), Vec2(0.5f, 0.01f)), lights_material, nearest);
+            return static_part(pos);
+        }
+    };
 
-            float x_light_distance = 2.0f;
-            _eval(SDF::line(pos, Vec2(-x_light_distance, -1.0f), Vec2(-x_light_distance, 1.0f), 0.05f), lights_material, nearest);
-            _eval(SDF::line(pos, Vec2(x_light_distance, -1.0f), Vec2(x_light_distance, 1.0f), 0.05f), lights_material, nearest);
+    struct SampleScene
+    {
+        MaterialId purple_mtl;
+        MaterialId pink_mtl;
+        MaterialId opaque_mtl;
+        MaterialId reflective_mtl;
+        MaterialId lights_material;
+        MaterialId refractive_material;
+
+        explicit SampleScene(MaterialTable& materials)
+            : purple_mtl(materials.add(Material::create_light({0.9f, 0.4f, 1.0f}, 1.5f))),
+              pink_mtl(materials.add(Material::create_light({0.8f, 0.0f, 0.21f}, 1.0f))),
+              opaque_mtl(materials.add(Material::create_opaque())),
+              reflective_mtl(materials.add(Material::create_reflective(0.6f))),
+              lights_material(materials.add(Material::create_light({1.0f}, 1.0f))),
+              refractive_material(materials.add(Material::create_refractive(0.2f, 1.5f))) {}
+
+        Bounds bounds() const { return { -2.1f, -1.1f, 2.1f, 1.1f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            // The smooth shape emits too, its parts grow by k / 4
+            return {
+                LightShape::box(Vec2(0.0f, 0.9f), Vec2(0.5f, 0.01f)),
+                LightShape::segment(Vec2(-2.0f, -1.0f), Vec2(-2.0f, 1.0f), 0.05f),
+                LightShape::segment(Vec2(2.0f, -1.0f), Vec2(2.0f, 1.0f), 0.05f),
+                LightShape::box(Vec2(0.0f, 0.4f), Vec2(0.32f, 0.07f)),
+                LightShape::circle(Vec2(0.3f, 0.4f), 0.12f),
+                LightShape::circle(Vec2(-0.25f, 0.3f), 0.17f)
+            };
         }
 
-        // Smooth shape
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
         {
-            float box_sd = SDF::box(pos, Vec2(0.0, 0.4f), Vec2(0.3f, 0.05f));
+            BasicNearest<T> nearest;
 
-            float circles_sd;
+            // Lights
             {
-                float circle_sd_0 = SDF::circle(pos, Vec2(0.3f, 0.4f), 0.1f);
-                float circle_sd_1 = SDF::circle(pos, Vec2(-0.25f, 0.3f), 0.15f);
-                circles_sd = SDF::combine_union(circle_sd_0, circle_sd_1);
+                // Top light
+                _eval(SDF::box(pos, Vec2(0.0, 1.0f - 0.1f), Vec2(0.5f, 0.01f)), lights_material, nearest);
+
+                float x_light_distance = 2.0f;
+                _eval(SDF::line(pos, Vec2(-x_light_distance, -1.0f), Vec2(-x_light_distance, 1.0f), 0.05f), lights_material, nearest);
+                _eval(SDF::line(pos, Vec2(x_light_distance, -1.0f), Vec2(x_light_distance, 1.0f), 0.05f), lights_material, nearest);
+            }
+
+            // Smooth shape
+            {
+                T box_sd = SDF::box(pos, Vec2(0.0, 0.4f), Vec2(0.3f, 0.05f));
+
+                T circles_sd;
+                {
+                    T circle_sd_0 = SDF::circle(pos, Vec2(0.3f, 0.4f), 0.1f);
+                    T circle_sd_1 = SDF::circle(pos, Vec2(-0.25f, 0.3f), 0.15f);
+                    circles_sd = SDF::combine_union(circle_sd_0, circle_sd_1);
+                }
+
+                float k = 0.08f;
+                T h = SDF::smooth_t(box_sd, circles_sd, k);
+
+                T d = SDF::combine_union_s(box_sd, circles_sd, k, h);
+                MaterialBlend mix_mtl = MaterialBlend::mix(purple_mtl, pink_mtl, h);
+                _eval(d, mix_mtl, nearest);
             }
 
-            float k = 0.08f;
-            float h = SDF::smooth_t(box_sd, circles_sd, k);
+            // Reflective edges
+            {
+                T box_sd_0 = SDF::line(pos, Vec2(-0.3f, -0.2), Vec2(0.3f, -0.2f), 0.15f);
+                T box_sd_1 = SDF::line(pos, Vec2(-0.65, 0.7), Vec2(-0.65, 0.1), 0.05f);
+                T box_sd_2 = SDF::line(pos, Vec2(0.65, 0.7), Vec2(0.65, 0.1), 0.05f);
+
+                T boxes = SDF::combine_union(SDF::combine_union(box_sd_0, box_sd_1), box_sd_2);
+                T circle_sd = SDF::circle(pos, Vec2(), 0.2f);
+                T line_sd = SDF::line(pos, Vec2(), Vec2(0.0f, -0.5f), 0.1f);
+
+                T subtract_sd = SDF::combine_union_s(circle_sd, line_sd, 0.1f);
 
-            float d = SDF::combine_union_s(box_sd, circles_sd, k, h);
-            Material mix_mtl = Material::mix(purple_mtl, pink_mtl, h);
-            _eval(d, mix_mtl, nearest);
+                _eval(SDF::combine_subtract(boxes, subtract_sd), reflective_mtl, nearest);
+            }
+            {
+                Vec2 origin(0.0f, -0.7f);
+                float offset = 0.5f;
+
+                _eval(
+                    SDF::combine_intersect(
+                        SDF::circle(pos, {origin.x, origin.y + offset}, 0.6f),
+                        SDF::circle(pos, {origin.x, origin.y - offset}, 0.6f)
+                    ),
+                    refractive_material,
+                    nearest
+                );
+            }
+            return nearest;
         }
+    };
 
-        // Reflective edges
-        {
-            float box_sd_0 = SDF::line(pos, Vec2(-0.3f, -0.2), Vec2(0.3f, -0.2f), 0.15f);
-            float box_sd_1 = SDF::line(pos, Vec2(-0.65, 0.7), Vec2(-0.65, 0.1), 0.05f);
-            float box_sd_2 = SDF::line(pos, Vec2(0.65, 0.7), Vec2(0.65, 0.1), 0.05f);
-            
-            float boxes = SDF::combine_union(SDF::combine_union(box_sd_0, box_sd_1), box_sd_2);           
-            float circle_sd = SDF::circle(pos, Vec2(), 0.2f);
-            float line_sd = SDF::line(pos, Vec2(), Vec2(0.0f, -0.5f), 0.1f);
 
-            float subtract_sd = SDF::combine_union_s(circle_sd, line_sd, 0.1f);
+    struct MetaballsAbsorption
+    {
+        MaterialId white_light;
+        MaterialId yellow_light;
+        MaterialId refractive_material1;
+        MaterialId refractive_material2;
+
+        explicit MetaballsAbsorption(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 1.0f))),
+              yellow_light(materials.add(Material::create_light(Color<float>(252, 241, 177) / 255.0f, 3.0f))),
+              refractive_material1(materials.add(Material::create_refractive(0.0f, 1.4f, {1.2f, 1.7f, 2.2f}))),
+              refractive_material2(materials.add(Material::create_refractive(0.0f, 1.4f, {1.1f, 1.3f, 2.5f}))) {}
+
+        Bounds bounds() const { return { -1.0f, -0.8f, 1.5f, 1.25f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            return {
+                LightShape::box(Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)),
+                LightShape::circle(Vec2(1.3f, 0.0f), 0.2f)
+            };
+        }
 
-            _eval(SDF::combine_subtract(boxes, subtract_sd), reflective_mtl, nearest);
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
+
+            // LIGHTS
+            _eval(SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)), white_light, nearest);
+            _eval(SDF::circle(pos, Vec2(1.3f, 0.0f), 0.2f), yellow_light, nearest);
+
+            // Metaballs
+            T box = SDF::box(pos, Vec2(-0.4f * static_cast<float>(cos(time * 2.0f * PI)), 0.3f), Vec2(0.4f)) - 0.08f;
+            T circle = SDF::circle(pos, Vec2(0.4f * static_cast<float>(cos(time * 2.0f * PI)), -0.3f), 0.4f);
+            float k = 0.3f;
+
+            T h = SDF::smooth_t(box, circle, k);
+            T distance = SDF::combine_union_s(box, circle, k, h);
+            MaterialBlend mtl = MaterialBlend::mix(refractive_material1, refractive_material2, h);
+            _eval(distance, mtl, nearest);
+            return nearest;
         }
+    };
+
+    struct Caustics
+    {
+        MaterialId white_light;
+        MaterialId reflective;
+
+        explicit Caustics(MaterialTable& materials)
+            : white_light(materials.add(Material::create_light({1.0f}, 1.0f))),
+              reflective(materials.add(Material::create_reflective(0.9f))) {}
+
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const { return { LightShape::circle(Vec2(0.3f, 0.6f), 0.2f) }; }
+
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
         {
-            Vec2 origin(0.0f, -0.7f);
-            float offset = 0.5f;
-            Material refractive_material = Material::create_refractive(0.2f, 1.5f);
+            BasicNearest<T> nearest;
+
+            // LIGHTS
+            _eval(SDF::circle(pos, Vec2(.3f, 0.6f), 0.2f), white_light, nearest);
 
             _eval(
-                SDF::combine_intersect(
-                    SDF::circle(pos, {origin.x, origin.y + offset}, 0.6f), 
-                    SDF::circle(pos, {origin.x, origin.y - offset}, 0.6f)
+                SDF::combine_subtract(
+                    SDF::plane(pos, Vec2(0.0f), Vec2(0.0f, 1.0f)),
+                    SDF::circle(pos, Vec2(0.0f), 0.8f)
                 ),
-                refractive_material,
+                reflective,
                 nearest
             );
+            return nearest;
         }
-        return nearest;
-    }
 
+        // Nothing moves, the whole scene is baked once for a sequence
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            return static_part(pos);
+        }
+    };
 
-    static Nearest metaballs_absorption(Vec2 pos, float time)
-    {
-        Nearest nearest;
-
-        // LIGHTS
-        Material white_light = Material::create_light({1.0f}, 1.0f);
-        Material yellow_light = Material::create_light(Color<float>(252, 241, 177) / 255.0f, 3.0f);
-        _eval(SDF::box(pos, Vec2(0.0f, 1.2f), Vec2(1.0f, 0.01f)), white_light, nearest);
-        _eval(SDF::circle(pos, Vec2(1.3f, 0.0f), 0.2f), yellow_light, nearest);
-
-        // Metaballs
-        Material refractive_material1 = Material::create_refractive(0.0f, 1.4f, {1.2f, 1.7f, 2.2f});
-        Material refractive_material2 = Material::create_refractive(0.0f, 1.4f, {1.1f, 1.3f, 2.5f});
-
-        float box = SDF::box(pos, Vec2(-0.4f * static_cast<float>(cos(time * 2.0f * PI)), 0.3f), Vec2(0.4f)) - 0.08f;
-        float circle =  SDF::circle(pos, Vec2(0.4f * static_cast<float>(cos(time * 2.0f * PI)), -0.3f), 0.4f);
-        float k = 0.3f;
-
-        float h = SDF::smooth_t(box, circle, k);
-        float distance = SDF::combine_union_s(box, circle, k, h);
-        Material mtl = Material::mix(refractive_material1, refractive_material2, h);
-        _eval(distance, mtl, nearest);
-        return nearest;
-    }
 
-    static Nearest caustics(Vec2 pos, float time)
+    struct Room
     {
-        Nearest nearest;
-
-        // LIGHTS
-        Material white_light = Material::create_light({1.0f}, 1.0f);
-        _eval(SDF::circle(pos, Vec2(.3f, 0.6f), 0.2f), white_light, nearest);
-
-        _eval(
-            SDF::combine_subtract(
-                SDF::plane(pos, Vec2(0.0f), Vec2(0.0f, 1.0f)),
-                SDF::circle(pos, Vec2(0.0f), 0.8f)
-            ),
-            Material::create_reflective(0.9f),
-            nearest
-        );
-        return nearest;
-    }
+        MaterialId white_mtl;
+        MaterialId black_mtl;
+        MaterialId purple_mtl;
+        MaterialId light_purple_mtl;
+        MaterialId green_mtl;
+
+        explicit Room(MaterialTable& materials)
+            : white_mtl(materials.add(Material::create_light({1.0f}, 1.0f))),
+              black_mtl(materials.add(Material::create_reflective(0.5f))),
+              purple_mtl(materials.add(Material::create_light(Color(0.3f, 0.0f, .8f), 1.3f))),
+              light_purple_mtl(materials.add(Material::create_light(Color(0.5f, 0.2f, 1.0f), 1.3f))),
+              green_mtl(materials.add(Material::create_light(Color(0.7f, 1.0f, .2f), 1.3f))) {}
+
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            Vec2 box_size(0.1f, 0.05f);
+            return {
+                LightShape::circle(Vec2(), 0.2f),
+                LightShape::box(Vec2(-0.7f, -1.0f + box_size.y), box_size),
+                LightShape::box(Vec2(-0.7f, 1.0f - box_size.y), box_size),
+                LightShape::box(Vec2(0.7f, -1.0f + box_size.y), box_size),
+                LightShape::box(Vec2(0.7f, 1.0f - box_size.y), box_size)
+            };
+        }
 
+        template <typename T>
+        BasicNearest<T> static_part(Vector2<T> pos) const
+        {
+            BasicNearest<T> nearest;
+
+            // Center circle
+            _eval(SDF::circle(pos, Vec2(), 0.2f), purple_mtl, nearest);
+
+            // BLACK - REFLECTIVE
+            T plane1_dist = SDF::plane(pos, {0, -0.70}, {0, 1});
+            T plane2_dist = SDF::plane(pos, {0, 0.70}, {0, -1});
+            T box1_dist = SDF::box(pos, {-0.7, 0}, {0.1, 1});
+            T box2_dist = SDF::box(pos, {0.7, 0}, {0.1, 1});
+
+            T circle_dist = SDF::circle(pos, Vec2(), 0.8f);
+            T planes = SDF::combine_union(plane1_dist, plane2_dist);
+            T boxes = SDF::combine_union(box1_dist, box2_dist);
+            T subtract = SDF::combine_union(circle_dist, boxes);
+            _eval(SDF::combine_subtract(planes, subtract), black_mtl, nearest);
+
+            // LIGHTS
+            Vec2 box_size(0.1f, 0.05f);
+            T box_light1 = SDF::box(pos, {-0.7, -1 + box_size.y}, box_size);
+            T box_light2 = SDF::box(pos, {-0.7,  1 - box_size.y}, box_size);
+            T box_light3 = SDF::box(pos, {+0.7, -1 + box_size.y}, box_size);
+            T box_light4 = SDF::box(pos, {+0.7,  1 - box_size.y}, box_size);
+            _eval(box_light1, light_purple_mtl, nearest);
+            _eval(box_light2, light_purple_mtl, nearest);
+            _eval(box_light3, light_purple_mtl, nearest);
+            _eval(box_light4, light_purple_mtl, nearest);
+
+
+            return nearest;
+        }
 
-    static Nearest room_sdf(Vec2 pos, float time)
-    {
-        Nearest nearest;
-
-        Material white_mtl = Material::create_light({1.0f}, 1.0f);
-        Material black_mtl = Material::create_reflective(0.5f);
-        Material purple_mtl = Material::create_light(Color(0.3f, 0.0f, .8f), 1.3f);
-        Material light_purple_mtl = Material::create_light(Color(0.5f, 0.2f, 1.0f), 1.3f);
-        Material green_mtl = Material::create_light(Color(0.7f, 1.0f, .2f), 1.3f);
-
-        // Center circle
-        _eval(SDF::circle(pos, Vec2(), 0.2f), purple_mtl, nearest);
-
-        // BLACK - REFLECTIVE
-        float plane1_dist = SDF::plane(pos, {0, -0.70}, {0, 1});
-        float plane2_dist = SDF::plane(pos, {0, 0.70}, {0, -1});
-        float box1_dist = SDF::box(pos, {-0.7, 0}, {0.1, 1});
-        float box2_dist = SDF::box(pos, {0.7, 0}, {0.1, 1});
-
-        float circle_dist = SDF::circle(pos, Vec2(), 0.8f);
-        float planes = SDF::combine_union(plane1_dist, plane2_dist);
-        float boxes = SDF::combine_union(box1_dist, box2_dist);
-        float subtract = SDF::combine_union(circle_dist, boxes);
-        _eval(SDF::combine_subtract(planes, subtract), black_mtl, nearest);
-
-        // LIGHTS
-        Vec2 box_size(0.1f, 0.05f);
-        float box_light1 = SDF::box(pos, {-0.7, -1 + box_size.y}, box_size);
-        float box_light2 = SDF::box(pos, {-0.7,  1 - box_size.y}, box_size);
-        float box_light3 = SDF::box(pos, {+0.7, -1 + box_size.y}, box_size);
-        float box_light4 = SDF::box(pos, {+0.7,  1 - box_size.y}, box_size);
-        _eval(box_light1, light_purple_mtl, nearest);
-        _eval(box_light2, light_purple_mtl, nearest);
-        _eval(box_light3, light_purple_mtl, nearest);
-        _eval(box_light4, light_purple_mtl, nearest);
-
-
-        return nearest;
-    }
+        // Nothing moves, the whole scene is baked once for a sequence
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            return static_part(pos);
+        }
+    };
 
 
-    static Nearest rainbow_sdf(Vec2 pos, float time)
+    struct Rainbow
     {
-        Nearest nearest;
-        Color<float> colors[7];
-        colors[0] = Utils::gamma_exp(Color<float>(148, 0, 211) / 255.0f);
-        colors[1] = Utils::gamma_exp(Color<float>(75, 0, 130) / 255.0f);
-        colors[2] = Utils::gamma_exp(Color<float>(0, 0, 255) / 255.0f);
-        colors[3] = Utils::gamma_exp(Color<float>(0, 255, 0) / 255.0f);
-        colors[4] = Utils::gamma_exp(Color<float>(255, 255, 0) / 255.0f);
-        colors[5] = Utils::gamma_exp(Color<float>(255, 127, 0) / 255.0f);
-        colors[6] = Utils::gamma_exp(Color<float>(255, 0 , 0) / 255.0f);
-
-        float segment_length = 0.7f;
-        float box_height = 1.5f;
-        float spacing = box_height / 7.0f;
-        for (int i = 0; i < 7; i++)
-        {
-            Color color = colors[i];
-            float displacement = i * spacing;
-            float y = box_height * 0.5f - displacement;
-            Vec2 p0(-0.5f * segment_length, y);
-            Vec2 p1(0.5f * segment_length, y);
-            float line_distance = SDF::line(pos, p0, p1, 0.1f);
-            Material mtl = Material::create_light(color, 1.0f);
-            _eval(SDF::line(pos, p0, p1, 0.01f), mtl, nearest);
-        }
-        return nearest;
-    }
+        MaterialId colors[7];
 
-    static Nearest color_interpolation(Vec2 pos, float time)
+        explicit Rainbow(MaterialTable& materials)
+        {
+            Color<float> rgb[7] = {
+                Color<float>(148, 0, 211),
+                Color<float>(75, 0, 130),
+                Color<float>(0, 0, 255),
+                Color<float>(0, 255, 0),
+                Color<float>(255, 255, 0),
+                Color<float>(255, 127, 0),
+                Color<float>(255, 0 , 0)
+            };
+            for (int i = 0; i < 7; i++)
+                colors[i] = materials.add(Material::create_light(Utils::gamma_exp(rgb[i] / 255.0f), 1.0f));
+        }
+
+        Bounds bounds() const { return { -0.4f, -0.6f, 0.4f, 0.8f }; }
+        float lipschitz() const { return 1.0f; }
+        std::vector<LightShape> lights(float time) const
+        {
+            std::vector<LightShape> lines;
+            for (int i = 0; i < 7; i++)
+            {
+                float y = 0.75f - i * 1.5f / 7.0f;
+                lines.push_back(LightShape::segment(Vec2(-0.35f, y), Vec2(0.35f, y), 0.01f));
+            }
+            return lines;
+        }
+
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
+
+            float segment_length = 0.7f;
+            float box_height = 1.5f;
+            float spacing = box_height / 7.0f;
+            for (int i = 0; i < 7; i++)
+            {
+                float displacement = i * spacing;
+                float y = box_height * 0.5f - displacement;
+                Vec2 p0(-0.5f * segment_length, y);
+                Vec2 p1(0.5f * segment_length, y);
+                _eval(SDF::line(pos, p0, p1, 0.01f), colors[i], nearest);
+            }
+            return nearest;
+        }
+    };
+
+    struct ColorInterpolation
     {
-        Nearest nearest;
-        Material purple_light = Material::create_light(Utils::gamma_exp(Color(0.3f, 0.0f, .8f)), 1.0f);
-        Material red_light = Material::create_light(Utils::gamma_exp(Color(1.0f, 0.0f, 0.443f)), 1.0f);
+        MaterialId purple_light;
+        MaterialId red_light;
 
-        float k_smooth_factor = 0.3f;
+        explicit ColorInterpolation(MaterialTable& materials)
+            : purple_light(materials.add(Material::create_light(Utils::gamma_exp(Color(0.3f, 0.0f, .8f)), 1.0f))),
+              red_light(materials.add(Material::create_light(Utils::gamma_exp(Color(1.0f, 0.0f, 0.443f)), 1.0f))) {}
 
-        float line_x = SDF::line(pos, Vec2(-0.5, 0.0f), Vec2(0.5f, 0.0f), 0.05f);
-        float line_y = SDF::line(pos, Vec2(0.0f, -0.5f), Vec2(0.0f, 0.5f), 0.05f);
+        Bounds bounds() const { return { -0.65f, -0.65f, 0.65f, 0.65f }; }
+        float lipschitz() const { return 1.0f; }
 
-        float h = SDF::smooth_t(line_x, line_y, k_smooth_factor);
-        float objects = SDF::combine_union_s(line_x, line_y, k_smooth_factor, h);
-        auto interpolated_mtl = Material::mix(purple_light, red_light, h);
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
 
-        _eval(objects, interpolated_mtl, nearest);
+            float k_smooth_factor = 0.3f;
 
-        return nearest;
-    }
+            T line_x = SDF::line(pos, Vec2(-0.5, 0.0f), Vec2(0.5f, 0.0f), 0.05f);
+            T line_y = SDF::line(pos, Vec2(0.0f, -0.5f), Vec2(0.0f, 0.5f), 0.05f);
 
-    static Nearest intensity_interpolation(Vec2 pos, float time)
+            T h = SDF::smooth_t(line_x, line_y, k_smooth_factor);
+            T objects = SDF::combine_union_s(line_x, line_y, k_smooth_factor, h);
+            auto interpolated_mtl = MaterialBlend::mix(purple_light, red_light, h);
+
+            _eval(objects, interpolated_mtl, nearest);
+
+            return nearest;
+        }
+    };
+
+    struct IntensityInterpolation
     {
-        Nearest nearest;
-        Material purple_light = Material::create_light(Utils::gamma_exp(Color(0.3f, 0.0f, .8f)), 2.0f);
-        Material purple_light_darker = Material::create_light(Utils::gamma_exp(Color(0.3f, 0.0f, .8f)), 0.7f);
-        Material green_light = Material::create_light(Utils::gamma_exp(Color(0.7f, 1.0f, .2f)), 1.3f);
+        MaterialId purple_light;
+        MaterialId purple_light_darker;
+        MaterialId green_light;
+
+        explicit IntensityInterpolation(MaterialTable& materials)
+            : purple_light(materials.add(Material::create_light(Utils::gamma_exp(Color(0.3f, 0.0f, .8f)), 2.0f))),
+              purple_light_darker(materials.add(Material::create_light(Utils::gamma_exp(Color(0.3f, 0.0f, .8f)), 0.7f))),
+              green_light(materials.add(Material::create_light(Utils::gamma_exp(Color(0.7f, 1.0f, .2f)), 1.3f))) {}
 
-        // Central light
-        float radius = 0.3f;
-        float k_smooth_factor = 0.3f;
+        Bounds bounds() const { return { -0.65f, -0.65f, 0.7f, 0.65f }; }
+        float lipschitz() const { return 1.0f; }
+
+        template <typename T>
+        BasicNearest<T> operator()(Vector2<T> pos, float time) const
+        {
+            BasicNearest<T> nearest;
 
-        float line = SDF::line(pos, Vec2(-0.5), Vec2(0.0, 0.5f), 0.05f);
-        float circle1 = SDF::circle(pos, Vec2(0.3f, 0.0f), radius);
+            // Central light
+            float radius = 0.3f;
+            float k_smooth_factor = 0.3f;
 
-        float h = SDF::smooth_t(line, circle1, k_smooth_factor);
-        float objects = SDF::combine_union_s(line, circle1, k_smooth_factor, h);
-        auto interpolated_mtl = Material::mix(purple_light, purple_light_darker, h);
+            T line = SDF::line(pos, Vec2(-0.5), Vec2(0.0, 0.5f), 0.05f);
+            T circle1 = SDF::circle(pos, Vec2(0.3f, 0.0f), radius);
 
-        _eval(objects, interpolated_mtl, nearest);
+            T h = SDF::smooth_t(line, circle1, k_smooth_factor);
+            T objects = SDF::combine_union_s(line, circle1, k_smooth_factor, h);
+            auto interpolated_mtl = MaterialBlend::mix(purple_light, purple_light_darker, h);
+
+            _eval(objects, interpolated_mtl, nearest);
+
+            return nearest;
+        }
+    };
 
-        return nearest;
+    template <typename Visitor>
+    static void for_each_scene(Visitor visitor)
+    {
+        /*
+        Calls visitor(name, scene) with every scene of this file, compiled with its own
+        type. The name is the one used to select the scene from the command line
+        */
+        visitor("smooth_reflections", compile_scene<SmoothReflections>());
+        visitor("metaballs_3", compile_scene<Metaballs3>());
+        visitor("circle_cut", compile_scene<CircleCut>());
+        visitor("metaballs", compile_scene<Metaballs>());
+        visitor("glass_metaballs", compile_scene<GlassMetaballs>());
+        visitor("circular_lens", compile_scene<CircularLens>());
+        visitor("glass_absorption", compile_scene<GlassAbsorption>());
+        visitor("convex_lens", compile_scene<ConvexLens>());
+        visitor("concave_lens", compile_scene<ConcaveLens>());
+        visitor("semicircular_lens", compile_scene<SemicircularLens>());
+        visitor("sample_scene", compile_scene<SampleScene>());
+        visitor("metaballs_absorption", compile_scene<MetaballsAbsorption>());
+        visitor("caustics", compile_scene<Caustics>());
+        visitor("room_sdf", compile_scene<Room>());
+        visitor("rainbow_sdf", compile_scene<Rainbow>());
+        visitor("color_interpolation", compile_scene<ColorInterpolation>());
+        visitor("intensity_interpolation", compile_scene<IntensityInterpolation>());
+    }
+
+    static std::vector<std::pair<std::string, Scene>> all()
+    {
+        // Every scene, type erased
+        std::vector<std::pair<std::string, Scene>> scenes;
+        for_each_scene([&scenes](const char* name, const auto& scene) { scenes.push_back({ name, scene }); });
+        return scenes;
     }
 }
 
-#endif
\ No newline at end of file
+#endif